@@ -1,26 +1,22 @@
 #pragma once
 
-#include <cpp/LedStripWs2812b.hpp>
-
-#include <map>
+#include "Compositor.hpp"
+#include "FixedPoint.hpp"
+#include "LedStripDma.hpp"
+#include "OutputStage.hpp"
+#include "PhaseProfile.hpp"
+#include "SpscQueue.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <hardware/sync.h>
 #include <pico/multicore.h>
-#include <pico/lock_core.h>
-
-template <typename T>
-class ScopedLock
-{
-public:
-  ScopedLock(T* mtx) : mtx_(mtx)
-  {
-    mutex_enter_blocking(mtx_);
-  }
-  ~ScopedLock()
-  {
-    mutex_exit(mtx_);
-  }
-private:
-  T* mtx_;
-};
+#include <pico/time.h>
 
 enum class AnimationState
 {
@@ -46,7 +42,7 @@ public:
   void update(LEDBuffer& buffer)
   {
     auto t = get_absolute_time();
-    updateInternal(buffer, (float)absolute_time_diff_us(lastUpdate_, t) / 1000000.0f );
+    updateInternal(buffer, (uint32_t)absolute_time_diff_us(lastUpdate_, t));
     if (state_ == AnimationState::Starting)
     {
       state_ = AnimationState::Playing;
@@ -59,15 +55,46 @@ public:
   }
   void parameter(float t)
   {
-    t_ = t;
+    t_ = q16FromFloat(t);
   }
   AnimationState state()
   {
     return state_;
   }
+  // Static animations only change when they're played or given a new
+  // parameter, so there's no need to keep rendering them
+  virtual bool isStatic() const
+  {
+    return false;
+  }
 protected:
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) = 0;
-  float t_;
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) = 0;
+
+  // Move t_ along by deltaUs of a periodUs long loop, counting down loops_
+  // each time it wraps past loopLength
+  void advance(uint32_t deltaUs, uint32_t periodUs, q16 loopLength = Q16One)
+  {
+    if (state_ == AnimationState::Starting)
+    {
+      t_ = 0;
+      tRemainder_ = 0;
+    }
+    // Carry the remainder over so t_ doesn't drift from the clock
+    uint64_t scaled = ((uint64_t)deltaUs << 16) + tRemainder_;
+    t_ += (q16)(scaled / periodUs);
+    tRemainder_ = (uint32_t)(scaled % periodUs);
+    while (t_ > loopLength)
+    {
+      t_ -= Q16One;
+      if (loops_ > 0)
+      {
+        --loops_;
+      }
+    }
+  }
+
+  q16 t_;
+  uint32_t tRemainder_;
   int loops_;
   absolute_time_t playStart_;
   absolute_time_t lastUpdate_;
@@ -76,7 +103,11 @@ protected:
 
 class BlankAnimation : public Animation
 {
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+  virtual bool isStatic() const override
+  {
+    return true;
+  }
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
     for (int i=0; i < buffer.size(); ++i)
     {
@@ -89,8 +120,12 @@ class SolidAnimation : public Animation
 {
 public:
   SolidAnimation(RGBColor color) : color_(color) {}
+  virtual bool isStatic() const override
+  {
+    return true;
+  }
 protected:
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
     for (int i=0; i < buffer.size(); ++i)
     {
@@ -105,25 +140,10 @@ class FlashAnimation : public Animation
 public:
   FlashAnimation(RGBColor flashColor) : flashColor_(flashColor) {}
 protected:
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
-    if (state_ == AnimationState::Starting)
-    {
-      t_ = 0.0f;
-    }
-
-    // Animate
-    t_ += deltaT / flashPeriodSecs_;
-
-    float loopLength = loops_ > 1 ? 1.0f : 2.0f;
-    while (t_ > loopLength)
-    {
-      t_ -= 1.0f;
-      if (loops_ > 0)
-      {
-        --loops_;
-      }
-    }
+    // Animate, the last flash is followed by a full period off
+    advance(deltaUs, flashPeriodUs_, loops_ > 1 ? Q16One : 2 * Q16One);
 
     // Draw
     RGBColor color;
@@ -134,39 +154,29 @@ protected:
     }
   }
   RGBColor flashColor_;
-  float flashDutyCycle_ = 0.666f;
-  float flashPeriodSecs_ = 0.3f;
+  q16 flashDutyCycle_ = q16FromFloat(0.666f);
+  uint32_t flashPeriodUs_ = 300000;
 };
 
 class WaveAnimation : public Animation
 {
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+public:
+  WaveAnimation() : ramp_(147.0f, 0.8f, 0.4f) {}
+protected:
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
-    if (state_ == AnimationState::Starting)
-    {
-      t_ = 0.0f;
-    }
-
     // Animate
-    t_ += deltaT / 16.0f;
-
-    while (t_ > 1.0f)
-    {
-      t_ -= 1.0f;
-      if (loops_ > 0)
-      {
-        --loops_;
-      }
-    }
+    advance(deltaUs, 16000000);
 
-    // Draw
-    float mean = t_ * 16.0f - 4.0f;
+    // Draw a gaussian with a sigma of 2 LEDs
+    q16 mean = t_ * 16 - q16FromInt(4);
     for (int i=0; i < buffer.size(); ++i)
     {
-      float v = 0.4f * expf(-0.5 * powf((((float)i - mean)/2.0f), 2.0f));
-      buffer[i] = HSVColor{147.0f, 0.8f, v}.toRGB();
+      q16 v = gaussianQ16((q16FromInt(i) - mean) / 2);
+      buffer[i] = ramp_(v);
     }
   }
+  ColorRamp ramp_;
 };
 
 class PulseAnimation : public Animation
@@ -174,41 +184,29 @@ class PulseAnimation : public Animation
 public:
   PulseAnimation(RGBColor color) : color_(color) {}
 protected:
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
-    if (state_ == AnimationState::Starting)
-    {
-      t_ = 0.0f;
-    }
+    static constexpr q16 RampLength = q16FromFloat(0.3f);
 
     // Animate
-    t_ += deltaT / 16.0f;
-
-    while (t_ > 1.0f)
-    {
-      t_ -= 1.0f;
-      if (loops_ > 0)
-      {
-        --loops_;
-      }
-    }
+    advance(deltaUs, 16000000);
 
     // Draw
-    float v;
-    if (t_ < 0.3f)
+    q16 v;
+    if (t_ < RampLength)
     {
-      v = t_ / 0.3f;
+      v = (t_ << 16) / RampLength;
     }
-    else if (t_ >= 0.3f && t_ < 0.7)
+    else if (t_ < Q16One - RampLength)
     {
-      v = 1.0f;
+      v = Q16One;
     }
     else
     {
-      v = 1.0f - (t_ - 0.7f) / 0.3f;
+      v = Q16One - ((t_ - (Q16One - RampLength)) << 16) / RampLength;
     }
-    float brightness = v * 0.333f + 0.1f;
-    RGBColor color = color_ * brightness;
+    q16 brightness = q16Mul(q16Clamp(v, 0, Q16One), q16FromFloat(0.333f)) + q16FromFloat(0.1f);
+    RGBColor color = scaleColor(color_, brightness);
     for (int i=0; i < buffer.size(); ++i)
     {
       buffer[i] = color;
@@ -219,53 +217,47 @@ protected:
 
 class WiFiConnectAnimation : public Animation
 {
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+public:
+  WiFiConnectAnimation() : ramp_(200.0f, 0.7f, 0.5f) {}
+protected:
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
-    if (state_ == AnimationState::Starting)
-    {
-      t_ = 0.0f;
-    }
-
     // Animate
-    t_ += deltaT / 2.0f;
-
-    while (t_ > 1.0f)
-    {
-      t_ -= 1.0f;
-      if (loops_ > 0)
-      {
-        --loops_;
-      }
-    }
+    advance(deltaUs, 2000000);
 
     // Draw
-    float loc;
-    if (t_ < 0.5f)
+    q16 loc;
+    if (t_ < Q16One / 2)
     {
-      loc = t_ * 14.0f;
+      loc = t_ * 14;
     }
     else
     {
-      loc = 14.0f - (t_ * 14.0f);
+      loc = q16FromInt(14) - t_ * 14;
     }
 
     for (int i=0; i < buffer.size(); ++i)
     {
-      float v = std::clamp(1.0f - std::abs(loc - i), 0.0f, 1.0f);
-      buffer[i] = HSVColor{200.0f, 0.7f, 0.5f * v}.toRGB();
+      q16 v = Q16One - q16Abs(loc - q16FromInt(i));
+      buffer[i] = ramp_(v);
     }
   }
+  ColorRamp ramp_;
 };
 
 class ProgressAnimation : public Animation
 {
 public:
   ProgressAnimation(RGBColor color) : color_(color) {}
+  virtual bool isStatic() const override
+  {
+    return true;
+  }
 protected:
-  virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+  virtual void updateInternal(LEDBuffer& buffer, uint32_t deltaUs) override
   {
     // End when progress reaches 100%
-    if (t_ >= 1.0f)
+    if (t_ >= Q16One)
     {
       loops_ = 0;
     }
@@ -273,60 +265,269 @@ protected:
     // Draw
     for (int i=0; i < buffer.size(); ++i)
     {
-      float dist = t_ * 7.0f - i;
-      float v = std::clamp(dist + 1.0f, 0.25f, 1.0f);
-      buffer[i] = color_ * v;
+      q16 dist = t_ * 7 - q16FromInt(i);
+      q16 v = q16Clamp(dist + Q16One, Q16One / 4, Q16One);
+      buffer[i] = scaleColor(color_, v);
     }
   }
   RGBColor color_;
 };
 
 // Starts a process on core 1 to animate the LEDs
+//
+// The animations live in a fixed table indexed by Id, an enum class ending
+// in Count. Names are only there to look animations up from the serial
+// console, everything else goes straight to the table.
+//
+// Each frame is composited from LayerCount layers, each playing at most one
+// animation. Higher layers are drawn over lower ones with their own blend
+// mode and opacity. Layer 0 is the base, whatever shows when nothing else
+// plays, and its animation loops forever.
+//
+// Core 0 never touches the animations directly. It queues commands that
+// core 1 applies at the start of its next frame, and reads back what is
+// playing through atomics, so neither core ever waits for the other to
+// finish a frame.
+//
+// Frames go out at TargetFPS while the animation moves, and only when they
+// differ from the last one sent. Once only static animations are showing,
+// core 1 sleeps until the next command.
+template <typename Id>
 class Animator
 {
-private:
-  friend void updateThread();
+public:
+  static constexpr size_t Count = (size_t)Id::Count;
+  static constexpr int LayerCount = 4;
+
+  struct Entry
+  {
+    const char* name;
+    Animation* animation;
+  };
+
+  struct FrameStats
+  {
+    uint32_t rendered;
+    uint32_t written;
+  };
+
+  // How often and how long core 0 had to wait for room in the queue
+  struct Contention
+  {
+    uint32_t commands;
+    uint32_t waits;
+    uint32_t worstWaitUs;
+    uint64_t totalWaitUs;
+  };
+
+  // What core 1 spends a frame on
+  enum class FramePhase
+  {
+    Commands,
+    Composite,
+    Output,
+    Write,
+    Count
+  };
+
+  static constexpr const char* FramePhaseNames[] = {"commands", "composite", "output", "write"};
+
+  // Frames are late when they finish after the next one was due
   static constexpr uint64_t TargetFPS = 30;
   static constexpr uint64_t TargetFrameTimeUs = 1000000 / TargetFPS;
-  static constexpr float TargetFrameTimeSec = 1.0f / (float)TargetFPS;
-  static Animator* ptr;
-  LedStripWs2812b leds_;
+
+private:
+  static constexpr Id None = Id::Count;
+  static constexpr size_t QueueSize = 16;
+  static inline Animator* ptr = nullptr;
+
+  enum class CommandType : uint8_t
+  {
+    Play,
+    Stop,
+    Blend,
+    Parameter,
+    Brightness,
+  };
+
+  struct Command
+  {
+    CommandType type;
+    uint8_t layer;
+    Id id; // None for the parameter of the top animation showing
+    int loops;
+    float t;
+    BlendMode mode;
+    uint8_t value; // opacity or brightness
+  };
+
+  struct Layer
+  {
+    // Only core 1 writes this, core 0 just looks
+    std::atomic<Id> animation {None};
+    BlendMode mode = BlendMode::Normal;
+    uint8_t opacity = 255;
+  };
+
+  LedStripDma leds_;
   LEDBuffer buffer_;
+  LEDBuffer layerBuffer_;
+  std::vector<uint32_t> frame_;
+  OutputStage output_;
   absolute_time_t nextFrameTime_;
-  std::string baseAnimation_;
-  std::string overlayAnimation_;
-  std::map<std::string, std::unique_ptr<Animation>> animations_;
-  BlankAnimation blank_;
-  mutex_t mtx_;
+  std::array<Entry, Count> animations_;
+  std::array<Layer, LayerCount> layers_;
+
+  SpscQueue<Command, QueueSize> commands_;
+  Contention contention_ {};
+  bool idle_ = false;
+  std::atomic<uint32_t> framesRendered_ {0};
+  std::atomic<uint32_t> framesWritten_ {0};
+  std::atomic<bool> moving_ {false};
+  PhaseProfile<FramePhase> profile_ {FramePhaseNames};
+
+  Animation* get(Id id)
+  {
+    return animations_[(size_t)id].animation;
+  }
+
+  // The animation on the highest layer playing one, or nullptr
+  Animation* topAnim()
+  {
+    for (int i = LayerCount - 1; i >= 0; --i)
+    {
+      Id id = layers_[i].animation.load(std::memory_order_relaxed);
+      if (id != None)
+      {
+        return get(id);
+      }
+    }
+    return nullptr;
+  }
+
+  void send(const Command& cmd)
+  {
+    ++contention_.commands;
+    if (commands_.push(cmd))
+    {
+      // Core 1 may be asleep with nothing to animate
+      __sev();
+      return;
+    }
+    if (ptr != this)
+    {
+      // Core 1 isn't running yet, nobody is going to make room
+      return;
+    }
+    absolute_time_t start = get_absolute_time();
+    while (!commands_.push(cmd))
+    {
+      tight_loop_contents();
+    }
+    __sev();
+    uint32_t waitUs = (uint32_t)absolute_time_diff_us(start, get_absolute_time());
+    ++contention_.waits;
+    contention_.totalWaitUs += waitUs;
+    if (waitUs > contention_.worstWaitUs)
+    {
+      contention_.worstWaitUs = waitUs;
+    }
+  }
 
-  Animation* currentAnim()
+  void apply(const Command& cmd)
   {
-    if (!overlayAnimation_.empty())
+    Layer& layer = layers_[cmd.layer];
+    switch (cmd.type)
+    {
+    case CommandType::Play:
+      get(cmd.id)->play(cmd.layer == 0 ? -1 : cmd.loops);
+      layer.animation.store(cmd.id, std::memory_order_release);
+      break;
+    case CommandType::Stop:
+      if (layer.animation.load(std::memory_order_relaxed) != None)
+      {
+        get(layer.animation.load(std::memory_order_relaxed))->stop();
+      }
+      break;
+    case CommandType::Blend:
+      layer.mode = cmd.mode;
+      layer.opacity = cmd.value;
+      break;
+    case CommandType::Brightness:
+      output_.brightness(cmd.value);
+      break;
+    case CommandType::Parameter:
+      {
+        Animation* anim = cmd.id == None ? topAnim() : get(cmd.id);
+        if (anim)
+        {
+          anim->parameter(cmd.t);
+        }
+      }
+      break;
+    }
+  }
+
+  // Composite all the layers into frame_. Returns true if every animation
+  // drawn is static.
+  bool composite()
+  {
+    // Nothing under an opaque Normal layer can show, so start from the top one
+    int bottom = 0;
+    for (int i = LayerCount - 1; i > 0; --i)
     {
-      return animations_[overlayAnimation_].get();
+      const Layer& layer = layers_[i];
+      if (layer.animation.load(std::memory_order_relaxed) != None && layer.mode == BlendMode::Normal && layer.opacity == 255)
+      {
+        bottom = i;
+        break;
+      }
     }
-    else if (!baseAnimation_.empty())
+
+    std::fill(frame_.begin(), frame_.end(), 0);
+    bool allStatic = true;
+    for (int i = bottom; i < LayerCount; ++i)
     {
-      return animations_[baseAnimation_].get();
+      Layer& layer = layers_[i];
+      Id id = layer.animation.load(std::memory_order_relaxed);
+      if (id == None || layer.opacity == 0)
+      {
+        continue;
+      }
+      Animation* anim = get(id);
+      anim->update(layerBuffer_);
+      blendLayer(frame_.data(), layerBuffer_.data(), frame_.size(), layer.mode, layer.opacity);
+      allStatic &= anim->isStatic();
+
+      // Layers above the base go away once their animation is done
+      if (i > 0 && anim->state() == AnimationState::Stopped)
+      {
+        layer.animation.store(None, std::memory_order_release);
+      }
     }
-    return &blank_;
+    return allStatic;
   }
 
   static void updateThread()
   {
     multicore_lockout_victim_init();
+    startCycleCounter();
+    Animator::ptr->leds_.begin();
     while (1)
     {
       Animator::ptr->update();
     }
   }
 public:
-  Animator(uint pin, uint numleds) :
-    leds_(pin),
+  Animator(uint pin, uint numleds, const std::array<Entry, Count>& animations) :
+    leds_(pin, numleds),
     buffer_(numleds),
-    nextFrameTime_ { get_absolute_time() }
+    layerBuffer_(numleds),
+    frame_(numleds),
+    output_(numleds),
+    nextFrameTime_ { get_absolute_time() },
+    animations_(animations)
   {
-    mutex_init(&mtx_);
   }
 
   ~Animator()
@@ -343,71 +544,82 @@ public:
     multicore_launch_core1(updateThread);
   }
 
-  void addAnimation(const std::string name, std::unique_ptr<Animation> anim)
+  // Look up an animation by name, for the serial console
+  bool find(std::string_view name, Id& id) const
   {
-    ScopedLock lock(&mtx_);
-    animations_[name] = std::move(anim);
-  }
-
-  bool changeBaseAnimation(std::string name)
-  {
-    ScopedLock lock(&mtx_);
-    if (animations_.count(name) > 0)
+    for (size_t i = 0; i < Count; ++i)
     {
-      baseAnimation_ = name;
-      animations_[name]->play(-1);
-      return true;
+      if (name == animations_[i].name)
+      {
+        id = (Id)i;
+        return true;
+      }
     }
     return false;
   }
 
-  bool playAnimation(std::string name, int loops = 1)
+  void changeBaseAnimation(Id id)
+  {
+    playAnimation(0, id, -1);
+  }
+
+  void playAnimation(int layer, Id id, int loops = 1)
   {
-    ScopedLock lock(&mtx_);
-    if (animations_.count(name) > 0)
+    // Some get played again every loop just to keep them going, only
+    // changes are worth tracing
+    if (playing(layer) != id)
     {
-      overlayAnimation_ = name;
-      animations_[name]->play(loops);
-      return true;
+      Trace::record(TraceEvent::Animation, layer, (uint32_t)id);
     }
-    return false;
+    send({CommandType::Play, (uint8_t)layer, id, loops});
   }
 
-  void stopAnimation()
+  void stopAnimation(int layer)
   {
-    // lock
-    if (!overlayAnimation_.empty())
+    if (playing(layer) != None)
     {
-      animations_[overlayAnimation_]->stop();
+      Trace::record(TraceEvent::Animation, layer, Trace::NoArg);
     }
+    send({CommandType::Stop, (uint8_t)layer});
+  }
+
+  void blend(int layer, BlendMode mode, uint8_t opacity)
+  {
+    send({CommandType::Blend, (uint8_t)layer, None, 0, 0.0f, mode, opacity});
   }
 
+  // Limit how bright the strip gets, 255 is full brightness
+  void brightness(uint8_t limit)
+  {
+    send({CommandType::Brightness, 0, None, 0, 0.0f, BlendMode::Normal, limit});
+  }
+
+  // Parameter for the animation on the highest layer playing one
   void parameter(float t)
   {
-    ScopedLock lock(&mtx_);
-    currentAnim()->parameter(t);
+    send({CommandType::Parameter, 0, None, 0, t});
   }
 
-  void parameter(std::string animation, float t)
+  void parameter(Id id, float t)
   {
-    ScopedLock lock(&mtx_);
-    if (animations_.count(animation) > 0)
-    {
-      animations_[animation]->parameter(t);
-    }
+    send({CommandType::Parameter, 0, id, 0, t});
+  }
+
+  // What's playing on a layer, None if nothing is
+  Id playing(int layer) const
+  {
+    return layers_[layer].animation.load(std::memory_order_acquire);
   }
 
-  bool waitForAnimationComplete(int timeoutMs = -1)
+  bool waitForAnimationComplete(int layer, int timeoutMs = -1)
   {
     absolute_time_t startTime = get_absolute_time();
     while (1)
     {
+      // Once core 1 has taken every command, the layer it reports is current
+      if (commands_.drained() && playing(layer) == None)
       {
-        ScopedLock lock(&mtx_);
-        if (overlayAnimation_.empty())
-        {
-          return true;
-        }
+        return true;
       }
       if (timeoutMs >= 0 && to_ms_since_boot(get_absolute_time()) - to_ms_since_boot(startTime) > timeoutMs)
       {
@@ -416,23 +628,78 @@ public:
       sleep_ms(10);
     }
   }
-  void update()
+
+  // Core 0 only
+  Contention contention() const
   {
-    // Wait
-    sleep_until(nextFrameTime_);
-    nextFrameTime_ = make_timeout_time_us(TargetFrameTimeUs);
+    return contention_;
+  }
+
+  void resetContention()
+  {
+    contention_ = {};
+  }
+
+  FrameStats frameStats() const
+  {
+    return {framesRendered_.load(std::memory_order_relaxed), framesWritten_.load(std::memory_order_relaxed)};
+  }
+
+  void resetFrameStats()
+  {
+    framesRendered_.store(0, std::memory_order_relaxed);
+    framesWritten_.store(0, std::memory_order_relaxed);
+  }
+
+  // True while frames keep changing, false once what's showing stays put
+  bool moving() const
+  {
+    return moving_.load(std::memory_order_relaxed) || !commands_.drained();
+  }
+
+  // Core 1's frame timing, reset() takes effect on its next frame
+  PhaseProfile<FramePhase>& profile()
+  {
+    return profile_;
+  }
 
-    // If the overlay animation is stopped, clear it out
+  void update()
+  {
+    // Wait for the next frame, or with nothing moving, for the next command
+    if (idle_)
     {
-      ScopedLock lock(&mtx_);
-      if (!overlayAnimation_.empty() && animations_[overlayAnimation_]->state() == AnimationState::Stopped)
+      while (commands_.empty())
       {
-        overlayAnimation_.clear();
+        __wfe();
       }
-      currentAnim()->update(buffer_);
     }
-    leds_.writeColors(buffer_);
+    else
+    {
+      sleep_until(nextFrameTime_);
+    }
+    // A frame woken by a command is due now, a timed one when it was meant to
+    absolute_time_t frameDue = idle_ ? get_absolute_time() : nextFrameTime_;
+    nextFrameTime_ = make_timeout_time_us(TargetFrameTimeUs);
+    profile_.start();
+
+    // Catch up on commands from core 0
+    while (commands_.consume([this](const Command& cmd) { apply(cmd); }))
+    {
+    }
+    profile_.lap(FramePhase::Commands);
+
+    // Dither while things move, a frame that's going to stay up is rounded
+    idle_ = composite();
+    moving_.store(!idle_, std::memory_order_relaxed);
+    profile_.lap(FramePhase::Composite);
+    output_.process(frame_.data(), buffer_, !idle_);
+    profile_.lap(FramePhase::Output);
+    framesRendered_.store(framesRendered_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (leds_.writeColors(buffer_))
+    {
+      framesWritten_.store(framesWritten_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    profile_.lap(FramePhase::Write);
+    profile_.finish(absolute_time_diff_us(frameDue, get_absolute_time()) > (int64_t)TargetFrameTimeUs);
   }
 };
-
-Animator* Animator::ptr;
@@ -0,0 +1,126 @@
+#include "CheckpointStore.hpp"
+#include "FlashScheduler.hpp"
+
+#include <hardware/flash.h>
+
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+  // Just below the settings in the last sector
+  constexpr uint32_t StoreOffset = PICO_FLASH_SIZE_BYTES - 3 * FLASH_SECTOR_SIZE;
+  constexpr uint32_t SlotsPerSector = FLASH_SECTOR_SIZE / sizeof(CheckpointStore::Record);
+  constexpr uint32_t SlotCount = 2 * SlotsPerSector;
+}
+
+static_assert(sizeof(CheckpointStore::Record) == 64, "records must tile a page");
+
+bool CheckpointStore::load(Record& record)
+{
+  bool found = false;
+  uint32_t latest = 0;
+  for (uint32_t slot = 0; slot < SlotCount; ++slot)
+  {
+    // Sequence numbers only wrap after far more checkpoints than the flash
+    // would survive, so the biggest is the latest
+    if (slotValid(slot) && (!found || slotRecord(slot)->sequence > slotRecord(latest)->sequence))
+    {
+      latest = slot;
+      found = true;
+    }
+  }
+
+  if (!found)
+  {
+    nextSlot_ = 0;
+    sequence_ = 0;
+    return false;
+  }
+
+  record = *slotRecord(latest);
+  sequence_ = record.sequence;
+
+  // Skip anything half written after it. Once the sector is used up the
+  // next save erases the other one.
+  nextSlot_ = latest + 1;
+  while (nextSlot_ % SlotsPerSector != 0 && !slotErased(nextSlot_))
+  {
+    nextSlot_++;
+  }
+  nextSlot_ %= SlotCount;
+  return true;
+}
+
+void CheckpointStore::save(Record record)
+{
+  record.magic = Magic;
+  record.sequence = ++sequence_;
+  record.reserved[0] = 0;
+  record.reserved[1] = 0;
+  record.checksum = checksum(record);
+
+  // Program the whole page around the slot, erased bytes leave the other
+  // records as they are
+  static uint8_t page[FLASH_PAGE_SIZE];
+  uint32_t offset = slotOffset(nextSlot_);
+  uint32_t pageOffset = offset & ~(FLASH_PAGE_SIZE - 1);
+  memset(page, 0xff, sizeof(page));
+  memcpy(page + (offset - pageOffset), &record, sizeof(record));
+
+  static_assert(FlashScheduler::CheckpointWindows >= 2, "a checkpoint save doesn't fit the flash queue");
+  if (nextSlot_ % SlotsPerSector == 0)
+  {
+    FlashScheduler::erase(offset, TraceFlash::Checkpoint);
+  }
+  FlashScheduler::program(pageOffset, page, TraceFlash::Checkpoint);
+
+  nextSlot_ = (nextSlot_ + 1) % SlotCount;
+  saves_++;
+}
+
+uint32_t CheckpointStore::saves() const
+{
+  return saves_;
+}
+
+uint32_t CheckpointStore::checksum(const Record& record)
+{
+  // FNV-1a over everything before the checksum
+  uint32_t hash = 2166136261u;
+  const uint8_t* bytes = (const uint8_t*)&record;
+  for (size_t i = 0; i < offsetof(Record, checksum); ++i)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t CheckpointStore::slotOffset(uint32_t slot)
+{
+  return StoreOffset + slot * sizeof(Record);
+}
+
+const CheckpointStore::Record* CheckpointStore::slotRecord(uint32_t slot)
+{
+  return (const Record*)(XIP_BASE + slotOffset(slot));
+}
+
+bool CheckpointStore::slotValid(uint32_t slot)
+{
+  const Record* record = slotRecord(slot);
+  return record->magic == Magic && record->checksum == checksum(*record);
+}
+
+bool CheckpointStore::slotErased(uint32_t slot)
+{
+  const uint8_t* bytes = (const uint8_t*)slotRecord(slot);
+  for (size_t i = 0; i < sizeof(Record); ++i)
+  {
+    if (bytes[i] != 0xff)
+    {
+      return false;
+    }
+  }
+  return true;
+}
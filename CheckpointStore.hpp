@@ -0,0 +1,52 @@
+#pragma once
+
+#include "WiFiLink.hpp"
+
+#include <stdint.h>
+
+// Remembers what the clock read and how we got on the WiFi in flash, so
+// after a reboot or a power blip the schedule can carry on from an estimate
+// right away, and the link comes back without a scan or waiting on DHCP.
+//
+// Checkpoints are small records appended to a log over two flash sectors.
+// Appending only needs a page program, and a sector is erased once per 64
+// checkpoints, always the one not holding the latest record.
+class CheckpointStore
+{
+public:
+  struct Record
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint64_t utcUs;      // UTC microseconds since 1970 when it was saved, 0 if unknown
+    int32_t driftPpb;    // the timer's drift estimate
+    uint32_t ntpAddress; // the time server's IPv4 address, 0 if unknown
+    WiFiLink::Cache wifi;
+    uint32_t reserved[2];
+    uint32_t checksum;
+  };
+
+  // Find the latest checkpoint. False if there is none.
+  bool load(Record& record);
+
+  // Append a checkpoint. Call load() first so it goes after the latest one.
+  // The magic, sequence and checksum are filled in here, the writing is
+  // queued with FlashScheduler.
+  void save(Record record);
+
+  uint32_t saves() const;
+
+private:
+  static constexpr uint32_t Magic = 0x434b5032;
+  static constexpr uint32_t SectorCount = 2;
+
+  static uint32_t checksum(const Record& record);
+  static uint32_t slotOffset(uint32_t slot);
+  static const Record* slotRecord(uint32_t slot);
+  static bool slotValid(uint32_t slot);
+  static bool slotErased(uint32_t slot);
+
+  uint32_t nextSlot_ = 0;
+  uint32_t sequence_ = 0;
+  uint32_t saves_ = 0;
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+// Splitting up and parsing serial commands in place, without allocating.
+// A line is cut into string_view tokens that point straight into the input
+// buffer, numbers are parsed from those, and the command names are looked up
+// in perfect hash tables built at compile time.
+
+// The whitespace separated tokens of a line
+class Tokens
+{
+public:
+  constexpr explicit Tokens(std::string_view line) :
+    rest_(line)
+  {
+  }
+
+  // The next token, empty once the line is used up
+  constexpr std::string_view next()
+  {
+    skipSpace();
+    size_t end = 0;
+    while (end < rest_.size() && !isSpace(rest_[end]))
+    {
+      end++;
+    }
+    std::string_view token = rest_.substr(0, end);
+    rest_.remove_prefix(end);
+    return token;
+  }
+
+  // Everything left on the line without the surrounding whitespace, for
+  // values that may have spaces in them
+  constexpr std::string_view rest()
+  {
+    skipSpace();
+    std::string_view rest = rest_;
+    while (!rest.empty() && isSpace(rest.back()))
+    {
+      rest.remove_suffix(1);
+    }
+    rest_ = {};
+    return rest;
+  }
+
+private:
+  static constexpr bool isSpace(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  constexpr void skipSpace()
+  {
+    while (!rest_.empty() && isSpace(rest_.front()))
+    {
+      rest_.remove_prefix(1);
+    }
+  }
+
+  std::string_view rest_;
+};
+
+// Parse a whole token as a number. False if it isn't one, or there's
+// anything left over after it.
+template <typename T>
+bool parseNumber(std::string_view s, T& value)
+{
+  const char* end = s.data() + s.size();
+  auto result = std::from_chars(s.data(), end, value);
+  return !s.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// The arm toolchain's from_chars has no floating point yet, so floats go
+// through strtof on a copy that's null terminated
+inline bool parseNumber(std::string_view s, float& value)
+{
+  char buf[32];
+  if (s.empty() || s.size() >= sizeof(buf))
+  {
+    return false;
+  }
+  memcpy(buf, s.data(), s.size());
+  buf[s.size()] = '\0';
+  char* end = nullptr;
+  value = strtof(buf, &end);
+  return end == buf + s.size();
+}
+
+// FNV-1a, seeded so a table can pick a seed that spreads its names out
+constexpr uint32_t commandHash(std::string_view name, uint32_t seed)
+{
+  uint32_t hash = 2166136261u ^ seed;
+  for (char c : name)
+  {
+    hash = (hash ^ (uint8_t)c) * 16777619u;
+  }
+  // The low bits pick the slot, but on their own they only ever see the
+  // low bits of the seed, so fold the high ones in
+  return hash ^ (hash >> 16);
+}
+
+template <typename Handler>
+struct CommandEntry
+{
+  std::string_view name;
+  Handler handler;
+};
+
+// Maps command names to handlers with a perfect hash: the constructor
+// searches for a seed that gives every name a slot of its own, so a lookup
+// is one hash and one compare however many names there are. Build it
+// constexpr with makeCommandTable() and the search happens at compile time.
+template <typename Handler, size_t N>
+class CommandTable
+{
+public:
+  // A power of two at least twice the names, so seeds are quick to find
+  static constexpr size_t Slots = []
+  {
+    size_t slots = 1;
+    while (slots < 2 * N)
+    {
+      slots *= 2;
+    }
+    return slots;
+  }();
+  static constexpr uint32_t MaxSeed = 100000;
+
+  constexpr CommandTable(const CommandEntry<Handler> (&entries)[N])
+  {
+    for (size_t i = 0; i < N; ++i)
+    {
+      entries_[i] = entries[i];
+    }
+    for (seed_ = 0; seed_ < MaxSeed; ++seed_)
+    {
+      if (fill())
+      {
+        return;
+      }
+    }
+  }
+
+  // False if no seed worked, e.g. the same name is in twice
+  constexpr bool valid() const
+  {
+    return seed_ < MaxSeed;
+  }
+
+  // The handler for a name, nullptr if there's none
+  constexpr Handler find(std::string_view name) const
+  {
+    uint8_t i = slots_[commandHash(name, seed_) & (Slots - 1)];
+    return (i != 0 && entries_[i - 1].name == name) ? entries_[i - 1].handler : nullptr;
+  }
+
+  constexpr size_t size() const
+  {
+    return N;
+  }
+
+  constexpr const CommandEntry<Handler>& entry(size_t i) const
+  {
+    return entries_[i];
+  }
+
+private:
+  static_assert(N < 256, "slots hold 8 bit indices");
+
+  // Place every name with the current seed, false on a collision
+  constexpr bool fill()
+  {
+    for (size_t s = 0; s < Slots; ++s)
+    {
+      slots_[s] = 0;
+    }
+    for (size_t i = 0; i < N; ++i)
+    {
+      size_t s = commandHash(entries_[i].name, seed_) & (Slots - 1);
+      if (slots_[s] != 0)
+      {
+        return false;
+      }
+      slots_[s] = (uint8_t)(i + 1);
+    }
+    return true;
+  }
+
+  CommandEntry<Handler> entries_[N] = {};
+  uint8_t slots_[Slots] = {}; // index + 1 into entries_, 0 for empty
+  uint32_t seed_ = 0;
+};
+
+template <typename Handler, size_t N>
+constexpr CommandTable<Handler, N> makeCommandTable(const CommandEntry<Handler> (&entries)[N])
+{
+  return CommandTable<Handler, N>(entries);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Blending animation layers into one frame. Colors are packed 0x00RRGGBB so
+// the common modes can work on red and blue together in one 32 bit word,
+// with green in another, and never overflow into the next channel.
+
+enum class BlendMode : uint8_t
+{
+  Normal,   // cover what's below
+  Add,      // add to what's below, saturating
+  Lighten,  // the brighter of the two, per channel
+  Multiply, // darken what's below
+  Count
+};
+
+constexpr uint32_t RBMask = 0x00FF00FF;
+constexpr uint32_t GMask = 0x0000FF00;
+
+inline uint32_t packColor(RGBColor c)
+{
+  return ((uint32_t)c.r << 16) | ((uint32_t)c.g << 8) | c.b;
+}
+
+inline RGBColor unpackColor(uint32_t c)
+{
+  return {(uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c};
+}
+
+// a + (b - a) * alpha / 256 for all three channels, alpha in 0..256
+inline uint32_t lerpPacked(uint32_t a, uint32_t b, uint32_t alpha)
+{
+  uint32_t rb = (((a & RBMask) * (256 - alpha) + (b & RBMask) * alpha) >> 8) & RBMask;
+  uint32_t g = (((a & GMask) * (256 - alpha) + (b & GMask) * alpha) >> 8) & GMask;
+  return rb | g;
+}
+
+inline uint32_t addPacked(uint32_t a, uint32_t b)
+{
+  // Each channel has room above it for the carry, which turns into 0xFF
+  uint32_t rb = (a & RBMask) + (b & RBMask);
+  uint32_t g = (a & GMask) + (b & GMask);
+  uint32_t rbCarry = rb & 0x01000100;
+  uint32_t gCarry = g & 0x00010000;
+  rb |= rbCarry - (rbCarry >> 8);
+  g |= gCarry - (gCarry >> 8);
+  return (rb & RBMask) | (g & GMask);
+}
+
+inline uint32_t lightenPacked(uint32_t a, uint32_t b)
+{
+  uint32_t r = (a & 0xFF0000) > (b & 0xFF0000) ? (a & 0xFF0000) : (b & 0xFF0000);
+  uint32_t g = (a & GMask) > (b & GMask) ? (a & GMask) : (b & GMask);
+  uint32_t bl = (a & 0xFF) > (b & 0xFF) ? (a & 0xFF) : (b & 0xFF);
+  return r | g | bl;
+}
+
+inline uint32_t multiplyPacked(uint32_t a, uint32_t b)
+{
+  // x * y / 255 per channel, the + 255 rounds 255 * 255 back up to 255
+  uint32_t r = (((a >> 16) & 0xFF) * ((b >> 16) & 0xFF) + 255) >> 8;
+  uint32_t g = (((a >> 8) & 0xFF) * ((b >> 8) & 0xFF) + 255) >> 8;
+  uint32_t bl = ((a & 0xFF) * (b & 0xFF) + 255) >> 8;
+  return (r << 16) | (g << 8) | bl;
+}
+
+// Blend one layer over the frame so far. Fully transparent layers leave
+// it alone and opaque Normal ones just overwrite it.
+inline void blendLayer(uint32_t* frame, const RGBColor* layer, size_t n, BlendMode mode, uint8_t opacity)
+{
+  if (opacity == 0)
+  {
+    return;
+  }
+  if (mode == BlendMode::Normal && opacity == 255)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      frame[i] = packColor(layer[i]);
+    }
+    return;
+  }
+
+  // 255 is opaque, so stretch opacity to 0..256 for the shifts
+  uint32_t alpha = opacity + (opacity >> 7);
+  for (size_t i = 0; i < n; ++i)
+  {
+    uint32_t below = frame[i];
+    uint32_t c = packColor(layer[i]);
+    switch (mode)
+    {
+    case BlendMode::Add: c = addPacked(below, c); break;
+    case BlendMode::Lighten: c = lightenPacked(below, c); break;
+    case BlendMode::Multiply: c = multiplyPacked(below, c); break;
+    default: break;
+    }
+    frame[i] = alpha == 256 ? c : lerpPacked(below, c, alpha);
+  }
+}
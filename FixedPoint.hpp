@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cpp/Color.hpp>
+
+#include <stdint.h>
+
+// Q16.16 fixed point for the animations. Core 1 is a Cortex-M0+ with no FPU,
+// so every float op per pixel is a call into the soft-float library.
+typedef int32_t q16;
+
+constexpr q16 Q16One = 1 << 16;
+
+constexpr q16 q16FromFloat(float f)
+{
+  return (q16)(f * (float)Q16One + (f >= 0.0f ? 0.5f : -0.5f));
+}
+
+constexpr q16 q16FromInt(int i)
+{
+  return (q16)i << 16;
+}
+
+constexpr q16 q16Mul(q16 a, q16 b)
+{
+  return (q16)(((int64_t)a * b) >> 16);
+}
+
+constexpr q16 q16Clamp(q16 v, q16 lo, q16 hi)
+{
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+constexpr q16 q16Abs(q16 v)
+{
+  return v < 0 ? -v : v;
+}
+
+// Scale a color by s in [0, 1]. Truncates like RGBColor * float does.
+inline RGBColor scaleColor(RGBColor c, q16 s)
+{
+  return
+  {
+    (uint8_t)((c.r * (uint32_t)s) >> 16),
+    (uint8_t)((c.g * (uint32_t)s) >> 16),
+    (uint8_t)((c.b * (uint32_t)s) >> 16),
+  };
+}
+
+// exp(-x^2 / 2) for x >= 0, linearly interpolated from a table in 1/32 steps.
+// It's under 1/3000 past x = 4, so that's treated as 0.
+inline q16 gaussianQ16(q16 x)
+{
+  // round(65536 * exp(-0.5 * (i / 32)^2)), with the first entry capped to fit
+  static const uint16_t table[130] =
+  {
+    65535, 65504, 65408, 65249, 65026, 64741, 64394, 63987, 63520, 62995,
+    62413, 61776, 61086, 60345, 59555, 58717, 57835, 56911, 55947, 54945,
+    53908, 52840, 51742, 50618, 49469, 48300, 47112, 45908, 44692, 43465,
+    42231, 40991, 39750, 38508, 37268, 36034, 34806, 33587, 32379, 31185,
+    30005, 28841, 27696, 26570, 25465, 24382, 23322, 22287, 21276, 20292,
+    19335, 18404, 17502, 16627, 15780, 14963, 14173, 13412, 12680, 11976,
+    11300, 10652, 10031, 9437, 8869, 8328, 7812, 7321, 6854, 6410,
+    5990, 5591, 5214, 4858, 4521, 4204, 3905, 3624, 3360, 3112,
+    2879, 2662, 2458, 2268, 2090, 1925, 1771, 1627, 1494, 1370,
+    1255, 1149, 1051, 960, 876, 799, 728, 663, 602, 547,
+    496, 450, 408, 369, 333, 301, 272, 245, 220, 198,
+    178, 160, 143, 128, 115, 103, 92, 82, 73, 65,
+    58, 51, 46, 41, 36, 32, 28, 25, 22, 19,
+  };
+  constexpr int FracBits = 16 - 5;
+
+  x = q16Abs(x);
+  uint32_t i = (uint32_t)x >> FracBits;
+  if (i >= 128)
+  {
+    return 0;
+  }
+  int32_t frac = x & ((1 << FracBits) - 1);
+  int32_t a = table[i];
+  int32_t b = table[i + 1];
+  return a + (((b - a) * frac) >> FracBits);
+}
+
+// HSV to RGB for a fixed hue and saturation, precomputed for 256 values
+// from 0 up to maxV. Building it is float math, so do that once up front.
+class ColorRamp
+{
+public:
+  ColorRamp(float h, float s, float maxV)
+  {
+    for (int i = 0; i < 256; ++i)
+    {
+      table_[i] = HSVColor{h, s, maxV * (float)i / 255.0f}.toRGB();
+    }
+  }
+
+  // v in [0, 1] of maxV
+  RGBColor operator()(q16 v) const
+  {
+    return table_[((uint32_t)q16Clamp(v, 0, Q16One) * 255 + Q16One / 2) >> 16];
+  }
+
+private:
+  RGBColor table_[256];
+};
@@ -0,0 +1,166 @@
+#include "FlashScheduler.hpp"
+
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#include <pico/multicore.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  struct Window
+  {
+    uint32_t offset;
+    bool erase;
+    TraceFlash what;
+    uint8_t page[FLASH_PAGE_SIZE];
+  };
+
+  Window queue[FlashScheduler::QueueSize];
+  size_t head = 0;
+  size_t count = 0;
+  // When the window at the head of the queue got there
+  absolute_time_t headSince = nil_time;
+
+  FlashScheduler::Stats counters {};
+
+  Window& push()
+  {
+    if (count == FlashScheduler::QueueSize)
+    {
+      // Make room the old way
+      counters.forced++;
+      FlashScheduler::flush();
+    }
+    if (count == 0)
+    {
+      headSince = get_absolute_time();
+    }
+    return queue[(head + count++) % FlashScheduler::QueueSize];
+  }
+
+  void runHead()
+  {
+    Window& window = queue[head];
+    Trace::record(TraceEvent::FlashBegin, (uint16_t)window.what, window.erase);
+    absolute_time_t start = get_absolute_time();
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    if (window.erase)
+    {
+      flash_range_erase(window.offset, FLASH_SECTOR_SIZE);
+    }
+    else
+    {
+      flash_range_program(window.offset, window.page, FLASH_PAGE_SIZE);
+    }
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+    uint32_t lockoutUs = (uint32_t)absolute_time_diff_us(start, get_absolute_time());
+    Trace::record(TraceEvent::FlashEnd, (uint16_t)window.what, lockoutUs);
+
+    counters.lastLockoutUs = lockoutUs;
+    counters.totalLockoutUs += lockoutUs;
+    if (window.erase)
+    {
+      counters.erases++;
+      counters.worstEraseUs = lockoutUs > counters.worstEraseUs ? lockoutUs : counters.worstEraseUs;
+    }
+    else
+    {
+      counters.programs++;
+      counters.worstProgramUs = lockoutUs > counters.worstProgramUs ? lockoutUs : counters.worstProgramUs;
+    }
+
+    head = (head + 1) % FlashScheduler::QueueSize;
+    count--;
+    headSince = get_absolute_time();
+  }
+}
+
+void FlashScheduler::erase(uint32_t offset, TraceFlash what)
+{
+  Window& window = push();
+  window.offset = offset;
+  window.erase = true;
+  window.what = what;
+}
+
+void FlashScheduler::program(uint32_t offset, const uint8_t* page, TraceFlash what)
+{
+  Window& window = push();
+  window.offset = offset;
+  window.erase = false;
+  window.what = what;
+  memcpy(window.page, page, FLASH_PAGE_SIZE);
+}
+
+void FlashScheduler::program(uint32_t offset, const uint8_t* data, size_t len, TraceFlash what)
+{
+  // Erased bytes program as nothing, which leaves what's already there
+  static uint8_t page[FLASH_PAGE_SIZE];
+  uint32_t first = offset & ~(FLASH_PAGE_SIZE - 1);
+  for (uint32_t pageOffset = first; pageOffset < offset + len; pageOffset += FLASH_PAGE_SIZE)
+  {
+    memset(page, 0xff, sizeof(page));
+    uint32_t from = pageOffset > offset ? pageOffset : offset;
+    uint32_t to = pageOffset + FLASH_PAGE_SIZE < offset + len ? pageOffset + FLASH_PAGE_SIZE : offset + len;
+    memcpy(page + (from - pageOffset), data + (from - offset), to - from);
+    program(pageOffset, page, what);
+  }
+}
+
+bool FlashScheduler::pending()
+{
+  return count > 0;
+}
+
+void FlashScheduler::step(absolute_time_t nextDeadline, bool ledsMoving)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  bool erase = queue[head].erase;
+  int64_t quietUs = absolute_time_diff_us(get_absolute_time(), nextDeadline);
+  int64_t neededUs = ProgramQuietUs;
+  if (erase)
+  {
+    neededUs = std::max<int64_t>(EraseQuietUs, (int64_t)counters.worstEraseUs + EraseMarginUs);
+  }
+  if (quietUs < neededUs)
+  {
+    counters.deferrals++;
+    return;
+  }
+  if (erase && ledsMoving)
+  {
+    if (absolute_time_diff_us(headSince, get_absolute_time()) < (int64_t)MaxEraseDeferMs * 1000)
+    {
+      counters.deferrals++;
+      return;
+    }
+    counters.forced++;
+  }
+  runHead();
+}
+
+void FlashScheduler::flush()
+{
+  while (count > 0)
+  {
+    runHead();
+  }
+}
+
+FlashScheduler::Stats FlashScheduler::stats()
+{
+  return counters;
+}
+
+void FlashScheduler::resetStats()
+{
+  counters = {};
+}
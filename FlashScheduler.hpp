@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Trace.hpp"
+
+#include <hardware/flash.h>
+
+#include <pico/time.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes to flash in the background, a little at a time, when nobody will
+// notice. Erasing or programming flash takes core 1 off the bus and holds
+// off interrupts, so done on the spot a settings save froze the LEDs and
+// could make a pump alarm late.
+//
+// The stores queue sector erases and page programs here instead, and the
+// main loop calls step() to run one of them per lockout window: a page
+// program only when no pump is about to switch, a sector erase also only
+// while the LEDs are still. An erase that's been put off for long enough
+// goes ahead while they move, so a save can't wait forever.
+//
+// Core 0 only. Reads of the flash see what's been written so far, so the
+// stores keep what they've queued in RAM.
+class FlashScheduler
+{
+public:
+  // Erases and pages waiting at once, enough for every store to have a
+  // compaction queued together: a full Schedule snapshot, a settings one and
+  // a checkpoint. The stores check their share of it. When it's full the
+  // oldest go out right away, all in one long lockout.
+  static constexpr size_t ScheduleWindows = 10;
+  static constexpr size_t SettingsWindows = 4;
+  static constexpr size_t CheckpointWindows = 2;
+  static constexpr size_t QueueSize = ScheduleWindows + SettingsWindows + CheckpointWindows;
+
+  // Windows to erase a sector and write len bytes from its start
+  static constexpr size_t compactionWindows(size_t len)
+  {
+    return 1 + (len + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+  }
+  // Nothing time critical may be due this soon after a window starts. A
+  // page program takes up to 3 ms and a sector erase up to 400 ms (the
+  // W25Q16JV's worst cases), plus margin. An erase also waits for longer
+  // if one has been seen to take that long.
+  static constexpr uint32_t ProgramQuietUs = 5000;
+  static constexpr uint32_t EraseQuietUs = 500000;
+  static constexpr uint32_t EraseMarginUs = 100000;
+  static constexpr uint32_t MaxEraseDeferMs = 30000;
+
+  struct Stats
+  {
+    uint32_t erases;
+    uint32_t programs;
+    uint32_t deferrals;   // steps that found it wasn't a good time
+    uint32_t forced;      // windows opened anyway, for a full queue or a long wait
+    uint32_t lastLockoutUs;
+    uint32_t worstEraseUs;
+    uint32_t worstProgramUs;
+    uint64_t totalLockoutUs;
+  };
+
+  // Queue erasing the sector at offset
+  static void erase(uint32_t offset, TraceFlash what);
+
+  // Queue programming the page at offset with a copy of page
+  static void program(uint32_t offset, const uint8_t* page, TraceFlash what);
+
+  // Queue programming len bytes at offset, a page at a time. They needn't
+  // start or end on a page, the rest of the pages is left as it is.
+  static void program(uint32_t offset, const uint8_t* data, size_t len, TraceFlash what);
+
+  // True while anything is waiting to be written
+  static bool pending();
+
+  // Run the next window if it can't get in the way. nextDeadline is when
+  // something time critical, like a pump switching, happens next.
+  static void step(absolute_time_t nextDeadline, bool ledsMoving);
+
+  // Write out everything now, before a reboot
+  static void flush();
+
+  static Stats stats();
+  static void resetStats();
+};
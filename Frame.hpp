@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Framing for the binary serial protocol. A frame on the wire is a 0, the
+// COBS encoded payload, and another 0. COBS never puts a 0 in what it
+// encodes, so the delimiters can't be mistaken for data, and because text
+// commands never contain a 0 either, a leading 0 is all it takes to tell a
+// binary frame from a line of text on the same serial port.
+//
+// Payloads start with a magic, end with a CRC-16 over everything before it,
+// and are checked by FrameReceiver before anyone sees them.
+
+// CRC-16/CCITT-FALSE
+inline uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xffff)
+{
+  for (size_t i = 0; i < len; ++i)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; ++bit)
+    {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// The most COBS adds to n bytes
+constexpr size_t cobsMaxEncoded(size_t n)
+{
+  return n + n / 254 + 1;
+}
+
+// Encode len bytes into out, which needs cobsMaxEncoded(len). Returns the
+// encoded length.
+inline size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out)
+{
+  size_t codePos = 0;
+  size_t o = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (in[i] != 0)
+    {
+      out[o++] = in[i];
+      code++;
+    }
+    if (in[i] == 0 || code == 0xff)
+    {
+      out[codePos] = code;
+      codePos = o++;
+      code = 1;
+    }
+  }
+  out[codePos] = code;
+  return o;
+}
+
+// Decode len bytes into out, which may be in itself. Returns the decoded
+// length, or 0 if the input isn't valid COBS.
+inline size_t cobsDecode(const uint8_t* in, size_t len, uint8_t* out)
+{
+  size_t i = 0;
+  size_t o = 0;
+  while (i < len)
+  {
+    uint8_t code = in[i++];
+    if (code == 0 || i + code - 1 > len)
+    {
+      return 0;
+    }
+    for (uint8_t k = 1; k < code; ++k)
+    {
+      out[o++] = in[i++];
+    }
+    if (code != 0xff && i < len)
+    {
+      out[o++] = 0;
+    }
+  }
+  return o;
+}
+
+// Collects the bytes of one frame at a time off the serial port
+class FrameReceiver
+{
+public:
+  static constexpr uint8_t Magic0 = 'S';
+  static constexpr uint8_t Magic1 = 'V';
+  static constexpr size_t MaxPayload = 1024;
+  // Magic, sequence number and CRC around the operations
+  static constexpr size_t HeaderSize = 3;
+  static constexpr size_t Overhead = HeaderSize + 2;
+
+  // True while between a frame's delimiters, when bytes belong to it
+  bool receiving() const
+  {
+    return receiving_;
+  }
+
+  // Feed the next byte. Returns true when it completed a good frame, which
+  // stays in payload() until the next byte is pushed.
+  bool push(uint8_t c)
+  {
+    if (!receiving_)
+    {
+      if (c == 0)
+      {
+        receiving_ = true;
+        len_ = 0;
+        overflow_ = false;
+      }
+      return false;
+    }
+
+    if (c != 0)
+    {
+      if (len_ < sizeof(buf_))
+      {
+        buf_[len_++] = c;
+      }
+      else
+      {
+        overflow_ = true;
+      }
+      return false;
+    }
+
+    // Back to back delimiters are just the start of a frame again
+    if (len_ == 0)
+    {
+      return false;
+    }
+    receiving_ = false;
+    size_t n = overflow_ ? 0 : cobsDecode(buf_, len_, buf_);
+    if (n < Overhead || buf_[0] != Magic0 || buf_[1] != Magic1 ||
+        crc16(buf_, n - 2) != (uint16_t)(buf_[n - 2] | buf_[n - 1] << 8))
+    {
+      errors_++;
+      return false;
+    }
+    size_ = n - 2;
+    frames_++;
+    return true;
+  }
+
+  // The good frame's payload, magic and sequence number included, CRC not
+  const uint8_t* payload() const
+  {
+    return buf_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  uint32_t frames() const
+  {
+    return frames_;
+  }
+
+  // Frames thrown away for a bad CRC, magic or encoding, or for being too long
+  uint32_t errors() const
+  {
+    return errors_;
+  }
+
+  void resetStats()
+  {
+    frames_ = 0;
+    errors_ = 0;
+  }
+
+private:
+  uint8_t buf_[cobsMaxEncoded(MaxPayload)];
+  size_t len_ = 0;
+  size_t size_ = 0;
+  bool receiving_ = false;
+  bool overflow_ = false;
+  uint32_t frames_ = 0;
+  uint32_t errors_ = 0;
+};
+
+// Builds a reply payload and sends it as a frame. put writes one raw byte
+// to the serial port, with no newline translation. Big, keep it off the
+// stack.
+class FrameWriter
+{
+public:
+  void begin(uint8_t sequence)
+  {
+    buf_[0] = FrameReceiver::Magic0;
+    buf_[1] = FrameReceiver::Magic1;
+    buf_[2] = sequence;
+    len_ = FrameReceiver::HeaderSize;
+  }
+
+  // Room for n more bytes, leaving space for the CRC
+  bool fits(size_t n) const
+  {
+    return len_ + n + 2 <= FrameReceiver::MaxPayload;
+  }
+
+  void put8(uint8_t v)
+  {
+    buf_[len_++] = v;
+  }
+
+  void put(const void* data, size_t n)
+  {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < n; ++i)
+    {
+      buf_[len_++] = bytes[i];
+    }
+  }
+
+  // Take back the last n bytes put
+  void unput(size_t n)
+  {
+    len_ -= n;
+  }
+
+  template <typename Put>
+  void send(Put put)
+  {
+    uint16_t crc = crc16(buf_, len_);
+    buf_[len_++] = (uint8_t)crc;
+    buf_[len_++] = (uint8_t)(crc >> 8);
+    size_t n = cobsEncode(buf_, len_, encoded_);
+    put(0);
+    for (size_t i = 0; i < n; ++i)
+    {
+      put(encoded_[i]);
+    }
+    put(0);
+  }
+
+private:
+  uint8_t buf_[FrameReceiver::MaxPayload];
+  uint8_t encoded_[cobsMaxEncoded(FrameReceiver::MaxPayload)];
+  size_t len_ = 0;
+};
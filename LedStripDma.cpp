@@ -0,0 +1,107 @@
+#include "LedStripDma.hpp"
+#include "LedStripDma.pio.h"
+
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+
+#include <algorithm>
+
+LedStripDma::LedStripDma(uint pin, uint numLeds) :
+  pio_(pio0),
+  frames_ { std::vector<uint32_t>(numLeds), std::vector<uint32_t>(numLeds) }
+{
+  sm_ = pio_claim_unused_sm(pio_, true);
+  uint offset = pio_add_program(pio_, &silvanus_ws2812_program);
+  silvanus_ws2812_program_init(pio_, sm_, offset, pin, 800000);
+
+  dma_ = dma_claim_unused_channel(true);
+  dma_channel_config c = dma_channel_get_default_config(dma_);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, true);
+  channel_config_set_write_increment(&c, false);
+  channel_config_set_dreq(&c, pio_get_dreq(pio_, sm_, true));
+  dma_channel_configure(dma_, &c, &pio_->txf[sm_], nullptr, numLeds, false);
+}
+
+void LedStripDma::begin()
+{
+  instance_ = this;
+  // Only one latch is ever pending
+  latchPool_ = alarm_pool_create_with_unused_hardware_alarm(1);
+  dma_channel_set_irq0_enabled(dma_, true);
+  irq_set_exclusive_handler(DMA_IRQ_0, onDmaComplete);
+  irq_set_enabled(DMA_IRQ_0, true);
+}
+
+bool LedStripDma::writeColors(const LEDBuffer& buffer)
+{
+  // The frame queued last time still needs the other buffer
+  while (queued_)
+  {
+    __wfe();
+  }
+
+  // Anything not sending_ is ours to fill
+  std::vector<uint32_t>& frame = frames_[1 - sending_];
+  const std::vector<uint32_t>& last = frames_[sending_];
+  size_t n = std::min(buffer.size(), frame.size());
+  bool changed = !sentAny_;
+  for (size_t i = 0; i < n; ++i)
+  {
+    // GRB, left aligned for the PIO's 24 bit pulls
+    frame[i] = ((uint32_t)buffer[i].g << 24) | ((uint32_t)buffer[i].r << 16) | ((uint32_t)buffer[i].b << 8);
+    changed |= frame[i] != last[i];
+  }
+  if (!changed)
+  {
+    return false;
+  }
+  sentAny_ = true;
+
+  uint32_t ints = save_and_disable_interrupts();
+  queued_ = true;
+  if (!busy_)
+  {
+    startNext();
+  }
+  restore_interrupts(ints);
+  return true;
+}
+
+bool LedStripDma::busy() const
+{
+  return busy_;
+}
+
+void LedStripDma::onDmaComplete()
+{
+  LedStripDma* self = instance_;
+  dma_channel_acknowledge_irq0(self->dma_);
+
+  // DMA is done once the last words are in the PIO, let those shift out
+  // and then hold the line low long enough to latch
+  uint32_t drainUs = std::min<uint32_t>(self->frames_[0].size(), PioWords) * UsPerLed;
+  alarm_pool_add_alarm_in_us(self->latchPool_, drainUs + ResetUs, onLatched, self, true);
+}
+
+int64_t LedStripDma::onLatched(alarm_id_t id, void* user_data)
+{
+  LedStripDma* self = (LedStripDma*)user_data;
+  self->busy_ = false;
+  if (self->queued_)
+  {
+    self->startNext();
+  }
+  // Wake the renderer if it's waiting for a buffer
+  __sev();
+  return 0;
+}
+
+void LedStripDma::startNext()
+{
+  sending_ = 1 - sending_;
+  queued_ = false;
+  busy_ = true;
+  dma_channel_transfer_from_buffer_now(dma_, frames_[sending_].data(), frames_[sending_].size());
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <hardware/pio.h>
+#include <pico/time.h>
+
+#include <vector>
+
+// WS2812B output where DMA feeds the PIO state machine, so writing a frame
+// doesn't keep the calling core busy while it shifts out.
+//
+// There are two frame buffers. One is being sent (or was the last sent),
+// the next frame is converted into the other and queued. When a transfer
+// ends, a timer holds the line low for the reset latch before the queued
+// frame, if any, starts going out.
+//
+// The DMA interrupt and the latch timer both go to the core that calls
+// begin(), which is the one that must write frames too. The hand-off
+// between them only disables interrupts, and that doesn't keep the other
+// core out.
+class LedStripDma
+{
+public:
+  LedStripDma(uint pin, uint numLeds);
+
+  // Take the DMA completion interrupt and latch timer on the calling core
+  void begin();
+
+  // Queue a frame to go out as soon as the strip is free, unless it's the
+  // same as the last frame queued. Only waits if the frame queued before
+  // this one hasn't started going out yet. True if the frame was queued.
+  bool writeColors(const LEDBuffer& buffer);
+
+  // True while a frame is going out or the strip is latching
+  bool busy() const;
+
+private:
+  // WS2812B: 24 bits at 800 kHz per LED
+  static constexpr uint32_t UsPerLed = 30;
+  // What's still queued in the PIO when DMA is done: the joined TX FIFO plus the OSR
+  static constexpr uint32_t PioWords = 8 + 1;
+  // The datasheet asks for 50 us, newer revisions of the part want 280 us
+  static constexpr uint32_t ResetUs = 300;
+
+  static void onDmaComplete();
+  static int64_t onLatched(alarm_id_t id, void* user_data);
+  // Call with interrupts disabled, on the core that called begin()
+  void startNext();
+
+  // There's one DMA IRQ handler, so one strip
+  static inline LedStripDma* instance_ = nullptr;
+
+  PIO pio_;
+  uint sm_;
+  uint dma_;
+  // Not the default pool, whose timer interrupts core 0
+  alarm_pool_t* latchPool_ = nullptr;
+  std::vector<uint32_t> frames_[2];
+  volatile int sending_ = 0;
+  volatile bool queued_ = false;
+  volatile bool busy_ = false;
+  bool sentAny_ = false;
+};
@@ -0,0 +1,213 @@
+#include "Log.hpp"
+#include "SpscQueue.hpp"
+
+#include <hardware/sync.h>
+#include <pico/time.h>
+
+#if LIB_PICO_STDIO_USB
+#include <pico/stdio_usb.h>
+#include <tusb.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+  SpscQueue<Log::Record, Log::MaxLines> lines;
+  volatile uint32_t logged = 0;
+  volatile uint32_t dropped = 0;
+  volatile uint32_t peak = 0;
+  // Drops already owned up to in the log itself
+  uint32_t droppedReported = 0;
+
+  // Whether a host is there to take the log at all. Until one is, the
+  // ring holds on to the oldest lines.
+  bool connected()
+  {
+#if LIB_PICO_STDIO_USB
+    return stdio_usb_connected();
+#else
+    return true;
+#endif
+  }
+
+  // Whether n more bytes can go out without waiting on the host
+  bool roomFor(size_t n)
+  {
+#if LIB_PICO_STDIO_USB
+    return tud_cdc_write_available() >= n;
+#else
+    return true;
+#endif
+  }
+
+  constexpr char LevelChars[] = {'D', 'I', 'W', 'E'};
+
+  // "[   12.345] I "
+  int formatPrefix(char (&buf)[32], uint32_t timeMs, LogLevel level)
+  {
+    return snprintf(buf, sizeof(buf), "[%6lu.%03lu] %c ", (unsigned long)(timeMs / 1000),
+                    (unsigned long)(timeMs % 1000), LevelChars[(int)level]);
+  }
+
+  template <typename T>
+  std::string_view formatInt(char (&buf)[24], T v)
+  {
+    auto result = std::to_chars(buf, buf + sizeof(buf), v);
+    return std::string_view(buf, result.ptr - buf);
+  }
+}
+
+bool Log::drain()
+{
+  if (!connected())
+  {
+    return false;
+  }
+
+  char prefix[32];
+  bool wrote = false;
+
+  uint32_t lost = dropped - droppedReported;
+  if (lost && roomFor(64))
+  {
+    int n = formatPrefix(prefix, to_ms_since_boot(get_absolute_time()), LogLevel::Warn);
+    std::cout.write(prefix, n) << lost << " log lines dropped" << '\n';
+    droppedReported += lost;
+    wrote = true;
+  }
+
+  while (lines.consumeIf([&](const Record& r)
+  {
+    int n = formatPrefix(prefix, r.timeMs, r.level);
+    if (!roomFor(n + r.length + 1))
+    {
+      return false;
+    }
+    std::cout.write(prefix, n).write(r.text, r.length) << '\n';
+    return true;
+  }))
+  {
+    wrote = true;
+  }
+
+  if (wrote)
+  {
+    std::cout << std::flush;
+  }
+  return !lines.empty();
+}
+
+bool Log::pending()
+{
+  return !lines.empty();
+}
+
+Log::Stats Log::stats()
+{
+  return Stats {logged, dropped, peak};
+}
+
+void Log::resetStats()
+{
+  logged = 0;
+  dropped = 0;
+  droppedReported = 0;
+  peak = 0;
+}
+
+void Log::commit(const Record& record)
+{
+  // Interrupts log too, and the ring only takes one producer at a time
+  uint32_t ints = save_and_disable_interrupts();
+  logged++;
+  if (lines.push(record))
+  {
+    uint32_t waiting = lines.size();
+    if (waiting > peak)
+    {
+      peak = waiting;
+    }
+  }
+  else
+  {
+    dropped++;
+  }
+  restore_interrupts(ints);
+}
+
+LogLine::LogLine(LogLevel level)
+{
+  record_.timeMs = to_ms_since_boot(get_absolute_time());
+  record_.level = level;
+  record_.length = 0;
+}
+
+LogLine::~LogLine()
+{
+  Log::commit(record_);
+}
+
+LogLine& LogLine::operator<<(std::string_view s)
+{
+  size_t n = std::min(s.size(), Log::MaxLength - record_.length);
+  memcpy(record_.text + record_.length, s.data(), n);
+  record_.length += n;
+  return *this;
+}
+
+LogLine& LogLine::operator<<(const char* s)
+{
+  return *this << std::string_view(s);
+}
+
+LogLine& LogLine::operator<<(char c)
+{
+  return *this << std::string_view(&c, 1);
+}
+
+LogLine& LogLine::operator<<(bool b)
+{
+  return *this << (b ? "1" : "0");
+}
+
+LogLine& LogLine::operator<<(int32_t v)
+{
+  char buf[24];
+  return *this << formatInt(buf, v);
+}
+
+LogLine& LogLine::operator<<(uint32_t v)
+{
+  char buf[24];
+  return *this << formatInt(buf, v);
+}
+
+LogLine& LogLine::operator<<(int64_t v)
+{
+  char buf[24];
+  return *this << formatInt(buf, v);
+}
+
+LogLine& LogLine::operator<<(uint64_t v)
+{
+  char buf[24];
+  return *this << formatInt(buf, v);
+}
+
+LogLine& LogLine::operator<<(float v)
+{
+  return *this << (double)v;
+}
+
+LogLine& LogLine::operator<<(double v)
+{
+  // Same as std::cout would print it
+  char buf[24];
+  int n = snprintf(buf, sizeof(buf), "%g", v);
+  return *this << std::string_view(buf, std::min(n, (int)sizeof(buf) - 1));
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <type_traits>
+
+// Logging that never waits on the serial port. A log line is formatted on
+// the stack, stamped with its level and the time, and put in a RAM ring
+// buffer. The main loop writes the ring out when it's about to go to sleep
+// and only as much as the USB stack can take right then. When the ring is
+// full the line is dropped and counted.
+//
+// Lines below SILVANUS_LOG_LEVEL (set from CMake) are compiled out:
+//
+//   LOG_INFO << "WiFi up in " << ms << " ms";
+//
+// Log from core 0 only, main loop or interrupts. Replies to commands are
+// not logging and still go straight to std::cout.
+
+#ifndef SILVANUS_LOG_LEVEL
+#define SILVANUS_LOG_LEVEL 1
+#endif
+
+enum class LogLevel : uint8_t
+{
+  Debug = 0,
+  Info = 1,
+  Warn = 2,
+  Error = 3,
+};
+
+#define LOG_AT(level) if constexpr ((int)(level) < SILVANUS_LOG_LEVEL) {} else LogLine(level)
+#define LOG_DEBUG LOG_AT(LogLevel::Debug)
+#define LOG_INFO LOG_AT(LogLevel::Info)
+#define LOG_WARN LOG_AT(LogLevel::Warn)
+#define LOG_ERROR LOG_AT(LogLevel::Error)
+
+class Log
+{
+public:
+  static constexpr size_t MaxLines = 32;
+  // Longer lines are cut short
+  static constexpr size_t MaxLength = 90;
+
+  struct Stats
+  {
+    uint32_t lines;    // logged, dropped ones included
+    uint32_t dropped;  // the ring was full
+    uint32_t peak;     // most lines waiting at once
+  };
+
+  // Write out what the serial port has room for. Call when there's
+  // nothing more urgent to do. True if lines are left waiting on a host
+  // that's slow to take them, so it's worth trying again soon.
+  static bool drain();
+
+  // True while there are lines waiting to go out
+  static bool pending();
+
+  static Stats stats();
+  static void resetStats();
+
+  // A line as it waits in the ring
+  struct Record
+  {
+    uint32_t timeMs;
+    LogLevel level;
+    uint8_t length;
+    char text[MaxLength];
+  };
+
+private:
+  friend class LogLine;
+  static void commit(const Record& record);
+};
+
+// One line of log, put in the ring when it goes out of scope. Use it
+// through the LOG_ macros.
+class LogLine
+{
+public:
+  explicit LogLine(LogLevel level);
+  ~LogLine();
+
+  LogLine& operator<<(std::string_view s);
+  LogLine& operator<<(const char* s);
+  LogLine& operator<<(char c);
+  LogLine& operator<<(bool b);
+  LogLine& operator<<(int32_t v);
+  LogLine& operator<<(uint32_t v);
+  LogLine& operator<<(int64_t v);
+  LogLine& operator<<(uint64_t v);
+  LogLine& operator<<(float v);
+  LogLine& operator<<(double v);
+
+  // Other integer types go through the widest of their kind
+  template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+  LogLine& operator<<(T v)
+  {
+    if constexpr (std::is_signed_v<T>)
+    {
+      return *this << (int64_t)v;
+    }
+    else
+    {
+      return *this << (uint64_t)v;
+    }
+  }
+
+private:
+  Log::Record record_;
+};
@@ -0,0 +1,276 @@
+#include "NtpClient.hpp"
+#include "Log.hpp"
+#include "Trace.hpp"
+#include "WiFiLink.hpp"
+
+#include <lwip/dns.h>
+#include <lwip/pbuf.h>
+#include <lwip/udp.h>
+
+#include <cstring>
+
+#define NTP_MSG_LEN 48
+#define NTP_PORT 123
+#define NTP_DELTA 2208988800 // seconds between 1 Jan 1900 and 1 Jan 1970
+
+NtpClient::NtpClient(WiFiLink& link, const char* server) :
+  link_(link),
+  server_(server)
+{
+}
+
+NtpClient::~NtpClient()
+{
+  if (busy())
+  {
+    finish(State::Failed);
+  }
+}
+
+bool NtpClient::start(uint32_t timeoutMs)
+{
+  if (busy())
+  {
+    return false;
+  }
+
+  resolved_ = false;
+  replied_ = false;
+  error_ = "";
+  timeoutMs_ = timeoutMs;
+  deadline_ = make_timeout_time_ms(timeoutMs);
+  enter(State::Connecting);
+  return true;
+}
+
+NtpClient::State NtpClient::step()
+{
+  if (!busy())
+  {
+    return state_;
+  }
+
+  switch (state_)
+  {
+  case State::Connecting:
+    if (link_.up())
+    {
+      // The server gets its own timeout, however long the WiFi took
+      deadline_ = make_timeout_time_ms(timeoutMs_);
+      resolve();
+    }
+    break;
+  case State::Resolving:
+    if (resolved_)
+    {
+      enter(State::Sending);
+    }
+    else if (*error_)
+    {
+      fail(error_);
+    }
+    break;
+  case State::Sending:
+    send();
+    break;
+  case State::Awaiting:
+    if (replied_)
+    {
+      finish(State::Done);
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (busy() && time_reached(deadline_))
+  {
+    if (state_ == State::Awaiting)
+    {
+      // Maybe the server moved, look it up again next time
+      haveAddress_ = false;
+    }
+    fail(state_ == State::Connecting ? "WiFi not connected" : "timed out waiting for the time server");
+  }
+  return state_;
+}
+
+NtpClient::State NtpClient::state() const
+{
+  return state_;
+}
+
+bool NtpClient::busy() const
+{
+  return state_ != State::Idle && state_ != State::Done && state_ != State::Failed;
+}
+
+time_t NtpClient::secondsSinceEpoch() const
+{
+  return (time_t)(utcUs_ / 1000000ull);
+}
+
+uint64_t NtpClient::utcUs() const
+{
+  return utcUs_;
+}
+
+absolute_time_t NtpClient::sampleTime() const
+{
+  return sampleTime_;
+}
+
+void NtpClient::useAddress(uint32_t address)
+{
+  ip_addr_set_ip4_u32(&address_, address);
+  haveAddress_ = address != 0;
+}
+
+uint32_t NtpClient::address() const
+{
+  return haveAddress_ ? ip4_addr_get_u32(ip_2_ip4(&address_)) : 0;
+}
+
+const char* NtpClient::error() const
+{
+  return error_;
+}
+
+absolute_time_t NtpClient::wakeTime() const
+{
+  switch (state_)
+  {
+  case State::Connecting:
+    // The link wakes us when it comes up
+  case State::Resolving:
+  case State::Awaiting:
+    // Replies wake us through the network interrupt
+    return deadline_;
+  case State::Sending:
+    return get_absolute_time();
+  default:
+    return at_the_end_of_time;
+  }
+}
+
+void NtpClient::onDnsFound(const char* name, const ip_addr_t* ipaddr, void* arg)
+{
+  NtpClient* ntp = (NtpClient*)arg;
+  if (ntp->state_ != State::Resolving)
+  {
+    return;
+  }
+  if (!ipaddr)
+  {
+    // Picked up by step(), the pcb can't be removed from in here
+    ntp->error_ = "DNS lookup failed";
+    return;
+  }
+  ntp->address_ = *ipaddr;
+  ntp->haveAddress_ = true;
+  ntp->resolved_ = true;
+}
+
+void NtpClient::onReceive(void* arg, udp_pcb* pcb, pbuf* p, const ip_addr_t* addr, u16_t port)
+{
+  NtpClient* ntp = (NtpClient*)arg;
+  uint8_t mode = pbuf_get_at(p, 0) & 0x7;
+  uint8_t stratum = pbuf_get_at(p, 1);
+
+  // Only take the answer to our own request
+  if (ntp->state_ == State::Awaiting && ip_addr_cmp(addr, &ntp->address_) && port == NTP_PORT &&
+      p->tot_len == NTP_MSG_LEN && mode == 0x4 && stratum != 0)
+  {
+    // The transmit timestamp: seconds since 1900 and a 32 bit fraction
+    absolute_time_t now = get_absolute_time();
+    uint8_t buf[8] = {0};
+    pbuf_copy_partial(p, buf, sizeof(buf), 40);
+    uint32_t secondsSince1900 = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3];
+    uint32_t fraction = (uint32_t)buf[4] << 24 | (uint32_t)buf[5] << 16 | (uint32_t)buf[6] << 8 | buf[7];
+    uint64_t halfRoundTripUs = (uint64_t)absolute_time_diff_us(ntp->sentTime_, now) / 2;
+    ntp->utcUs_ = (uint64_t)(secondsSince1900 - NTP_DELTA) * 1000000ull +
+                  (((uint64_t)fraction * 1000000ull) >> 32) + halfRoundTripUs;
+    ntp->sampleTime_ = now;
+    ntp->replied_ = true;
+  }
+  else
+  {
+    LOG_WARN << "Invalid NTP response";
+  }
+  pbuf_free(p);
+}
+
+void NtpClient::resolve()
+{
+  enter(State::Resolving);
+  pcb_ = udp_new_ip_type(IPADDR_TYPE_ANY);
+  if (!pcb_)
+  {
+    fail("out of memory");
+    return;
+  }
+  udp_recv(pcb_, onReceive, this);
+
+  if (haveAddress_)
+  {
+    enter(State::Sending);
+    return;
+  }
+
+  int dnsResult = dns_gethostbyname(server_, &address_, onDnsFound, this);
+  if (dnsResult == ERR_OK)
+  {
+    // Cached, no need to wait
+    haveAddress_ = true;
+    enter(State::Sending);
+  }
+  else if (dnsResult != ERR_INPROGRESS)
+  {
+    fail("DNS lookup failed");
+  }
+}
+
+void NtpClient::send()
+{
+  pbuf* p = pbuf_alloc(PBUF_TRANSPORT, NTP_MSG_LEN, PBUF_RAM);
+  if (!p)
+  {
+    fail("out of memory");
+    return;
+  }
+  uint8_t* req = (uint8_t*)p->payload;
+  memset(req, 0, NTP_MSG_LEN);
+  req[0] = 0x1b; // LI 0, version 3, mode 3 (client)
+  sentTime_ = get_absolute_time();
+  err_t err = udp_sendto(pcb_, p, &address_, NTP_PORT);
+  pbuf_free(p);
+  if (err != ERR_OK)
+  {
+    fail("couldn't send the NTP request");
+    return;
+  }
+  enter(State::Awaiting);
+}
+
+void NtpClient::fail(const char* error)
+{
+  error_ = error;
+  finish(State::Failed);
+}
+
+void NtpClient::finish(State state)
+{
+  if (pcb_)
+  {
+    udp_remove(pcb_);
+    pcb_ = nullptr;
+  }
+  deadline_ = at_the_end_of_time;
+  enter(state);
+}
+
+void NtpClient::enter(State state)
+{
+  state_ = state;
+  Trace::record(TraceEvent::NtpState, (uint16_t)state);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <pico/time.h>
+#include <lwip/ip_addr.h>
+
+#include <stdint.h>
+#include <time.h>
+
+class WiFiLink;
+struct udp_pcb;
+struct pbuf;
+
+// Asks an NTP server for the time over the WiFi link, without ever
+// blocking. The main loop calls step() whenever it wakes up and each call
+// does at most one bit of work, so the buttons, serial and pumps carry on
+// as normal while a sync is in flight.
+class NtpClient
+{
+public:
+  enum class State : uint8_t
+  {
+    Idle,
+    Connecting, // waiting for the WiFi link to be up
+    Resolving,  // waiting for DNS
+    Sending,    // ready to send the request
+    Awaiting,   // waiting for the reply
+    Done,       // got the time
+    Failed,     // gave up, see error()
+  };
+
+  NtpClient(WiFiLink& link, const char* server = "pool.ntp.org");
+  ~NtpClient();
+
+  // Start a sync. The link gets timeoutMs to be up and the server another
+  // timeoutMs to answer. False if a sync is already running.
+  bool start(uint32_t timeoutMs);
+
+  // Advance by one step, after the link's step() has polled the network.
+  // Returns the new state, which is Done or Failed exactly once per sync.
+  State step();
+
+  State state() const;
+  bool busy() const;
+
+  // Seconds since 1970 (UTC) from the last sync that got to Done
+  time_t secondsSinceEpoch() const;
+
+  // The same to the microsecond, as of sampleTime(). The server's time is
+  // moved on by half the round trip to when its reply arrived here.
+  uint64_t utcUs() const;
+  absolute_time_t sampleTime() const;
+
+  // Skip DNS and send straight to this IPv4 address, e.g. remembered from
+  // before a reboot. It's forgotten again if the server doesn't answer.
+  void useAddress(uint32_t address);
+
+  // The server's IPv4 address as of the last sync, 0 if unknown
+  uint32_t address() const;
+
+  // Why the last sync failed
+  const char* error() const;
+
+  // When step() next has something to do even if no network event wakes
+  // us. at_the_end_of_time when not busy.
+  absolute_time_t wakeTime() const;
+
+private:
+  static void onDnsFound(const char* name, const ip_addr_t* ipaddr, void* arg);
+  static void onReceive(void* arg, udp_pcb* pcb, pbuf* p, const ip_addr_t* addr, u16_t port);
+  void resolve();
+  void send();
+  void fail(const char* error);
+  void finish(State state);
+  void enter(State state);
+
+  WiFiLink& link_;
+  const char* server_;
+  State state_ = State::Idle;
+  uint32_t timeoutMs_ = 0;
+  absolute_time_t deadline_ = at_the_end_of_time;
+  udp_pcb* pcb_ = nullptr;
+  ip_addr_t address_ {};
+  bool haveAddress_ = false;
+  bool resolved_ = false;
+  bool replied_ = false;
+  absolute_time_t sentTime_ = nil_time;
+  absolute_time_t sampleTime_ = nil_time;
+  uint64_t utcUs_ = 0;
+  const char* error_ = "";
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Compositor.hpp"
+
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// The last step before the strip: gamma correction, a global brightness
+// limit and temporal dithering.
+//
+// Gamma takes each 8 bit channel to 8.8 fixed point linear PWM. The
+// fraction that doesn't fit in the strip's PWM is carried over to the next
+// frame per channel, so over a few frames the LED averages out to the level
+// asked for instead of stepping between the few dim levels 8 bits have.
+class OutputStage
+{
+public:
+  OutputStage(size_t numLeds) :
+    residual_(numLeds * 3)
+  {
+  }
+
+  // Scale everything down so the brightest white is limit / 255
+  void brightness(uint8_t limit)
+  {
+    scale_ = limit + (limit >> 7);
+  }
+
+  // Turn a composited frame into what goes out on the strip. Without dither
+  // every channel is rounded, e.g. for a frame that will be left showing.
+  void process(const uint32_t* frame, LEDBuffer& out, bool dither)
+  {
+    uint8_t* residual = residual_.data();
+    for (size_t i = 0; i < out.size(); ++i)
+    {
+      uint32_t c = frame[i];
+      out[i].r = channel((c >> 16) & 0xFF, residual[0], dither);
+      out[i].g = channel((c >> 8) & 0xFF, residual[1], dither);
+      out[i].b = channel(c & 0xFF, residual[2], dither);
+      residual += 3;
+    }
+  }
+
+private:
+  uint8_t channel(uint32_t v, uint8_t& residual, bool dither)
+  {
+    // round(255 * 256 * (i / 255)^2.2), in 1/256ths of a PWM step
+    static const uint16_t gamma[256] =
+    {
+    0, 0, 2, 4, 7, 11, 17, 24, 32, 42, 53, 65,
+    78, 94, 110, 128, 148, 169, 191, 216, 241, 269, 298, 328,
+    360, 394, 430, 467, 506, 547, 589, 633, 679, 726, 776, 827,
+    880, 934, 991, 1049, 1109, 1171, 1235, 1300, 1368, 1437, 1508, 1581,
+    1656, 1733, 1812, 1893, 1975, 2060, 2146, 2235, 2325, 2417, 2512, 2608,
+    2706, 2806, 2908, 3013, 3119, 3227, 3337, 3450, 3564, 3680, 3798, 3919,
+    4041, 4166, 4292, 4421, 4552, 4685, 4819, 4956, 5096, 5237, 5380, 5525,
+    5673, 5823, 5974, 6128, 6284, 6442, 6603, 6765, 6930, 7097, 7266, 7437,
+    7610, 7786, 7963, 8143, 8325, 8509, 8696, 8885, 9075, 9268, 9464, 9661,
+    9861, 10063, 10267, 10474, 10682, 10893, 11107, 11322, 11540, 11760, 11982, 12207,
+    12433, 12663, 12894, 13128, 13363, 13602, 13842, 14085, 14330, 14578, 14827, 15080,
+    15334, 15591, 15850, 16111, 16375, 16641, 16909, 17180, 17453, 17729, 18006, 18287,
+    18569, 18854, 19141, 19431, 19723, 20017, 20314, 20613, 20915, 21218, 21525, 21833,
+    22144, 22458, 22774, 23092, 23413, 23736, 24062, 24390, 24720, 25053, 25388, 25726,
+    26066, 26408, 26753, 27101, 27451, 27803, 28158, 28515, 28875, 29237, 29602, 29969,
+    30338, 30710, 31085, 31462, 31841, 32223, 32608, 32995, 33384, 33776, 34170, 34567,
+    34967, 35369, 35773, 36180, 36589, 37001, 37416, 37833, 38252, 38674, 39099, 39526,
+    39956, 40388, 40823, 41260, 41700, 42142, 42587, 43034, 43484, 43937, 44392, 44849,
+    45310, 45772, 46238, 46706, 47176, 47649, 48125, 48603, 49084, 49567, 50053, 50542,
+    51033, 51526, 52023, 52522, 53023, 53527, 54034, 54543, 55055, 55570, 56087, 56607,
+    57129, 57654, 58182, 58712, 59245, 59780, 60318, 60859, 61402, 61948, 62497, 63048,
+    63602, 64159, 64718, 65280,
+    };
+
+    uint32_t linear = (gamma[v] * scale_ >> 8) + (dither ? residual : 128);
+    residual = linear & 0xFF;
+    return (uint8_t)(linear >> 8);
+  }
+
+  std::vector<uint8_t> residual_;
+  uint32_t scale_ = 256;
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <hardware/clocks.h>
+#include <hardware/structs/systick.h>
+#include <pico/time.h>
+
+#include <array>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Cycle timing of the phases of a loop, one profile per core. SysTick
+// counts processor cycles, but it is only 24 bits, which wraps after about
+// 134 ms at 125 MHz. Longer phases are timed with the microsecond timer
+// instead, which is plenty accurate at that length.
+//
+// Each core has its own SysTick, so every core that profiles calls
+// startCycleCounter() once first.
+inline void startCycleCounter()
+{
+  systick_hw->rvr = 0x00ffffff;
+  systick_hw->cvr = 0;
+  // Enabled, counting the processor clock, no interrupt
+  systick_hw->csr = 0x5;
+}
+
+struct CycleStamp
+{
+  uint32_t us;
+  uint32_t ticks;
+
+  static CycleStamp now()
+  {
+    return {time_us_32(), systick_hw->cvr};
+  }
+};
+
+// Phase is an enum of the loop's phases, Count the last of them. Profile
+// and finish a loop on the core it runs on. Any core can read the stats,
+// they can be a little torn while the loop is updating them.
+template <typename Phase, size_t Count = (size_t)Phase::Count>
+class PhaseProfile
+{
+public:
+  static constexpr size_t PhaseCount = Count;
+
+  // Bucket k counts times of less than 2^k cycles and at least half that,
+  // the last one everything longer
+  static constexpr size_t Buckets = 32;
+
+  struct Stats
+  {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    uint32_t histogram[Buckets];
+
+    uint32_t meanCycles() const
+    {
+      return count ? (uint32_t)(totalCycles / count) : 0;
+    }
+  };
+
+  explicit PhaseProfile(const char* const (&names)[Count])
+    : names_(names)
+  {
+    clear();
+  }
+
+  // Start timing an iteration of the loop
+  void start()
+  {
+    if (resetRequested_.load(std::memory_order_acquire))
+    {
+      clear();
+      resetRequested_.store(false, std::memory_order_release);
+    }
+    started_ = CycleStamp::now();
+    lap_ = started_;
+    running_ = true;
+  }
+
+  // phase is what ran since start() or the last lap()
+  void lap(Phase phase)
+  {
+    if (!running_)
+    {
+      return;
+    }
+    CycleStamp now = CycleStamp::now();
+    add(phases_[(size_t)phase], cyclesBetween(lap_, now));
+    lap_ = now;
+  }
+
+  // End the iteration, late if it missed its deadline
+  void finish(bool late)
+  {
+    if (!running_)
+    {
+      return;
+    }
+    running_ = false;
+    add(total_, cyclesBetween(started_, CycleStamp::now()));
+    if (late)
+    {
+      missed_++;
+    }
+  }
+
+  const char* name(size_t phase) const
+  {
+    return names_[phase];
+  }
+
+  const Stats& phase(size_t phase) const
+  {
+    return phases_[phase];
+  }
+
+  // Whole iterations, start() to finish()
+  const Stats& total() const
+  {
+    return total_;
+  }
+
+  uint32_t missed() const
+  {
+    return missed_;
+  }
+
+  // Takes effect when the loop starts its next iteration
+  void reset()
+  {
+    resetRequested_.store(true, std::memory_order_release);
+  }
+
+  static uint32_t cyclesPerUs()
+  {
+    static const uint32_t cycles = clock_get_hz(clk_sys) / 1000000;
+    return cycles;
+  }
+
+private:
+  const char* const* names_;
+  std::array<Stats, Count> phases_;
+  Stats total_;
+  uint32_t missed_;
+  CycleStamp started_ {};
+  CycleStamp lap_ {};
+  bool running_ = false;
+  std::atomic<bool> resetRequested_ {false};
+
+  static uint32_t cyclesBetween(CycleStamp from, CycleStamp to)
+  {
+    uint32_t us = to.us - from.us;
+    // Well inside a SysTick wrap, the cycle count can be trusted. It
+    // counts down.
+    if (us < 0x01000000 / 2 / cyclesPerUs())
+    {
+      return (from.ticks - to.ticks) & 0x00ffffff;
+    }
+    return us < UINT32_MAX / cyclesPerUs() ? us * cyclesPerUs() : UINT32_MAX;
+  }
+
+  static void add(Stats& stats, uint32_t cycles)
+  {
+    stats.count++;
+    stats.totalCycles += cycles;
+    if (cycles < stats.minCycles)
+    {
+      stats.minCycles = cycles;
+    }
+    if (cycles > stats.maxCycles)
+    {
+      stats.maxCycles = cycles;
+    }
+    size_t bucket = cycles ? 32 - __builtin_clz(cycles) : 0;
+    stats.histogram[bucket < Buckets ? bucket : Buckets - 1]++;
+  }
+
+  void clear()
+  {
+    for (Stats& stats : phases_)
+    {
+      stats = Stats {0, UINT32_MAX, 0, 0, {}};
+    }
+    total_ = Stats {0, UINT32_MAX, 0, 0, {}};
+    missed_ = 0;
+  }
+};
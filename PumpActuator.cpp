@@ -0,0 +1,160 @@
+#include "PumpActuator.hpp"
+#include "Trace.hpp"
+
+#include <hardware/sync.h>
+
+volatile uint32_t PumpActuator::actuations_ = 0;
+volatile uint32_t PumpActuator::worstErrorUs_ = 0;
+volatile uint64_t PumpActuator::totalErrorUs_ = 0;
+
+PumpActuator::PumpActuator(DiscreteOut& pump, uint8_t channel) :
+  pump_(pump),
+  channel_(channel)
+{
+}
+
+void PumpActuator::arm(absolute_time_t onTime, uint64_t durationUs)
+{
+  uint32_t ints = save_and_disable_interrupts();
+  bool unchanged = to_us_since_boot(onTime) == to_us_since_boot(armedOnTime_) && durationUs == armedDurationUs_;
+  // Don't re-arm a cycle that has already started
+  bool started = to_us_since_boot(onTime) == to_us_since_boot(onTime_);
+  if (!unchanged && !started)
+  {
+    if (onAlarm_ > 0)
+    {
+      cancel_alarm(onAlarm_);
+      onAlarm_ = 0;
+    }
+    armedOnTime_ = onTime;
+    armedDurationUs_ = durationUs;
+    if (!is_at_the_end_of_time(onTime) && durationUs > 0)
+    {
+      onAlarm_ = add_alarm_at(onTime, onAlarm, this, true);
+    }
+  }
+  restore_interrupts(ints);
+}
+
+void PumpActuator::start(uint64_t durationUs)
+{
+  uint32_t ints = save_and_disable_interrupts();
+  if (offAlarm_ > 0)
+  {
+    cancel_alarm(offAlarm_);
+    offAlarm_ = 0;
+  }
+  switchOn(get_absolute_time(), durationUs);
+  Trace::record(TraceEvent::PumpOn, channel_, Trace::NoArg);
+  restore_interrupts(ints);
+}
+
+void PumpActuator::stop()
+{
+  uint32_t ints = save_and_disable_interrupts();
+  if (offAlarm_ > 0)
+  {
+    cancel_alarm(offAlarm_);
+    offAlarm_ = 0;
+  }
+  if (running_)
+  {
+    Trace::record(TraceEvent::PumpOff, channel_, Trace::NoArg);
+  }
+  pump_.set(false);
+  running_ = false;
+  restore_interrupts(ints);
+}
+
+bool PumpActuator::running() const
+{
+  return running_;
+}
+
+absolute_time_t PumpActuator::onTime() const
+{
+  return onTime_;
+}
+
+absolute_time_t PumpActuator::offTime() const
+{
+  return offTime_;
+}
+
+absolute_time_t PumpActuator::nextSwitchTime() const
+{
+  uint32_t ints = save_and_disable_interrupts();
+  absolute_time_t next = onAlarm_ > 0 ? armedOnTime_ : at_the_end_of_time;
+  if (running_)
+  {
+    next = absolute_time_min(next, offTime_);
+  }
+  restore_interrupts(ints);
+  return next;
+}
+
+PumpActuator::Stats PumpActuator::stats()
+{
+  uint32_t ints = save_and_disable_interrupts();
+  Stats s {actuations_, worstErrorUs_, totalErrorUs_};
+  restore_interrupts(ints);
+  return s;
+}
+
+void PumpActuator::resetStats()
+{
+  uint32_t ints = save_and_disable_interrupts();
+  actuations_ = 0;
+  worstErrorUs_ = 0;
+  totalErrorUs_ = 0;
+  restore_interrupts(ints);
+}
+
+int64_t PumpActuator::onAlarm(alarm_id_t id, void* user_data)
+{
+  PumpActuator* self = (PumpActuator*)user_data;
+  absolute_time_t onTime = self->armedOnTime_;
+  self->onAlarm_ = 0;
+  self->armedOnTime_ = at_the_end_of_time;
+  if (self->offAlarm_ > 0)
+  {
+    // The previous cycle is somehow still running, this one replaces it
+    cancel_alarm(self->offAlarm_);
+    self->offAlarm_ = 0;
+  }
+  self->switchOn(onTime, self->armedDurationUs_);
+  Trace::record(TraceEvent::PumpOn, self->channel_, recordActuation(onTime));
+  return 0;
+}
+
+int64_t PumpActuator::offAlarm(alarm_id_t id, void* user_data)
+{
+  PumpActuator* self = (PumpActuator*)user_data;
+  self->offAlarm_ = 0;
+  self->pump_.set(false);
+  self->running_ = false;
+  Trace::record(TraceEvent::PumpOff, self->channel_, recordActuation(self->offTime_));
+  return 0;
+}
+
+uint32_t PumpActuator::recordActuation(absolute_time_t target)
+{
+  int64_t errorUs = absolute_time_diff_us(target, get_absolute_time());
+  if (errorUs < 0) errorUs = 0;
+  actuations_ = actuations_ + 1;
+  totalErrorUs_ = totalErrorUs_ + (uint64_t)errorUs;
+  if ((uint32_t)errorUs > worstErrorUs_)
+  {
+    worstErrorUs_ = (uint32_t)errorUs;
+  }
+  return (uint32_t)errorUs;
+}
+
+void PumpActuator::switchOn(absolute_time_t onTime, uint64_t durationUs)
+{
+  onTime_ = onTime;
+  offTime_ = delayed_by_us(onTime, durationUs);
+  running_ = true;
+  pump_.set(true);
+  offAlarm_ = add_alarm_at(offTime_, offAlarm, this, true);
+}
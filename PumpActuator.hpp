@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cpp/DiscreteOut.hpp>
+
+#include <pico/time.h>
+
+// Runs a pump's watering cycles from hardware alarms, so it switches on and
+// off at exactly the armed times in interrupt context, whatever core 0 is
+// busy with at that moment.
+//
+// There is at most one armed cycle waiting to start plus one running cycle
+// waiting to end, so the next day's cycle can be armed while today's runs.
+class PumpActuator
+{
+public:
+  struct Stats
+  {
+    uint32_t actuations;
+    uint32_t worstErrorUs;
+    uint64_t totalErrorUs;
+  };
+
+  // channel is only for telling pumps apart in the trace
+  PumpActuator(DiscreteOut& pump, uint8_t channel);
+
+  // Arm the next cycle to start at onTime. Re-arming with the same values
+  // is a no-op, at_the_end_of_time disarms.
+  void arm(absolute_time_t onTime, uint64_t durationUs);
+
+  // Start a cycle right now, replacing any running one
+  void start(uint64_t durationUs);
+
+  // End the running cycle now. An armed cycle stays armed.
+  void stop();
+
+  // The cycle in progress, or the last one that ran
+  bool running() const;
+  absolute_time_t onTime() const;
+  absolute_time_t offTime() const;
+
+  // When the pump switches next, on or off, if nothing changes
+  absolute_time_t nextSwitchTime() const;
+
+  // How late the alarms switched the pumps, over all pumps
+  static Stats stats();
+  static void resetStats();
+
+private:
+  static int64_t onAlarm(alarm_id_t id, void* user_data);
+  static int64_t offAlarm(alarm_id_t id, void* user_data);
+  static uint32_t recordActuation(absolute_time_t target);
+  void switchOn(absolute_time_t onTime, uint64_t durationUs);
+
+  DiscreteOut& pump_;
+  uint8_t channel_;
+  alarm_id_t onAlarm_ = 0;
+  alarm_id_t offAlarm_ = 0;
+  absolute_time_t armedOnTime_ = at_the_end_of_time;
+  uint64_t armedDurationUs_ = 0;
+  volatile bool running_ = false;
+  volatile absolute_time_t onTime_ = nil_time;
+  volatile absolute_time_t offTime_ = nil_time;
+
+  static volatile uint32_t actuations_;
+  static volatile uint32_t worstErrorUs_;
+  static volatile uint64_t totalErrorUs_;
+};
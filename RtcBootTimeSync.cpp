@@ -0,0 +1,215 @@
+#include "RtcBootTimeSync.hpp"
+
+namespace
+{
+  // x * num / den without overflowing for any x we'll see
+  int64_t mulDiv(int64_t x, int64_t num, int64_t den)
+  {
+    return (x / den) * num + (x % den) * num / den;
+  }
+
+  // How far a span of dt on one clock differs on a clock ppb faster
+  int64_t ppbOf(int64_t dt, int32_t ppb)
+  {
+    return mulDiv(dt, ppb, 1000000000ll);
+  }
+
+  // The span on the slower clock for a span of dw on the one ppb faster
+  int64_t unPpb(int64_t dw, int32_t ppb)
+  {
+    return dw - mulDiv(dw, ppb, 1000000000ll + ppb);
+  }
+
+  int64_t absUs(int64_t v)
+  {
+    return v < 0 ? -v : v;
+  }
+}
+
+bool RtcBootTimeSync::synced() const
+{
+  return synced_;
+}
+
+void RtcBootTimeSync::set(uint64_t wallUs, absolute_time_t at)
+{
+  synced_ = true;
+  baseUs_ = to_us_since_boot(at);
+  baseWallUs_ = wallUs;
+  slewPpb_ = 0;
+  slewEndUs_ = baseUs_;
+
+  // Whatever the timer did before isn't comparable any more
+  rawCount_ = 0;
+  raw_[rawNext_] = {baseUs_, (int64_t)(wallUs - baseUs_)};
+  rawNext_ = (rawNext_ + 1) % HistorySize;
+  rawCount_ = 1;
+}
+
+void RtcBootTimeSync::estimate(uint64_t wallUs, absolute_time_t at, int32_t driftPpb)
+{
+  set(wallUs, at);
+  driftPpb_ = (driftPpb > MaxDriftPpb || driftPpb < -MaxDriftPpb) ? 0 : driftPpb;
+  rawCount_ = 0;
+}
+
+RtcBootTimeSync::Sample RtcBootTimeSync::discipline(uint64_t wallUs, absolute_time_t at)
+{
+  Sample sample {at, 0, driftPpb_, true};
+  if (synced_)
+  {
+    sample.offsetUs = (int64_t)(wallUs - wallUsAt(at));
+    sample.stepped = absUs(sample.offsetUs) > MaxSlewUs;
+  }
+
+  if (sample.stepped)
+  {
+    set(wallUs, at);
+  }
+  else
+  {
+    uint64_t atUs = to_us_since_boot(at);
+    raw_[rawNext_] = {atUs, (int64_t)(wallUs - atUs)};
+    rawNext_ = (rawNext_ + 1) % HistorySize;
+    if (rawCount_ < HistorySize)
+    {
+      rawCount_++;
+    }
+
+    // Re-base the mapping where it is now so it doesn't jump, then run it
+    // fast or slow until the offset is made up
+    baseWallUs_ = wallUsAt(at);
+    baseUs_ = atUs;
+    driftPpb_ = estimateDrift();
+    slewPpb_ = sample.offsetUs > 0 ? SlewPpb : (sample.offsetUs < 0 ? -SlewPpb : 0);
+    slewEndUs_ = baseUs_ + mulDiv(absUs(sample.offsetUs), 1000000000ll, SlewPpb);
+    sample.driftPpb = driftPpb_;
+  }
+
+  history_[next_] = sample;
+  next_ = (next_ + 1) % HistorySize;
+  if (count_ < HistorySize)
+  {
+    count_++;
+  }
+  return sample;
+}
+
+uint64_t RtcBootTimeSync::wallUsAt(absolute_time_t t) const
+{
+  uint64_t tUs = to_us_since_boot(t);
+  if (slewPpb_ != 0 && tUs > slewEndUs_)
+  {
+    int64_t slewUs = (int64_t)(slewEndUs_ - baseUs_);
+    int64_t afterUs = (int64_t)(tUs - slewEndUs_);
+    return baseWallUs_ + slewUs + ppbOf(slewUs, driftPpb_ + slewPpb_) + afterUs + ppbOf(afterUs, driftPpb_);
+  }
+  int64_t dt = (int64_t)(tUs - baseUs_);
+  return baseWallUs_ + dt + ppbOf(dt, driftPpb_ + slewPpb_);
+}
+
+absolute_time_t RtcBootTimeSync::timeAtWallUs(uint64_t wallUs) const
+{
+  int64_t tUs;
+  uint64_t slewEndWallUs = wallUsAt(from_us_since_boot(slewEndUs_));
+  if (slewPpb_ != 0 && wallUs > slewEndWallUs)
+  {
+    tUs = (int64_t)slewEndUs_ + unPpb((int64_t)(wallUs - slewEndWallUs), driftPpb_);
+  }
+  else
+  {
+    tUs = (int64_t)baseUs_ + unPpb((int64_t)(wallUs - baseWallUs_), driftPpb_ + slewPpb_);
+  }
+  return from_us_since_boot(tUs < 0 ? 0 : tUs);
+}
+
+int32_t RtcBootTimeSync::driftPpb() const
+{
+  return driftPpb_;
+}
+
+int64_t RtcBootTimeSync::slewRemainingUs(absolute_time_t t) const
+{
+  uint64_t tUs = to_us_since_boot(t);
+  if (slewPpb_ == 0 || tUs >= slewEndUs_)
+  {
+    return 0;
+  }
+  return ppbOf((int64_t)(slewEndUs_ - tUs), slewPpb_);
+}
+
+int RtcBootTimeSync::historyCount() const
+{
+  return count_;
+}
+
+const RtcBootTimeSync::Sample& RtcBootTimeSync::history(int i) const
+{
+  return history_[(next_ - count_ + i + HistorySize) % HistorySize];
+}
+
+absolute_time_t RtcBootTimeSync::absoluteTimeFromSecondsSinceMidnight(int32_t secondsSinceMidnight, absolute_time_t referenceTime) const
+{
+  uint64_t wallUs = wallUsAt(referenceTime);
+  uint64_t startOfDayUs = wallUs - wallUs % usPerDay;
+  return timeAtWallUs(startOfDayUs + (uint64_t)secondsSinceMidnight * 1000000ull);
+}
+
+absolute_time_t RtcBootTimeSync::nextTimeFromSecondsSinceMidnight(int32_t secondsSinceMidnight, absolute_time_t referenceTime) const
+{
+  uint64_t wallUs = wallUsAt(referenceTime);
+  uint64_t startOfDayUs = wallUs - wallUs % usPerDay;
+  absolute_time_t t = timeAtWallUs(startOfDayUs + (uint64_t)secondsSinceMidnight * 1000000ull);
+  while (to_us_since_boot(t) <= to_us_since_boot(referenceTime))
+  {
+    startOfDayUs += usPerDay;
+    t = timeAtWallUs(startOfDayUs + (uint64_t)secondsSinceMidnight * 1000000ull);
+  }
+  return t;
+}
+
+// Least squares slope of the raw offsets over time. The offsets are the
+// wall clock minus the timer, so the slope is straight how much faster
+// the wall clock runs.
+int32_t RtcBootTimeSync::estimateDrift() const
+{
+  if (rawCount_ < 2)
+  {
+    return driftPpb_;
+  }
+  const RawSample& first = raw_[(rawNext_ - rawCount_ + HistorySize) % HistorySize];
+  const RawSample& last = raw_[(rawNext_ - 1 + HistorySize) % HistorySize];
+  if ((int64_t)(last.timeUs - first.timeUs) < MinDriftSpanUs)
+  {
+    return driftPpb_;
+  }
+
+  // Rare enough that soft float doesn't matter
+  double meanT = 0.0;
+  double meanO = 0.0;
+  for (int i = 0; i < rawCount_; ++i)
+  {
+    const RawSample& s = raw_[(rawNext_ - rawCount_ + i + HistorySize) % HistorySize];
+    meanT += (double)(int64_t)(s.timeUs - first.timeUs);
+    meanO += (double)(s.offsetUs - first.offsetUs);
+  }
+  meanT /= rawCount_;
+  meanO /= rawCount_;
+
+  double num = 0.0;
+  double den = 0.0;
+  for (int i = 0; i < rawCount_; ++i)
+  {
+    const RawSample& s = raw_[(rawNext_ - rawCount_ + i + HistorySize) % HistorySize];
+    double dt = (double)(int64_t)(s.timeUs - first.timeUs) - meanT;
+    double doff = (double)(s.offsetUs - first.offsetUs) - meanO;
+    num += dt * doff;
+    den += dt * dt;
+  }
+  double ppb = num / den * 1e9;
+  if (ppb > MaxDriftPpb || ppb < -MaxDriftPpb)
+  {
+    return driftPpb_;
+  }
+  return (int32_t)(ppb < 0 ? ppb - 0.5 : ppb + 0.5);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <pico/time.h>
+
+#include <stdint.h>
+
+// Maps between the pico's timer (microseconds since boot) and local wall
+// time, so we can feed in "secondsSinceMidnight" values and get out the
+// absolute_time_t when the wall clock reads that.
+//
+// The timer's crystal is only good to some tens of ppm, which adds up to
+// seconds a day. Every NTP sync is fed to discipline(), which estimates the
+// timer's drift from the history of syncs and steers out what's left of
+// the offset by running the mapping a little fast or slow for a while
+// (slewing) instead of jumping. The mapping never jumps backwards or skips
+// ahead unless it's way off, so events planned from it happen exactly once.
+class RtcBootTimeSync
+{
+public:
+  static const uint64_t usPerDay = (24ull*60ull*60ull*1000ull*1000ull);
+
+  // Offsets bigger than this are stepped, e.g. the UTC offset was changed
+  static constexpr int64_t MaxSlewUs = 10ll * 1000 * 1000;
+  // How fast offsets are slewed out, 1000 ppm takes 1000 s per second of offset
+  static constexpr int32_t SlewPpb = 1000000;
+  // Drift estimates past this are treated as bad measurements
+  static constexpr int32_t MaxDriftPpb = 500000;
+  // Syncs closer together than this are too noisy to tell drift from
+  static constexpr int64_t MinDriftSpanUs = 30ll * 60 * 1000 * 1000;
+  static constexpr int HistorySize = 8;
+
+  struct Sample
+  {
+    absolute_time_t time;   // when the sync was taken
+    int64_t offsetUs;       // real minus our time, before correcting
+    int32_t driftPpb;       // drift estimate after this sync
+    bool stepped;           // offset was too big to slew
+  };
+
+  // True once the time has been set
+  bool synced() const;
+
+  // Set the clock outright: the wall clock reads wallUs at time at
+  void set(uint64_t wallUs, absolute_time_t at);
+  // Start from a guess, e.g. the time saved before a reboot, with the
+  // drift known from back then. Nothing is measured, so the first
+  // discipline() after it sets or slews the clock as usual.
+  void estimate(uint64_t wallUs, absolute_time_t at, int32_t driftPpb);
+
+  // Steer toward a measured time, see above. Sets the clock if it wasn't.
+  Sample discipline(uint64_t wallUs, absolute_time_t at);
+
+  // Local microseconds since 1970 at a time, and back
+  uint64_t wallUsAt(absolute_time_t t) const;
+  absolute_time_t timeAtWallUs(uint64_t wallUs) const;
+
+  int32_t driftPpb() const;
+  // What's left to slew out at time t, plus or minus
+  int64_t slewRemainingUs(absolute_time_t t) const;
+
+  // The last HistorySize syncs, oldest first
+  int historyCount() const;
+  const Sample& history(int i) const;
+
+  absolute_time_t absoluteTimeFromSecondsSinceMidnight(int32_t secondsSinceMidnight, absolute_time_t referenceTime = get_absolute_time()) const;
+
+  // The first time after (not at) referenceTime that the clock reads secondsSinceMidnight
+  absolute_time_t nextTimeFromSecondsSinceMidnight(int32_t secondsSinceMidnight, absolute_time_t referenceTime) const;
+
+private:
+  // Raw offset of the wall clock from the timer, for the drift estimate
+  struct RawSample
+  {
+    uint64_t timeUs;
+    int64_t offsetUs;
+  };
+
+  int32_t estimateDrift() const;
+
+  bool synced_ = false;
+  // The mapping: the wall clock read baseWallUs_ at baseUs_, and since then
+  // ran at driftPpb_ + slewPpb_ until slewEndUs_ and at driftPpb_ after it
+  uint64_t baseUs_ = 0;
+  uint64_t baseWallUs_ = 0;
+  int32_t driftPpb_ = 0;
+  int32_t slewPpb_ = 0;
+  uint64_t slewEndUs_ = 0;
+
+  // Only back to the last step, the drift estimate starts over after one
+  RawSample raw_[HistorySize] = {};
+  int rawCount_ = 0;
+  int rawNext_ = 0;
+  Sample history_[HistorySize] = {};
+  int count_ = 0;
+  int next_ = 0;
+};
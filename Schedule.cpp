@@ -0,0 +1,446 @@
+#include "Schedule.hpp"
+#include "FlashScheduler.hpp"
+#include "SettingsStore.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+  // Just below the settings log
+  constexpr uint32_t StoreOffset =
+    PICO_FLASH_SIZE_BYTES - (3 + SettingsStore::SectorCount + Schedule::SectorCount) * FLASH_SECTOR_SIZE;
+
+  // In flash an entry is its time, days, channel and action in one word
+  // and then its amount
+  constexpr size_t PackedSize = 8;
+
+  void pack(const ScheduleEntry& entry, uint8_t* out)
+  {
+    uint32_t word = (uint32_t)entry.time | (uint32_t)entry.weekdays << 17 | (uint32_t)entry.channel << 24 |
+                    (uint32_t)entry.action << 28;
+    memcpy(out, &word, sizeof(word));
+    memcpy(out + sizeof(word), &entry.amount, sizeof(entry.amount));
+  }
+
+  ScheduleEntry unpack(const uint8_t* in)
+  {
+    uint32_t word;
+    ScheduleEntry entry;
+    memcpy(&word, in, sizeof(word));
+    memcpy(&entry.amount, in + sizeof(word), sizeof(entry.amount));
+    entry.time = word & 0x1ffff;
+    entry.weekdays = (word >> 17) & 0x7f;
+    entry.channel = (word >> 24) & 0xf;
+    entry.action = (ScheduleAction)(word >> 28);
+    return entry;
+  }
+
+  // Sorted by what they do, then when
+  bool before(const ScheduleEntry& a, const ScheduleEntry& b)
+  {
+    if (a.action != b.action) return a.action < b.action;
+    if (a.channel != b.channel) return a.channel < b.channel;
+    if (a.time != b.time) return a.time < b.time;
+    if (a.weekdays != b.weekdays) return a.weekdays < b.weekdays;
+    return a.amount < b.amount;
+  }
+
+  uint32_t fnv1a(const uint8_t* bytes, size_t len, uint32_t hash = 2166136261u)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  const char* const dayNames[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+  constexpr uint8_t Weekdays = 0x3e;
+  constexpr uint8_t Weekends = 0x41;
+
+  // Room for a sector header, a record header and a snapshot
+  uint8_t commitBuffer[12 + 8 + Schedule::MaxEntries * PackedSize];
+}
+
+bool Schedule::readFromFlash()
+{
+  // Newest sector first, the other one still has everything up to its
+  // snapshot if that didn't get written
+  uint32_t order[SectorCount];
+  uint32_t valid = 0;
+  for (uint32_t sector = 0; sector < SectorCount; ++sector)
+  {
+    if (sectorHeader(sector)->magic == Magic && sectorHeader(sector)->version == Version)
+    {
+      uint32_t i = valid++;
+      while (i > 0 && sectorHeader(order[i - 1])->sequence < sectorHeader(sector)->sequence)
+      {
+        order[i] = order[i - 1];
+        i--;
+      }
+      order[i] = sector;
+    }
+  }
+
+  sector_ = valid ? order[0] : SectorCount - 1;
+  sequence_ = valid ? sectorHeader(order[0])->sequence : 0;
+  writePos_ = 0;
+  for (uint32_t i = 0; i < valid; ++i)
+  {
+    if (replay(order[i]))
+    {
+      sector_ = order[i];
+      reindex();
+      return true;
+    }
+  }
+  count_ = 0;
+  reindex();
+  return false;
+}
+
+bool Schedule::add(const ScheduleEntry& entry)
+{
+  if (!valid(entry) || !insert(entry))
+  {
+    return false;
+  }
+  reindex();
+  commit(Op::Add, &entry, 1);
+  return true;
+}
+
+bool Schedule::remove(size_t index)
+{
+  if (index >= count_)
+  {
+    return false;
+  }
+  ScheduleEntry entry = entries_[index];
+  erase(entry);
+  reindex();
+  commit(Op::Remove, &entry, 1);
+  return true;
+}
+
+void Schedule::clear()
+{
+  count_ = 0;
+  reindex();
+  commit(Op::Snapshot, entries_, 0);
+}
+
+bool Schedule::valid(const ScheduleEntry& entry)
+{
+  if (entry.action >= ScheduleAction::Count || entry.weekdays == 0 || entry.weekdays > EveryDay ||
+      entry.time < 0 || entry.time >= (int32_t)SecondsPerDay)
+  {
+    return false;
+  }
+  if (entry.action == ScheduleAction::Water)
+  {
+    // The same range as the pump settings, written so NaN is out too
+    return entry.channel < Settings::PumpCount && entry.amount >= 0.0f && entry.amount <= 1000.0f;
+  }
+  return entry.channel < Settings::LightCount;
+}
+
+bool Schedule::parseWeekdays(std::string_view text, uint8_t& weekdays)
+{
+  if (text == "daily")
+  {
+    weekdays = EveryDay;
+    return true;
+  }
+  if (text == "weekdays" || text == "weekends")
+  {
+    weekdays = text == "weekdays" ? Weekdays : Weekends;
+    return true;
+  }
+
+  uint8_t days = 0;
+  while (!text.empty())
+  {
+    size_t comma = text.find(',');
+    std::string_view name = text.substr(0, comma);
+    uint8_t day = 0;
+    while (day < 7 && name != dayNames[day])
+    {
+      day++;
+    }
+    if (day == 7)
+    {
+      return false;
+    }
+    days |= 1 << day;
+    text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+  }
+  weekdays = days;
+  return days != 0;
+}
+
+void Schedule::print() const
+{
+  std::cout << "-- Schedule: " << count_ << " of " << MaxEntries << " entries --" << std::endl;
+  for (size_t i = 0; i < count_; ++i)
+  {
+    const ScheduleEntry& entry = entries_[i];
+    std::cout << i << ": ";
+    if (entry.action == ScheduleAction::Water)
+    {
+      std::cout << "water " << entry.channel + 1;
+    }
+    else
+    {
+      std::cout << "light " << entry.channel + 1 << (entry.action == ScheduleAction::LightOn ? " on" : " off");
+    }
+    std::cout << " ";
+    if (entry.weekdays == EveryDay || entry.weekdays == Weekdays || entry.weekdays == Weekends)
+    {
+      std::cout << (entry.weekdays == EveryDay ? "daily" : entry.weekdays == Weekdays ? "weekdays" : "weekends");
+    }
+    else
+    {
+      const char* separator = "";
+      for (int day = 0; day < 7; ++day)
+      {
+        if (entry.weekdays & (1 << day))
+        {
+          std::cout << separator << dayNames[day];
+          separator = ",";
+        }
+      }
+    }
+    std::cout << " at " << entry.time << " secs after midnight";
+    if (entry.action == ScheduleAction::Water)
+    {
+      std::cout << ", " << entry.amount << " mL";
+    }
+    std::cout << std::endl;
+  }
+  std::cout << std::flush;
+}
+
+bool Schedule::has(ScheduleAction action, uint8_t channel) const
+{
+  uint32_t key = slot(action, channel) << SlotShift;
+  const uint32_t* it = std::lower_bound(index_, index_ + indexCount_, key);
+  return it != index_ + indexCount_ && (*it >> SlotShift) == (key >> SlotShift);
+}
+
+bool Schedule::follows(ScheduleAction action, uint8_t channel) const
+{
+  if (action == ScheduleAction::Water)
+  {
+    return has(action, channel);
+  }
+  return has(ScheduleAction::LightOn, channel) || has(ScheduleAction::LightOff, channel);
+}
+
+const ScheduleEntry* Schedule::next(ScheduleAction action, uint8_t channel, uint32_t weekSecond, uint32_t& at) const
+{
+  uint32_t s = slot(action, channel);
+  const uint32_t* end = index_ + indexCount_;
+  const uint32_t* it = std::lower_bound(index_, end, s << SlotShift | (weekSecond + 1) << SecondShift);
+  if (it == end || (*it >> SlotShift) != s)
+  {
+    // Nothing later this week, so the first one next week
+    it = std::lower_bound(index_, end, s << SlotShift);
+    if (it == end || (*it >> SlotShift) != s)
+    {
+      return nullptr;
+    }
+  }
+  at = (*it >> SecondShift) & ((1u << (SlotShift - SecondShift)) - 1);
+  return &entries_[*it & ((1u << SecondShift) - 1)];
+}
+
+const ScheduleEntry* Schedule::last(ScheduleAction action, uint8_t channel, uint32_t weekSecond, uint32_t& at) const
+{
+  uint32_t s = slot(action, channel);
+  const uint32_t* end = index_ + indexCount_;
+  const uint32_t* it = std::lower_bound(index_, end, s << SlotShift | (weekSecond + 1) << SecondShift);
+  if (it == index_ || (it[-1] >> SlotShift) != s)
+  {
+    // Nothing earlier this week, so the last one of the week before
+    it = std::lower_bound(index_, end, (s + 1) << SlotShift);
+    if (it == index_ || (it[-1] >> SlotShift) != s)
+    {
+      return nullptr;
+    }
+  }
+  at = (it[-1] >> SecondShift) & ((1u << (SlotShift - SecondShift)) - 1);
+  return &entries_[it[-1] & ((1u << SecondShift) - 1)];
+}
+
+uint32_t Schedule::slot(ScheduleAction action, uint8_t channel)
+{
+  return (uint32_t)action * MaxChannels + channel;
+}
+
+uint32_t Schedule::sectorOffset(uint32_t sector)
+{
+  return StoreOffset + sector * FLASH_SECTOR_SIZE;
+}
+
+const Schedule::SectorHeader* Schedule::sectorHeader(uint32_t sector)
+{
+  return (const SectorHeader*)(XIP_BASE + sectorOffset(sector));
+}
+
+uint32_t Schedule::recordChecksum(const RecordHeader& header, const uint8_t* data)
+{
+  uint32_t hash = fnv1a((const uint8_t*)&header.op, sizeof(header.op));
+  hash = fnv1a((const uint8_t*)&header.count, sizeof(header.count), hash);
+  return fnv1a(data, header.count * PackedSize, hash);
+}
+
+bool Schedule::insert(const ScheduleEntry& entry)
+{
+  ScheduleEntry* end = entries_ + count_;
+  ScheduleEntry* it = std::lower_bound(entries_, end, entry, before);
+  if (count_ == MaxEntries || (it != end && !before(entry, *it)))
+  {
+    return false;
+  }
+  std::move_backward(it, end, end + 1);
+  *it = entry;
+  count_++;
+  return true;
+}
+
+bool Schedule::erase(const ScheduleEntry& entry)
+{
+  ScheduleEntry* end = entries_ + count_;
+  ScheduleEntry* it = std::lower_bound(entries_, end, entry, before);
+  if (it == end || before(entry, *it))
+  {
+    return false;
+  }
+  std::move(it + 1, end, it);
+  count_--;
+  return true;
+}
+
+void Schedule::reindex()
+{
+  // Every day each entry comes up on, then all of them in order
+  indexCount_ = 0;
+  for (size_t i = 0; i < count_; ++i)
+  {
+    const ScheduleEntry& entry = entries_[i];
+    for (uint32_t day = 0; day < 7; ++day)
+    {
+      if (entry.weekdays & (1u << day))
+      {
+        uint32_t weekSecond = day * SecondsPerDay + (uint32_t)entry.time;
+        index_[indexCount_++] = slot(entry.action, entry.channel) << SlotShift | weekSecond << SecondShift | (uint32_t)i;
+      }
+    }
+  }
+  std::sort(index_, index_ + indexCount_);
+}
+
+bool Schedule::replay(uint32_t sector)
+{
+  const uint8_t* base = (const uint8_t*)(XIP_BASE + sectorOffset(sector));
+  count_ = 0;
+  bool snapshot = false;
+  bool partial = false;
+  uint32_t pos = sizeof(SectorHeader);
+
+  while (pos + sizeof(RecordHeader) <= FLASH_SECTOR_SIZE)
+  {
+    RecordHeader header;
+    memcpy(&header, base + pos, sizeof(header));
+    if ((uint16_t)header.op == 0xffff)
+    {
+      break;
+    }
+    size_t len = header.count * PackedSize;
+    const uint8_t* data = base + pos + sizeof(header);
+    // A sector starts with a snapshot, without one the rest means nothing
+    if (pos + sizeof(header) + len > FLASH_SECTOR_SIZE || header.checksum != recordChecksum(header, data) ||
+        (!snapshot && header.op != Op::Snapshot))
+    {
+      // Half written, nothing after it can be trusted
+      partial = true;
+      break;
+    }
+    if (header.op == Op::Snapshot)
+    {
+      count_ = 0;
+    }
+    for (size_t i = 0; i < header.count; ++i)
+    {
+      ScheduleEntry entry = unpack(data + i * PackedSize);
+      if (header.op == Op::Remove)
+      {
+        erase(entry);
+      }
+      else if (valid(entry))
+      {
+        insert(entry);
+      }
+    }
+    snapshot = true;
+    pos += sizeof(header) + len;
+  }
+
+  // Appending after a half written record would leave it in the way of the
+  // ones after, so the next edit starts a new sector instead
+  writePos_ = partial ? 0 : pos;
+  return snapshot;
+}
+
+void Schedule::commit(Op op, const ScheduleEntry* entries, size_t count)
+{
+  static_assert(sizeof(SectorHeader) + sizeof(RecordHeader) + MaxEntries * PackedSize <= sizeof(commitBuffer),
+                "commit buffer too small");
+  // Or a compaction of a full table would overflow the queue and lock
+  // everything out for the erase
+  static_assert(FlashScheduler::compactionWindows(sizeof(commitBuffer)) <= FlashScheduler::ScheduleWindows,
+                "a schedule snapshot doesn't fit the flash queue");
+
+  size_t len = sizeof(RecordHeader) + count * PackedSize;
+  bool fits = writePos_ && writePos_ + len <= FLASH_SECTOR_SIZE;
+  uint8_t* record = commitBuffer;
+  if (!fits)
+  {
+    // Start over in the other sector with a snapshot, which has this edit
+    // in it already
+    sector_ = (sector_ + 1) % SectorCount;
+    SectorHeader header {Magic, Version, ++sequence_};
+    memcpy(commitBuffer, &header, sizeof(header));
+    record += sizeof(header);
+    op = Op::Snapshot;
+    entries = entries_;
+    count = count_;
+  }
+
+  RecordHeader header {op, (uint16_t)count, 0};
+  for (size_t i = 0; i < count; ++i)
+  {
+    pack(entries[i], record + sizeof(header) + i * PackedSize);
+  }
+  header.checksum = recordChecksum(header, record + sizeof(header));
+  memcpy(record, &header, sizeof(header));
+  len = record + sizeof(header) + count * PackedSize - commitBuffer;
+
+  if (fits)
+  {
+    FlashScheduler::program(sectorOffset(sector_) + writePos_, commitBuffer, len, TraceFlash::Schedule);
+    writePos_ += len;
+  }
+  else
+  {
+    FlashScheduler::erase(sectorOffset(sector_), TraceFlash::Schedule);
+    FlashScheduler::program(sectorOffset(sector_), commitBuffer, len, TraceFlash::Schedule);
+    writePos_ = len;
+    stats_.compactions++;
+  }
+  stats_.edits++;
+  stats_.bytesWritten += len;
+}
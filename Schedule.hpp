@@ -0,0 +1,177 @@
+#pragma once
+
+#include "Settings.hpp"
+
+#include <hardware/flash.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+// What a schedule entry does. Entries due at the same time run in this
+// order, the same as Scheduler::EventType.
+enum class ScheduleAction : uint8_t
+{
+  LightOff,
+  LightOn,
+  Water,
+  Count
+};
+
+struct ScheduleEntry
+{
+  ScheduleAction action;
+  uint8_t channel;  // pump or light, from 0
+  uint8_t weekdays; // bit 0 is Sunday, 0x7f every day
+  int32_t time;     // seconds after midnight
+  float amount;     // mL to water, unused by the lights
+};
+
+// Any number of watering and light events a week per channel, on top of
+// the one a day in the settings. A pump with entries here follows them
+// instead of its time in the settings, and so does a light with entries of
+// either kind, for both switching on and off. One with only on entries is
+// never switched off.
+//
+// The entries are kept sorted by action, channel and time. Next to them is
+// an index of every time an entry comes up in the week, sorted too, so the
+// next event for a channel is a binary search however many there are.
+//
+// Edits go to flash on their own as records appended to a log over two
+// sectors, the way SettingsStore keeps the settings, without touching the
+// settings.
+class Schedule
+{
+public:
+  static constexpr size_t MaxEntries = 256;
+  static constexpr uint32_t SecondsPerDay = 24 * 60 * 60;
+  static constexpr uint32_t SecondsPerWeek = 7 * SecondsPerDay;
+  static constexpr uint8_t EveryDay = 0x7f;
+  static constexpr uint32_t SectorCount = 2;
+
+  struct Stats
+  {
+    uint32_t edits;
+    uint32_t bytesWritten;
+    uint32_t compactions;
+  };
+
+  // Rebuild the table from the log, false if there's nothing in it
+  bool readFromFlash();
+
+  // Edits, each queued to be written to flash with FlashScheduler. add()
+  // is false if the entry isn't valid, is already there or the table is
+  // full, remove() if there's no entry at index.
+  bool add(const ScheduleEntry& entry);
+  bool remove(size_t index);
+  void clear();
+
+  static bool valid(const ScheduleEntry& entry);
+
+  // "daily", "weekdays", "weekends" or days like "mon,wed,fri"
+  static bool parseWeekdays(std::string_view text, uint8_t& weekdays);
+
+  // Print the entries to cout, numbered for remove()
+  void print() const;
+
+  size_t size() const
+  {
+    return count_;
+  }
+
+  const ScheduleEntry& entry(size_t index) const
+  {
+    return entries_[index];
+  }
+
+  // True if the channel has entries for action
+  bool has(ScheduleAction action, uint8_t channel) const;
+
+  // True if action on the channel goes by the entries rather than the
+  // settings, see the rule above
+  bool follows(ScheduleAction action, uint8_t channel) const;
+
+  // The entry for action and channel that comes up first after (not at)
+  // weekSecond, seconds since midnight on Sunday, nullptr if there's none.
+  // at is when in the week that is, less than weekSecond if it's next week.
+  const ScheduleEntry* next(ScheduleAction action, uint8_t channel, uint32_t weekSecond, uint32_t& at) const;
+
+  // The entry that came up last at or before weekSecond, going back into
+  // the week before if need be
+  const ScheduleEntry* last(ScheduleAction action, uint8_t channel, uint32_t weekSecond, uint32_t& at) const;
+
+  Stats stats() const
+  {
+    return stats_;
+  }
+
+  void resetStats()
+  {
+    stats_ = {};
+  }
+
+  // Bytes of the active sector in use, 0 before the first edit
+  uint32_t used() const
+  {
+    return writePos_;
+  }
+
+private:
+  static constexpr uint32_t Magic = 0x5343484c;
+  static constexpr uint32_t Version = 1;
+  static constexpr int MaxChannels = Settings::PumpCount > Settings::LightCount ? Settings::PumpCount : Settings::LightCount;
+
+  // An index entry: the action and channel, when in the week and which
+  // entry, packed so they sort in that order
+  static constexpr uint32_t SlotShift = 28;
+  static constexpr uint32_t SecondShift = 8;
+
+  static_assert((int)ScheduleAction::Count * MaxChannels <= 16, "schedule slots don't fit the index");
+  static_assert(SecondsPerWeek < (1u << (SlotShift - SecondShift)), "week seconds don't fit the index");
+  static_assert(MaxEntries <= (1u << SecondShift), "entry numbers don't fit the index");
+
+  enum class Op : uint16_t
+  {
+    Snapshot, // the whole table
+    Add,
+    Remove,
+  };
+
+  struct SectorHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+  };
+
+  struct RecordHeader
+  {
+    Op op;
+    uint16_t count;    // of entries after the header
+    uint32_t checksum; // of the op, count and entries
+  };
+
+  static uint32_t slot(ScheduleAction action, uint8_t channel);
+  static uint32_t sectorOffset(uint32_t sector);
+  static const SectorHeader* sectorHeader(uint32_t sector);
+  static uint32_t recordChecksum(const RecordHeader& header, const uint8_t* data);
+
+  bool insert(const ScheduleEntry& entry);
+  bool erase(const ScheduleEntry& entry);
+  void reindex();
+  bool replay(uint32_t sector);
+  // Append a record of entries to the log, or start the next sector with a
+  // snapshot if it doesn't fit
+  void commit(Op op, const ScheduleEntry* entries, size_t count);
+
+  ScheduleEntry entries_[MaxEntries] {};
+  size_t count_ = 0;
+  uint32_t index_[MaxEntries * 7] {};
+  size_t indexCount_ = 0;
+
+  uint32_t sector_ = 0;
+  uint32_t sequence_ = 0;
+  // 0 until there's a sector to append to, so the next edit starts one
+  uint32_t writePos_ = 0;
+  Stats stats_ {};
+};
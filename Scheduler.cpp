@@ -0,0 +1,207 @@
+#include "Scheduler.hpp"
+
+void Scheduler::start(const RtcBootTimeSync& timeSync, const Settings& settings, const Schedule& schedule)
+{
+  timeSync_ = &timeSync;
+  settings_ = &settings;
+  schedule_ = &schedule;
+  allChanged();
+}
+
+bool Scheduler::started() const
+{
+  return timeSync_ != nullptr;
+}
+
+void Scheduler::pumpChanged(int i)
+{
+  pumpDirty_[i] = true;
+}
+
+void Scheduler::lightChanged(int i)
+{
+  lightDirty_[i] = true;
+}
+
+void Scheduler::allChanged()
+{
+  for (int i = 0; i < Settings::PumpCount; ++i) pumpChanged(i);
+  for (int i = 0; i < Settings::LightCount; ++i) lightChanged(i);
+}
+
+void Scheduler::refresh(absolute_time_t now)
+{
+  if (!started()) return;
+
+  for (int i = 0; i < Settings::PumpCount; ++i)
+  {
+    if (!pumpDirty_[i]) continue;
+    pumpDirty_[i] = false;
+    plan(EventType::PumpOn, i, now);
+  }
+  for (int i = 0; i < Settings::LightCount; ++i)
+  {
+    if (!lightDirty_[i]) continue;
+    lightDirty_[i] = false;
+    plan(EventType::LightOn, i, now);
+    plan(EventType::LightOff, i, now);
+  }
+}
+
+void Scheduler::retime(const RtcBootTimeSync& before)
+{
+  if (!started()) return;
+
+  for (int type = 0; type < TypeCount; ++type)
+  {
+    for (int channel = 0; channel < MaxChannels; ++channel)
+    {
+      if (!pending_[type][channel]) continue;
+      uint64_t wallUs = before.wallUsAt(pendingTime_[type][channel]);
+      schedule((EventType)type, channel, timeSync_->timeAtWallUs(wallUs));
+    }
+  }
+}
+
+void Scheduler::schedule(EventType type, int channel, absolute_time_t time)
+{
+  uint16_t gen = ++generation_[(int)type][channel];
+  pending_[(int)type][channel] = true;
+  pendingTime_[(int)type][channel] = time;
+  queue_.push({time, type, (uint8_t)channel, gen});
+
+  // Every replaced event leaves a stale entry behind, don't let them pile up
+  if (queue_.size() > 4 * TypeCount * MaxChannels)
+  {
+    dropStale();
+  }
+}
+
+void Scheduler::cancel(EventType type, int channel)
+{
+  ++generation_[(int)type][channel];
+  pending_[(int)type][channel] = false;
+}
+
+absolute_time_t Scheduler::nextEventTime()
+{
+  while (!queue_.empty() && !live(queue_.top()))
+  {
+    queue_.pop();
+  }
+  return queue_.empty() ? at_the_end_of_time : queue_.top().time;
+}
+
+absolute_time_t Scheduler::pendingTime(EventType type, int channel) const
+{
+  return pending_[(int)type][channel] ? pendingTime_[(int)type][channel] : at_the_end_of_time;
+}
+
+float Scheduler::pendingAmount(int channel) const
+{
+  return pendingAmount_[channel];
+}
+
+bool Scheduler::popDue(absolute_time_t now, Event& ev)
+{
+  if (to_us_since_boot(nextEventTime()) > to_us_since_boot(now))
+  {
+    return false;
+  }
+  ev = queue_.top();
+  queue_.pop();
+  pending_[(int)ev.type][ev.channel] = false;
+  plan(ev.type, ev.channel, ev.time);
+  return true;
+}
+
+bool Scheduler::live(const Event& ev) const
+{
+  return pending_[(int)ev.type][ev.channel] && generation_[(int)ev.type][ev.channel] == ev.generation;
+}
+
+void Scheduler::dropStale()
+{
+  std::vector<Event> liveEvents;
+  while (!queue_.empty())
+  {
+    if (live(queue_.top()))
+    {
+      liveEvents.push_back(queue_.top());
+    }
+    queue_.pop();
+  }
+  for (const Event& ev : liveEvents)
+  {
+    queue_.push(ev);
+  }
+}
+
+void Scheduler::plan(EventType type, int channel, absolute_time_t after)
+{
+  bool enable = type == EventType::PumpOn ? settings_->pump(channel).enable : settings_->light(channel).enable;
+  if (!enable)
+  {
+    cancel(type, channel);
+    return;
+  }
+
+  const ScheduleEntry* entry = nullptr;
+  absolute_time_t time;
+  if (schedule_->follows((ScheduleAction)type, channel))
+  {
+    time = nextScheduled(type, channel, after, entry);
+    if (!entry)
+    {
+      // A light scheduled to come on but never go off, or the other way
+      cancel(type, channel);
+      return;
+    }
+  }
+  else
+  {
+    int32_t secondsSinceMidnight = type == EventType::PumpOn ? settings_->pump(channel).activationTime :
+                                   type == EventType::LightOn ? settings_->light(channel).onTime :
+                                   settings_->light(channel).offTime;
+    time = timeSync_->nextTimeFromSecondsSinceMidnight(secondsSinceMidnight, after);
+  }
+  if (type == EventType::PumpOn)
+  {
+    pendingAmount_[channel] = entry ? entry->amount : settings_->pump(channel).amount;
+  }
+  schedule(type, channel, time);
+}
+
+absolute_time_t Scheduler::nextScheduled(EventType type, int channel, absolute_time_t after, const ScheduleEntry*& entry) const
+{
+  constexpr uint64_t UsPerSecond = 1000000ull;
+  constexpr uint64_t UsPerWeek = 7 * RtcBootTimeSync::usPerDay;
+  // 1 January 1970 was a Thursday
+  constexpr uint64_t EpochWeekday = 4;
+
+  uint64_t wallUs = timeSync_->wallUsAt(after);
+  uint64_t day = wallUs / RtcBootTimeSync::usPerDay;
+  uint64_t weekStartUs = (day - (day + EpochWeekday) % 7) * RtcBootTimeSync::usPerDay;
+  uint32_t second = (uint32_t)((wallUs - weekStartUs) / UsPerSecond);
+
+  // Usually the first one after now, but while the clock slews the
+  // mapping can put that at or before after, so keep going until it isn't
+  absolute_time_t t;
+  do
+  {
+    uint32_t at;
+    entry = schedule_->next((ScheduleAction)type, (uint8_t)channel, second, at);
+    if (!entry)
+    {
+      return at_the_end_of_time;
+    }
+    if (at <= second)
+    {
+      weekStartUs += UsPerWeek;
+    }
+    second = at;
+    t = timeSync_->timeAtWallUs(weekStartUs + at * UsPerSecond);
+  }
+  while (to_us_since_boot(t) <= to_us_since_boot(after));
+  return t;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "RtcBootTimeSync.hpp"
+#include "Schedule.hpp"
+#include "Settings.hpp"
+
+#include <pico/time.h>
+
+#include <queue>
+#include <vector>
+
+// Keeps the upcoming pump and light events in time order, so the main loop
+// can sleep until the next one is due instead of polling for it.
+//
+// There is at most one live event per (type, channel). Replacing or
+// cancelling one just bumps its generation, and the stale queue entry is
+// dropped when it reaches the front.
+//
+// A channel with entries in the Schedule follows them (see Schedule for
+// how lights count), one without comes on once a day at its time in the
+// settings.
+class Scheduler
+{
+public:
+  // Events due at the same time run in this order
+  enum class EventType : uint8_t
+  {
+    LightOff,
+    LightOn,
+    PumpOn,
+    Count
+  };
+
+  static_assert((int)EventType::LightOff == (int)ScheduleAction::LightOff &&
+                (int)EventType::LightOn == (int)ScheduleAction::LightOn &&
+                (int)EventType::PumpOn == (int)ScheduleAction::Water, "schedule actions must be event types");
+
+  struct Event
+  {
+    absolute_time_t time;
+    EventType type;
+    uint8_t channel;
+    uint16_t generation;
+  };
+
+  // Start planning events from the settings and schedule. Everything is
+  // queued on the next refresh().
+  void start(const RtcBootTimeSync& timeSync, const Settings& settings, const Schedule& schedule);
+  bool started() const;
+
+  // Mark the events for a channel as needing to be re-planned, after its
+  // settings or schedule entries changed
+  void pumpChanged(int i);
+  void lightChanged(int i);
+  void allChanged();
+
+  // Re-plan only the channels marked as changed
+  void refresh(absolute_time_t now);
+
+  // The time sync was corrected, it used to look like before. Every
+  // pending event moves to when the clock now reads what it would have
+  // read then, so one the correction moved into the past runs right away
+  // instead of being skipped, and one that already ran isn't planned again.
+  void retime(const RtcBootTimeSync& before);
+
+  void schedule(EventType type, int channel, absolute_time_t time);
+  void cancel(EventType type, int channel);
+
+  // When the next live event is due, or at_the_end_of_time if there is none
+  absolute_time_t nextEventTime();
+
+  // When the live event of this type and channel is due, or
+  // at_the_end_of_time if there is none
+  absolute_time_t pendingTime(EventType type, int channel) const;
+
+  // How much the pending watering of a pump is for, in mL
+  float pendingAmount(int channel) const;
+
+  // Pop the next live event due at or before now. The next one of the
+  // same type and channel is queued as it is popped.
+  bool popDue(absolute_time_t now, Event& ev);
+
+private:
+  static constexpr int MaxChannels = Settings::PumpCount > Settings::LightCount ? Settings::PumpCount : Settings::LightCount;
+  static constexpr int TypeCount = (int)EventType::Count;
+
+  struct Later
+  {
+    bool operator()(const Event& a, const Event& b) const
+    {
+      if (to_us_since_boot(a.time) != to_us_since_boot(b.time))
+      {
+        return to_us_since_boot(a.time) > to_us_since_boot(b.time);
+      }
+      return a.type > b.type;
+    }
+  };
+
+  bool live(const Event& ev) const;
+  void dropStale();
+  void plan(EventType type, int channel, absolute_time_t after);
+  // The first time after (not at) after that a schedule entry comes up
+  absolute_time_t nextScheduled(EventType type, int channel, absolute_time_t after, const ScheduleEntry*& entry) const;
+
+  const RtcBootTimeSync* timeSync_ = nullptr;
+  const Settings* settings_ = nullptr;
+  const Schedule* schedule_ = nullptr;
+  std::priority_queue<Event, std::vector<Event>, Later> queue_;
+  uint16_t generation_[TypeCount][MaxChannels] = {};
+  bool pending_[TypeCount][MaxChannels] = {};
+  absolute_time_t pendingTime_[TypeCount][MaxChannels] = {};
+  float pendingAmount_[Settings::PumpCount] = {};
+  bool pumpDirty_[Settings::PumpCount] = {};
+  bool lightDirty_[Settings::LightCount] = {};
+};
@@ -0,0 +1,106 @@
+#include "SerialRx.hpp"
+
+#include <hardware/sync.h>
+#include <pico/stdio.h>
+
+void SerialRx::begin(void (*onInput)())
+{
+  onInput_ = onInput;
+  stdio_set_chars_available_callback(onCharsAvailable, this);
+  // Anything that came in before there was a callback to say so
+  uint32_t ints = save_and_disable_interrupts();
+  fill();
+  restore_interrupts(ints);
+}
+
+int SerialRx::read()
+{
+  int c = -1;
+  if (!buffer_.consume([&c](uint8_t b) { c = b; }))
+  {
+    if (!stalled_)
+    {
+      return -1;
+    }
+    // The USB stack won't say there's input again until more comes in, so
+    // pick up what's been waiting on us ourselves
+    uint32_t ints = save_and_disable_interrupts();
+    fill();
+    restore_interrupts(ints);
+    if (!buffer_.consume([&c](uint8_t b) { c = b; }))
+    {
+      return -1;
+    }
+  }
+
+  if (c == '\n')
+  {
+    absolute_time_t arrived = nil_time;
+    lineTimes_.consume([&arrived](absolute_time_t t) { arrived = t; });
+    uint32_t latencyUs = (uint32_t)absolute_time_diff_us(arrived, get_absolute_time());
+    lines_++;
+    lastLatencyUs_ = latencyUs;
+    if (latencyUs > worstLatencyUs_)
+    {
+      worstLatencyUs_ = latencyUs;
+    }
+  }
+  return c;
+}
+
+SerialRx::Stats SerialRx::stats() const
+{
+  return Stats {bytes_, lines_, peakBuffered_, stalls_, lastLatencyUs_, worstLatencyUs_};
+}
+
+void SerialRx::resetStats()
+{
+  bytes_ = 0;
+  peakBuffered_ = 0;
+  stalls_ = 0;
+  lines_ = 0;
+  lastLatencyUs_ = 0;
+  worstLatencyUs_ = 0;
+}
+
+void SerialRx::onCharsAvailable(void* param)
+{
+  SerialRx* rx = (SerialRx*)param;
+  rx->fill();
+  if (rx->onInput_)
+  {
+    rx->onInput_();
+  }
+}
+
+void SerialRx::fill()
+{
+  absolute_time_t now = get_absolute_time();
+  // A byte can't be put back once it's read, so only read one when there's
+  // room for it and for its time if it turns out to be a newline
+  while (buffer_.size() < BufferSize && lineTimes_.size() < MaxLines)
+  {
+    int c = getchar_timeout_us(0);
+    if (c < 0)
+    {
+      stalled_ = false;
+      return;
+    }
+    buffer_.push((uint8_t)c);
+    if (c == '\n')
+    {
+      lineTimes_.push(now);
+    }
+    bytes_++;
+    uint32_t buffered = buffer_.size();
+    if (buffered > peakBuffered_)
+    {
+      peakBuffered_ = buffered;
+    }
+  }
+  if (!stalled_)
+  {
+    stalls_++;
+    stalled_ = true;
+  }
+}
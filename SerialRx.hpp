@@ -0,0 +1,56 @@
+#pragma once
+
+#include "SpscQueue.hpp"
+
+#include <pico/time.h>
+
+#include <stdint.h>
+
+// Takes serial input off the USB stack as soon as it arrives, from the
+// stdio chars available callback, and keeps it in a ring buffer until the
+// main loop gets to it. However long the main loop is busy, nothing gets
+// lost: once the ring is full the callback leaves the rest in the USB
+// stack, which holds the host off until the main loop has made room.
+class SerialRx
+{
+public:
+  static constexpr size_t BufferSize = 4096;
+  // Newlines waiting at once, each remembers when it came in
+  static constexpr size_t MaxLines = 64;
+
+  struct Stats
+  {
+    uint32_t bytes;
+    uint32_t lines;          // newlines the main loop took
+    uint32_t peakBuffered;   // most bytes waiting at once
+    uint32_t stalls;         // times the ring filled up and input had to wait
+    uint32_t lastLatencyUs;  // from a newline coming in to the main loop taking it
+    uint32_t worstLatencyUs;
+  };
+
+  // Start taking input. onInput is called in interrupt context whenever
+  // something came in, e.g. to get the main loop out of its sleep.
+  void begin(void (*onInput)());
+
+  // The next byte for the main loop, -1 if there's nothing waiting
+  int read();
+
+  Stats stats() const;
+  void resetStats();
+
+private:
+  static void onCharsAvailable(void* param);
+  void fill();
+
+  SpscQueue<uint8_t, BufferSize> buffer_;
+  SpscQueue<absolute_time_t, MaxLines> lineTimes_;
+  void (*onInput_)() = nullptr;
+  volatile bool stalled_ = false;
+
+  volatile uint32_t bytes_ = 0;
+  volatile uint32_t peakBuffered_ = 0;
+  volatile uint32_t stalls_ = 0;
+  uint32_t lines_ = 0;
+  uint32_t lastLatencyUs_ = 0;
+  uint32_t worstLatencyUs_ = 0;
+};
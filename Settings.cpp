@@ -1,120 +1,276 @@
 #include "Settings.hpp"
+#include "SettingsFields.hpp"
 
-#include <vector>
 #include <cstring>
 #include <iostream>
-#include <algorithm>
 
 namespace
 {
+  // Where a field's value is
   template <typename T>
-  bool validate(T& field, T min, T max, T defaultVal)
+  T* at(Settings& settings, const SettingField& field)
   {
-    if (field < min || field > max)
+    return (T*)((uint8_t*)&settings + field.offset);
+  }
+
+  template <typename T>
+  const T* at(const Settings& settings, const SettingField& field)
+  {
+    return (const T*)((const uint8_t*)&settings + field.offset);
+  }
+
+  // Written so NaN is out of range too
+  bool inRange(const SettingField& field, float value)
+  {
+    return value >= field.min && value <= field.max;
+  }
+
+  void setDefault(Settings& settings, const SettingField& field)
+  {
+    switch (field.type)
     {
-      field = defaultVal;
-      return true;
+    case FieldType::Bool:
+      *at<bool>(settings, field) = field.defaultValue != 0;
+      break;
+    case FieldType::Int32:
+      *at<int32_t>(settings, field) = (int32_t)field.defaultValue;
+      break;
+    case FieldType::Float:
+      *at<float>(settings, field) = field.defaultValue;
+      break;
+    case FieldType::String:
+      strncpy(at<char>(settings, field), field.defaultText, field.size - 1);
+      break;
+    }
+  }
+
+  bool valid(const Settings& settings, const SettingField& field)
+  {
+    switch (field.type)
+    {
+    case FieldType::Bool:
+      return *at<uint8_t>(settings, field) <= 1;
+    case FieldType::Int32:
+      return inRange(field, (float)*at<int32_t>(settings, field));
+    case FieldType::Float:
+      return inRange(field, *at<float>(settings, field));
+    case FieldType::String:
+      return memchr(at<char>(settings, field), 0, field.size) != nullptr;
     }
     return false;
   }
 }
 
-void Settings::setDefaults()
+namespace SettingFields
 {
-  memcpy(wifiSsid, "wifi", 5);
-  memcpy(wifiPassword, "password", 9);
-  offsetFromUtc = -5.0f; // EST in the US
-  pump1 = { true, 1.3f, 80.0f, 8 * 60 * 60 };
-  pump2 = { false, 1.3f, 80.0f, 8 * 60 * 60 };
-  pump3 = { false, 1.3f, 80.0f, 8 * 60 * 60 };
-  pump4 = { false, 1.3f, 80.0f, 8 * 60 * 60 };
-  light1 = { true, 8 * 60 * 60, (8 + 12) * 60 * 60};
-  light2 = { false, 8 * 60 * 60, (8 + 12) * 60 * 60};
-}
+  FieldResult parse(Settings& settings, const SettingField& field, Tokens& args)
+  {
+    switch (field.type)
+    {
+    case FieldType::String:
+    {
+      // The whole rest of the line, spaces and all
+      std::string_view str = args.rest();
+      if (str.empty())
+      {
+        return FieldResult::ParseError;
+      }
+      if (str.size() >= field.size)
+      {
+        return FieldResult::TooLong;
+      }
+      memcpy(at<char>(settings, field), str.data(), str.size());
+      at<char>(settings, field)[str.size()] = '\0';
+      return FieldResult::Ok;
+    }
+    case FieldType::Float:
+    {
+      float value;
+      if (!parseNumber(args.next(), value))
+      {
+        return FieldResult::ParseError;
+      }
+      if (!inRange(field, value))
+      {
+        return FieldResult::OutOfRange;
+      }
+      *at<float>(settings, field) = value;
+      return FieldResult::Ok;
+    }
+    default:
+    {
+      int32_t value;
+      if (!parseNumber(args.next(), value))
+      {
+        return FieldResult::ParseError;
+      }
+      if (!inRange(field, (float)value))
+      {
+        return FieldResult::OutOfRange;
+      }
+      if (field.type == FieldType::Bool)
+      {
+        *at<bool>(settings, field) = value == 1;
+      }
+      else
+      {
+        *at<int32_t>(settings, field) = value;
+      }
+      return FieldResult::Ok;
+    }
+    }
+  }
 
-bool Settings::validateAll()
-{
-  // Validate the settings to make sure they are ok after load
-  bool failedValidation = false;
-  // tbd: actually validate stuff
-  return !failedValidation;
-}
+  FieldResult set(Settings& settings, const SettingField& field, const uint8_t* value, size_t len)
+  {
+    switch (field.type)
+    {
+    case FieldType::String:
+      if (len == 0 || len >= field.size || memchr(value, 0, len))
+      {
+        return FieldResult::BadLength;
+      }
+      memcpy(at<char>(settings, field), value, len);
+      at<char>(settings, field)[len] = '\0';
+      return FieldResult::Ok;
+    case FieldType::Bool:
+      if (len != 1)
+      {
+        return FieldResult::BadLength;
+      }
+      if (value[0] > 1)
+      {
+        return FieldResult::OutOfRange;
+      }
+      *at<bool>(settings, field) = value[0];
+      return FieldResult::Ok;
+    case FieldType::Int32:
+    {
+      int32_t v;
+      if (len != sizeof(v))
+      {
+        return FieldResult::BadLength;
+      }
+      memcpy(&v, value, sizeof(v));
+      if (!inRange(field, (float)v))
+      {
+        return FieldResult::OutOfRange;
+      }
+      *at<int32_t>(settings, field) = v;
+      return FieldResult::Ok;
+    }
+    case FieldType::Float:
+    {
+      float v;
+      if (len != sizeof(v))
+      {
+        return FieldResult::BadLength;
+      }
+      memcpy(&v, value, sizeof(v));
+      if (!inRange(field, v))
+      {
+        return FieldResult::OutOfRange;
+      }
+      *at<float>(settings, field) = v;
+      return FieldResult::Ok;
+    }
+    }
+    return FieldResult::BadLength;
+  }
 
-void PumpConfig::print()
-{
-  std::cout << "enable: " << (enable ? "1" : "0") << std::endl;
-  std::cout << "rate: " << rate << " mL/sec" << std::endl;
-  std::cout << "amount: " << amount << " mL" << std::endl;
-  std::cout << "activationTime: " << activationTime << " secs after midnight" << std::endl << std::flush;
-}
+  const uint8_t* get(const Settings& settings, const SettingField& field, size_t& len)
+  {
+    len = field.type == FieldType::String ? strnlen(at<char>(settings, field), field.size) : field.size;
+    return at<uint8_t>(settings, field);
+  }
 
-void LightConfig::print()
-{
-  std::cout << "enable: " << (enable ? "1" : "0") << std::endl;
-  std::cout << "onTime: " << onTime << " secs after midnight" << std::endl;
-  std::cout << "offTime: " << offTime << " secs after midnight" << std::endl << std::flush;
-}
+  size_t valueSize(const Settings& settings, const SettingField& field)
+  {
+    if (field.type != FieldType::String)
+    {
+      return field.size;
+    }
+    size_t len = strnlen(at<char>(settings, field), field.size);
+    return len < field.size ? len + 1 : len;
+  }
 
-void Settings::print()
-{
-  std::cout << "-- Silvanus Pico v1.1 --" << std::endl;
-  std::cout << "wifiSsid: " << wifiSsid << std::endl;
-  std::cout << "wifiPassword: " << wifiPassword << std::endl;
-  std::cout << "offsetFromUtc: " << offsetFromUtc << " hours" << std::endl << std::flush;
-  std::cout << "-- Pump 1 --" << std::endl;
-  pump1.print();
-  std::cout << "-- Pump 2 --" << std::endl;
-  pump2.print();
-  std::cout << "-- Pump 3 --" << std::endl;
-  pump3.print();
-  std::cout << "-- Pump 4 --" << std::endl;
-  pump4.print();
-  std::cout << "-- Light 1 --" << std::endl;
-  light1.print();
-  std::cout << "-- Light 2 --" << std::endl;
-  light2.print();
-}
+  bool equal(const Settings& a, const Settings& b, const SettingField& field)
+  {
+    size_t size = valueSize(a, field);
+    return size == valueSize(b, field) && memcmp(at<uint8_t>(a, field), at<uint8_t>(b, field), size) == 0;
+  }
 
-PumpConfig& Settings::pump(int i)
-{
-  switch (i)
+  bool equal(const Settings& a, const Settings& b)
   {
-    case 0: return pump1;
-    case 1: return pump2;
-    case 2: return pump3;
-    case 3: return pump4;
-    default: return pump1;
+    for (const SettingField& field : table)
+    {
+      if (!equal(a, b, field))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void print(const Settings& settings, const SettingField& field)
+  {
+    std::cout << field.name << ": ";
+    switch (field.type)
+    {
+    case FieldType::Bool:
+      std::cout << (*at<bool>(settings, field) ? "1" : "0");
+      break;
+    case FieldType::Int32:
+      std::cout << *at<int32_t>(settings, field);
+      break;
+    case FieldType::Float:
+      std::cout << *at<float>(settings, field);
+      break;
+    case FieldType::String:
+      std::cout << at<char>(settings, field);
+      break;
+    }
+    std::cout << field.unit << std::endl;
   }
 }
 
-const PumpConfig& Settings::pump(int i) const
+void Settings::setDefaults()
 {
-  switch (i)
+  memset(this, 0, sizeof(Settings));
+  for (const SettingField& field : SettingFields::table)
   {
-    case 0: return pump1;
-    case 1: return pump2;
-    case 2: return pump3;
-    case 3: return pump4;
-    default: return pump1;
+    setDefault(*this, field);
   }
 }
 
-LightConfig& Settings::light(int i)
+bool Settings::validateAll()
 {
-  switch (i)
+  // Anything that didn't survive in flash goes back to its default
+  bool failedValidation = false;
+  for (const SettingField& field : SettingFields::table)
   {
-    case 0: return light1;
-    case 1: return light2;
-    default: return light1;
+    if (!valid(*this, field))
+    {
+      setDefault(*this, field);
+      failedValidation = true;
+    }
   }
+  return !failedValidation;
 }
 
-const LightConfig& Settings::light(int i) const
+void Settings::print() const
 {
-  switch (i)
+  static const char* groupNames[] = {"", "Pump", "Light"};
+  std::cout << "-- Silvanus Pico v1.1 --" << std::endl;
+  const SettingField* last = nullptr;
+  for (const SettingField& field : SettingFields::table)
   {
-    case 0: return light1;
-    case 1: return light2;
-    default: return light1;
+    if (field.group != FieldGroup::General && (!last || last->group != field.group || last->channel != field.channel))
+    {
+      std::cout << "-- " << groupNames[(int)field.group] << " " << field.channel + 1 << " --" << std::endl;
+    }
+    SettingFields::print(*this, field);
+    last = &field;
   }
+  std::cout << std::flush;
 }
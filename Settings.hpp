@@ -8,7 +8,6 @@ struct PumpConfig
   float rate; // mL per second
   float amount; // mL
   int32_t activationTime; // seconds since midnight
-  void print();
 };
 
 struct LightConfig
@@ -16,34 +15,46 @@ struct LightConfig
   bool enable;
   int32_t onTime; // seconds since midnight
   int32_t offTime; // seconds since midnight
-  void print();
 };
 
 struct Settings
 {
-  bool reserved; // not used, only here for backwards compatibility
-  char wifiSsid[256];
-  char wifiPassword[256]; // only wpa2-psk auth supported
-  float offsetFromUtc; // in hours
-  PumpConfig pump1;
-  PumpConfig pump2;
-  PumpConfig pump3;
-  PumpConfig pump4;
-  LightConfig light1;
-  LightConfig light2;
-
-  PumpConfig& pump(int i);
-  LightConfig& light(int i);
+  static constexpr int PumpCount = 4;
+  static constexpr int LightCount = 2;
 
-  const PumpConfig& pump(int i) const;
-  const LightConfig& light(int i) const;
-
-  // Set all settings to their default values
+  char wifiSsid[33]; // 802.11 allows 32 bytes
+  char wifiPassword[65]; // only wpa2-psk auth supported, 63 characters or 64 hex digits
+  float offsetFromUtc; // in hours
+  PumpConfig pumps[PumpCount];
+  LightConfig lights[LightCount];
+
+  PumpConfig& pump(int i)
+  {
+    return pumps[i];
+  }
+
+  LightConfig& light(int i)
+  {
+    return lights[i];
+  }
+
+  const PumpConfig& pump(int i) const
+  {
+    return pumps[i];
+  }
+
+  const LightConfig& light(int i) const
+  {
+    return lights[i];
+  }
+
+  // Set all settings to their default values. The defaults, ranges and
+  // names of the settings are in SettingsFields.hpp.
   void setDefaults();
 
   // Returns true if all settings are ok, false if any had to be changed 
   bool validateAll();
 
   // Print all the settings to cout
-  void print();
+  void print() const;
 };
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "Command.hpp"
+#include "Settings.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Every setting described once, in a table built at compile time: its
+// name, where it lives in Settings, its type, the values it may take and
+// its default. Parsing the text commands, the binary protocol's get and
+// set, printing, defaults, validation and the flash store's diffs all
+// work from the table, so a new setting is a new row.
+
+enum class FieldType : uint8_t
+{
+  Bool,
+  Int32,
+  Float,
+  String,
+};
+
+enum class FieldGroup : uint8_t
+{
+  General, // a command of its own, "offsetFromUtc -5"
+  Pump,    // "pump <n> <name> <value>"
+  Light,   // "light <n> <name> <value>"
+};
+
+struct SettingField
+{
+  std::string_view name;
+  FieldGroup group;
+  uint8_t channel;          // pump or light, from 0
+  uint8_t id;               // in the binary protocol
+  FieldType type;
+  uint16_t offset;          // into Settings
+  uint16_t size;
+  float min;                // numbers only
+  float max;
+  float defaultValue;
+  const char* defaultText;  // strings only
+  const char* unit;         // printed after the value
+};
+
+// How setting a field from text or bytes went
+enum class FieldResult : uint8_t
+{
+  Ok,
+  ParseError,
+  OutOfRange,
+  TooLong,   // a string that doesn't fit
+  BadLength, // bytes of the wrong size
+};
+
+namespace SettingFields
+{
+  constexpr size_t PumpFieldCount = 4;
+  constexpr size_t LightFieldCount = 3;
+  constexpr size_t Count = 3 + Settings::PumpCount * PumpFieldCount + Settings::LightCount * LightFieldCount;
+
+  // Binary protocol ids. The pump and light fields go in blocks of four
+  // per channel.
+  constexpr uint8_t PumpIdBase = 16;
+  constexpr uint8_t LightIdBase = 32;
+  constexpr size_t IdCount = 64;
+  constexpr uint8_t WifiSsidId = 0;
+  constexpr uint8_t WifiPasswordId = 1;
+  constexpr uint8_t OffsetFromUtcId = 2;
+
+  constexpr float DaySecs = 24 * 60 * 60;
+
+  constexpr std::array<SettingField, Count> table = []
+  {
+    std::array<SettingField, Count> t {};
+    size_t n = 0;
+    t[n++] = {"wifiSsid", FieldGroup::General, 0, WifiSsidId, FieldType::String, offsetof(Settings, wifiSsid),
+              sizeof(Settings::wifiSsid), 0, 0, 0, "wifi", ""};
+    t[n++] = {"wifiPassword", FieldGroup::General, 0, WifiPasswordId, FieldType::String, offsetof(Settings, wifiPassword),
+              sizeof(Settings::wifiPassword), 0, 0, 0, "password", ""};
+    t[n++] = {"offsetFromUtc", FieldGroup::General, 0, OffsetFromUtcId, FieldType::Float, offsetof(Settings, offsetFromUtc),
+              sizeof(float), -24.0f, 24.0f, -5.0f, nullptr, " hours"}; // EST in the US
+    for (uint8_t p = 0; p < Settings::PumpCount; ++p)
+    {
+      uint16_t base = offsetof(Settings, pumps) + p * sizeof(PumpConfig);
+      uint8_t id = PumpIdBase + 4 * p;
+      // Only the first pump is on out of the box
+      t[n++] = {"enable", FieldGroup::Pump, p, id, FieldType::Bool, (uint16_t)(base + offsetof(PumpConfig, enable)),
+                sizeof(bool), 0, 1, p == 0 ? 1.0f : 0.0f, nullptr, ""};
+      t[n++] = {"rate", FieldGroup::Pump, p, (uint8_t)(id + 1), FieldType::Float, (uint16_t)(base + offsetof(PumpConfig, rate)),
+                sizeof(float), 0.0f, 1000.0f, 1.3f, nullptr, " mL/sec"};
+      t[n++] = {"amount", FieldGroup::Pump, p, (uint8_t)(id + 2), FieldType::Float, (uint16_t)(base + offsetof(PumpConfig, amount)),
+                sizeof(float), 0.0f, 1000.0f, 80.0f, nullptr, " mL"};
+      t[n++] = {"activationTime", FieldGroup::Pump, p, (uint8_t)(id + 3), FieldType::Int32,
+                (uint16_t)(base + offsetof(PumpConfig, activationTime)), sizeof(int32_t), 0, DaySecs, 8 * 60 * 60,
+                nullptr, " secs after midnight"};
+    }
+    for (uint8_t l = 0; l < Settings::LightCount; ++l)
+    {
+      uint16_t base = offsetof(Settings, lights) + l * sizeof(LightConfig);
+      uint8_t id = LightIdBase + 4 * l;
+      t[n++] = {"enable", FieldGroup::Light, l, id, FieldType::Bool, (uint16_t)(base + offsetof(LightConfig, enable)),
+                sizeof(bool), 0, 1, l == 0 ? 1.0f : 0.0f, nullptr, ""};
+      t[n++] = {"onTime", FieldGroup::Light, l, (uint8_t)(id + 1), FieldType::Int32, (uint16_t)(base + offsetof(LightConfig, onTime)),
+                sizeof(int32_t), 0, DaySecs, 8 * 60 * 60, nullptr, " secs after midnight"};
+      t[n++] = {"offTime", FieldGroup::Light, l, (uint8_t)(id + 2), FieldType::Int32, (uint16_t)(base + offsetof(LightConfig, offTime)),
+                sizeof(int32_t), 0, DaySecs, (8 + 12) * 60 * 60, nullptr, " secs after midnight"};
+    }
+    return t;
+  }();
+
+  // Binary id to table index, 0xff where there's no field
+  constexpr std::array<uint8_t, IdCount> byId = []
+  {
+    std::array<uint8_t, IdCount> ids {};
+    for (uint8_t& i : ids)
+    {
+      i = 0xff;
+    }
+    for (size_t i = 0; i < Count; ++i)
+    {
+      ids[table[i].id] = (uint8_t)i;
+    }
+    return ids;
+  }();
+
+  // Names to the field of the first channel in each group. The other
+  // channels' fields follow it a block at a time.
+  template <size_t N>
+  constexpr auto groupNames(FieldGroup group)
+  {
+    CommandEntry<const SettingField*> entries[N] = {};
+    size_t n = 0;
+    for (const SettingField& field : table)
+    {
+      if (field.group == group && field.channel == 0)
+      {
+        entries[n++] = {field.name, &field};
+      }
+    }
+    return makeCommandTable(entries);
+  }
+
+  constexpr auto generalNames = groupNames<3>(FieldGroup::General);
+  constexpr auto pumpNames = groupNames<PumpFieldCount>(FieldGroup::Pump);
+  constexpr auto lightNames = groupNames<LightFieldCount>(FieldGroup::Light);
+
+  // The field for an id, nullptr if there's none
+  constexpr const SettingField* find(uint8_t id)
+  {
+    return id < IdCount && byId[id] != 0xff ? &table[byId[id]] : nullptr;
+  }
+
+  // The field for a name in a group, nullptr if there's none. channel
+  // must be in range for the group.
+  constexpr const SettingField* find(FieldGroup group, uint8_t channel, std::string_view name)
+  {
+    switch (group)
+    {
+    case FieldGroup::General:
+      return generalNames.find(name);
+    case FieldGroup::Pump:
+    {
+      const SettingField* field = pumpNames.find(name);
+      return field ? field + channel * PumpFieldCount : nullptr;
+    }
+    case FieldGroup::Light:
+    {
+      const SettingField* field = lightNames.find(name);
+      return field ? field + channel * LightFieldCount : nullptr;
+    }
+    }
+    return nullptr;
+  }
+
+  // Set a field from the text after its name. Strings take the whole rest
+  // of the line.
+  FieldResult parse(Settings& settings, const SettingField& field, Tokens& args);
+
+  // Set a field from the binary protocol's little endian bytes
+  FieldResult set(Settings& settings, const SettingField& field, const uint8_t* value, size_t len);
+
+  // The bytes the binary protocol sends for a field, strings without their
+  // terminator
+  const uint8_t* get(const Settings& settings, const SettingField& field, size_t& len);
+
+  // The bytes that make up a field's value: the whole of a number, a
+  // string up to and including its terminator
+  size_t valueSize(const Settings& settings, const SettingField& field);
+
+  bool equal(const Settings& a, const Settings& b, const SettingField& field);
+  bool equal(const Settings& a, const Settings& b);
+
+  // "name: value unit"
+  void print(const Settings& settings, const SettingField& field);
+
+  constexpr bool tableValid()
+  {
+    for (size_t i = 0; i < Count; ++i)
+    {
+      const SettingField& field = table[i];
+      // In the order they're laid out, the flash store relies on it
+      if (i > 0 && field.offset < table[i - 1].offset + table[i - 1].size)
+      {
+        return false;
+      }
+      if (field.offset + field.size > sizeof(Settings) || find(field.id) != &field)
+      {
+        return false;
+      }
+    }
+    return generalNames.valid() && pumpNames.valid() && lightNames.valid();
+  }
+}
+
+static_assert(SettingFields::tableValid(), "setting fields must be in order, in Settings, with ids and names of their own");
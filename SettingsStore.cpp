@@ -0,0 +1,327 @@
+#include "SettingsStore.hpp"
+#include "FlashScheduler.hpp"
+#include "Log.hpp"
+#include "SettingsFields.hpp"
+
+#include <cpp/FlashStorage.hpp>
+
+#include <hardware/flash.h>
+
+#include <cstring>
+
+namespace
+{
+  // Just below the checkpoints, which are below the old settings sector
+  constexpr uint32_t StoreOffset = PICO_FLASH_SIZE_BYTES - (3 + SettingsStore::SectorCount) * FLASH_SECTOR_SIZE;
+
+  uint32_t fnv1a(const uint8_t* bytes, size_t len, uint32_t hash = 2166136261u)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  // The most a record of every field can take: a run header each, in case
+  // they all changed but every other one, and strings at their longest
+  constexpr size_t MaxRecordSize = []
+  {
+    size_t n = 0;
+    for (const SettingField& field : SettingFields::table)
+    {
+      n += 2 + (field.type == FieldType::String ? 1 + field.size - 1 : field.size);
+    }
+    return n;
+  }();
+
+  // Room for the sector and record headers and the biggest record
+  uint8_t commitBuffer[16 + MaxRecordSize];
+
+  // Set the fields in a record's runs. False if they don't make sense,
+  // which leaves settings as they were.
+  bool decode(Settings& settings, const uint8_t* runs, size_t len)
+  {
+    Settings next = settings;
+    size_t pos = 0;
+    while (pos < len)
+    {
+      if (pos + 2 > len)
+      {
+        return false;
+      }
+      const SettingField* field = SettingFields::find(runs[pos]);
+      size_t count = runs[pos + 1];
+      pos += 2;
+      if (!field || (size_t)(field - SettingFields::table.data()) + count > SettingFields::Count)
+      {
+        return false;
+      }
+      for (size_t i = 0; i < count; ++i, ++field)
+      {
+        size_t size = field->size;
+        if (field->type == FieldType::String)
+        {
+          if (pos >= len)
+          {
+            return false;
+          }
+          size = runs[pos++];
+        }
+        if (pos + size > len)
+        {
+          return false;
+        }
+        // A value out of range keeps the one from before
+        SettingFields::set(next, *field, runs + pos, size);
+        pos += size;
+      }
+    }
+    settings = next;
+    return true;
+  }
+
+  // -- Older formats --
+
+  // The Settings struct as version 1 stored it, byte for byte
+  struct OldSettings
+  {
+    bool reserved;
+    char wifiSsid[256];
+    char wifiPassword[256];
+    float offsetFromUtc;
+    PumpConfig pumps[Settings::PumpCount];
+    LightConfig lights[Settings::LightCount];
+  };
+
+  void upgradeString(char* to, size_t size, const char* from, size_t fromSize, const char* name)
+  {
+    size_t len = strnlen(from, fromSize);
+    if (len < size)
+    {
+      memcpy(to, from, len + 1);
+    }
+    else
+    {
+      LOG_WARN << name << " is too long to keep, back to its default";
+    }
+  }
+
+  void upgrade(const OldSettings& old, Settings& settings)
+  {
+    settings.setDefaults();
+    upgradeString(settings.wifiSsid, sizeof(settings.wifiSsid), old.wifiSsid, sizeof(old.wifiSsid), "wifiSsid");
+    upgradeString(settings.wifiPassword, sizeof(settings.wifiPassword), old.wifiPassword, sizeof(old.wifiPassword),
+                  "wifiPassword");
+    settings.offsetFromUtc = old.offsetFromUtc;
+    for (int i = 0; i < Settings::PumpCount; ++i)
+    {
+      settings.pump(i) = old.pumps[i];
+    }
+    for (int i = 0; i < Settings::LightCount; ++i)
+    {
+      settings.light(i) = old.lights[i];
+    }
+    // Before it goes back in flash
+    settings.validateAll();
+  }
+}
+
+bool SettingsStore::readFromFlash()
+{
+  // Newest sector first. If a reset came before its snapshot was written,
+  // the one before still has everything up to then.
+  uint32_t order[SectorCount];
+  uint32_t valid = sectorsByAge(order);
+
+  // Anything written from here on goes after the newest sector
+  sector_ = valid ? order[0] : SectorCount - 1;
+  sequence_ = valid ? sectorHeader(order[0])->sequence : 0;
+  writePos_ = FLASH_SECTOR_SIZE;
+  haveCommitted_ = false;
+
+  for (uint32_t i = 0; i < valid; ++i)
+  {
+    Settings settings;
+    if (replay(order[i], settings))
+    {
+      data = settings;
+      committed_ = settings;
+      haveCommitted_ = true;
+      sector_ = order[i];
+      return true;
+    }
+  }
+  return readOlder();
+}
+
+bool SettingsStore::readOlder()
+{
+  // The whole struct in the old settings sector
+  FlashStorage<OldSettings> legacy;
+  if (!legacy.readFromFlash())
+  {
+    return false;
+  }
+
+  upgrade(legacy.data, data);
+  LOG_INFO << "Upgrading settings from version 1 to " << SchemaVersion;
+  writeToFlash();
+  return true;
+}
+
+bool SettingsStore::writeToFlash()
+{
+  if (haveCommitted_ && SettingFields::equal(committed_, data))
+  {
+    return false;
+  }
+
+  static_assert(sizeof(SectorHeader) + sizeof(RecordHeader) <= sizeof(commitBuffer) - MaxRecordSize,
+                "commit buffer too small");
+  static_assert(FlashScheduler::compactionWindows(sizeof(commitBuffer)) <= FlashScheduler::SettingsWindows,
+                "a settings snapshot doesn't fit the flash queue");
+  uint32_t fields = 0;
+  size_t len = haveCommitted_ ? encode(committed_, data, false, commitBuffer, fields) : 0;
+  if (len != 0 && writePos_ + len <= FLASH_SECTOR_SIZE)
+  {
+    FlashScheduler::program(sectorOffset(sector_) + writePos_, commitBuffer, len, TraceFlash::Settings);
+    writePos_ += len;
+  }
+  else
+  {
+    // Start over in the oldest sector with a snapshot
+    sector_ = (sector_ + 1) % SectorCount;
+    SectorHeader header {Magic, SchemaVersion, ++sequence_};
+    memcpy(commitBuffer, &header, sizeof(header));
+    len = sizeof(header) + encode(data, data, true, commitBuffer + sizeof(header), fields);
+    FlashScheduler::erase(sectorOffset(sector_), TraceFlash::Settings);
+    FlashScheduler::program(sectorOffset(sector_), commitBuffer, len, TraceFlash::Settings);
+    writePos_ = len;
+    stats_.compactions++;
+  }
+
+  committed_ = data;
+  haveCommitted_ = true;
+  stats_.commits++;
+  stats_.fields += fields;
+  stats_.bytesWritten += len;
+  return true;
+}
+
+uint32_t SettingsStore::sectorOffset(uint32_t sector)
+{
+  return StoreOffset + sector * FLASH_SECTOR_SIZE;
+}
+
+const SettingsStore::SectorHeader* SettingsStore::sectorHeader(uint32_t sector)
+{
+  return (const SectorHeader*)(XIP_BASE + sectorOffset(sector));
+}
+
+uint32_t SettingsStore::sectorsByAge(uint32_t* order)
+{
+  uint32_t valid = 0;
+  for (uint32_t sector = 0; sector < SectorCount; ++sector)
+  {
+    const SectorHeader* header = sectorHeader(sector);
+    if (header->magic == Magic && header->version == SchemaVersion)
+    {
+      uint32_t i = valid++;
+      while (i > 0 && sectorHeader(order[i - 1])->sequence < header->sequence)
+      {
+        order[i] = order[i - 1];
+        i--;
+      }
+      order[i] = sector;
+    }
+  }
+  return valid;
+}
+
+uint16_t SettingsStore::recordChecksum(const RecordHeader& header, const uint8_t* data)
+{
+  uint32_t hash = fnv1a((const uint8_t*)&header.length, sizeof(header.length));
+  hash = fnv1a(data, header.length, hash);
+  return (uint16_t)(hash ^ (hash >> 16));
+}
+
+bool SettingsStore::replay(uint32_t sector, Settings& settings)
+{
+  const uint8_t* base = (const uint8_t*)(XIP_BASE + sectorOffset(sector));
+  // A field the snapshot doesn't have, say one newer than it, keeps its
+  // default
+  settings.setDefaults();
+  bool committed = false;
+  bool partial = false;
+  uint32_t pos = sizeof(SectorHeader);
+
+  while (pos + sizeof(RecordHeader) <= FLASH_SECTOR_SIZE)
+  {
+    RecordHeader header;
+    memcpy(&header, base + pos, sizeof(header));
+    if (header.length == 0xffff)
+    {
+      break;
+    }
+    const uint8_t* runs = base + pos + sizeof(header);
+    if (pos + sizeof(header) + header.length > FLASH_SECTOR_SIZE ||
+        header.checksum != recordChecksum(header, runs) || !decode(settings, runs, header.length))
+    {
+      // Half written, nothing after it can be trusted
+      partial = true;
+      break;
+    }
+    committed = true;
+    pos += sizeof(header) + header.length;
+  }
+
+  // Appending after a commit that didn't finish would leave it in the way
+  // of the ones after, so the next write starts a new sector instead
+  writePos_ = partial ? FLASH_SECTOR_SIZE : pos;
+  return committed;
+}
+
+size_t SettingsStore::encode(const Settings& from, const Settings& to, bool all, uint8_t* out, uint32_t& fields)
+{
+  // Each run of changed fields is the id of the first, how many there are
+  // and then their values in table order
+  size_t n = sizeof(RecordHeader);
+  fields = 0;
+  size_t i = 0;
+  while (i < SettingFields::Count)
+  {
+    if (!all && SettingFields::equal(from, to, SettingFields::table[i]))
+    {
+      i++;
+      continue;
+    }
+    uint8_t* run = out + n;
+    run[0] = SettingFields::table[i].id;
+    run[1] = 0;
+    n += 2;
+    while (i < SettingFields::Count && (all || !SettingFields::equal(from, to, SettingFields::table[i])))
+    {
+      const SettingField& field = SettingFields::table[i++];
+      size_t len;
+      const uint8_t* value = SettingFields::get(to, field, len);
+      if (field.type == FieldType::String)
+      {
+        out[n++] = (uint8_t)len;
+      }
+      memcpy(out + n, value, len);
+      n += len;
+      run[1]++;
+      fields++;
+    }
+  }
+
+  if (n == sizeof(RecordHeader))
+  {
+    return 0;
+  }
+  RecordHeader header {(uint16_t)(n - sizeof(RecordHeader)), 0};
+  header.checksum = recordChecksum(header, out + sizeof(header));
+  memcpy(out, &header, sizeof(header));
+  return n;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Settings.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Keeps the settings in flash as a log of changes, so saving after every
+// little edit costs a page program instead of erasing a sector.
+//
+// The log lives in a ring of sectors, one of them active at a time. A
+// sector starts with a header and a snapshot of all the settings, then
+// each commit appends a record of the fields that changed since the last
+// one. When a commit doesn't fit, the oldest sector is erased and becomes
+// the active one with a fresh snapshot, so every sector takes its turn at
+// wearing out. At boot the active sector's records are replayed to get the
+// settings back.
+//
+// Records are packed rather than copies of the Settings struct: runs of
+// fields named by their binary protocol id, numbers as they are and
+// strings as a length and their characters. The sector header carries the
+// schema version of that encoding. Settings found at boot in the older
+// format, the whole struct in the old settings sector, are read the old
+// way, upgraded and written back as a snapshot in the current format.
+//
+// Records are checksummed, so a commit cut short by a reset is left out of
+// the replay.
+class SettingsStore
+{
+public:
+  struct Stats
+  {
+    uint32_t commits;
+    uint32_t fields;
+    uint32_t bytesWritten;
+    uint32_t compactions;
+  };
+
+  Settings data;
+
+  // Rebuild the settings from the log. Settings saved in an older format
+  // are upgraded and a snapshot of them is queued to be written right
+  // away. False if there is nothing valid in any of them.
+  bool readFromFlash();
+
+  // Append what changed since the last read or write, false if nothing
+  // did. The writing itself is queued with FlashScheduler.
+  bool writeToFlash();
+
+  Stats stats() const
+  {
+    return stats_;
+  }
+
+  void resetStats()
+  {
+    stats_ = {};
+  }
+
+  // Bytes of the active sector in use
+  uint32_t used() const
+  {
+    return writePos_;
+  }
+
+  static constexpr uint32_t SectorCount = 4;
+
+  // Of the encoding in the sector headers. 1 was the whole struct in one
+  // sector. Bump it when a field's id or type changes, and teach
+  // readFromFlash to upgrade from the one before.
+  static constexpr uint32_t SchemaVersion = 2;
+
+private:
+  struct SectorHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+  };
+
+  struct RecordHeader
+  {
+    uint16_t length;   // of the runs after the header
+    uint16_t checksum; // of the length and runs
+  };
+
+  static constexpr uint32_t Magic = 0x53544f52;
+
+  static uint32_t sectorOffset(uint32_t sector);
+  static const SectorHeader* sectorHeader(uint32_t sector);
+  static uint16_t recordChecksum(const RecordHeader& header, const uint8_t* data);
+  // The sectors in the current format, newest first. Returns how many.
+  static uint32_t sectorsByAge(uint32_t* order);
+  bool replay(uint32_t sector, Settings& settings);
+  // Find settings in an older format and upgrade them
+  bool readOlder();
+  // A record of the fields that differ between from and to in out, all of
+  // them if all is set. Returns its size, 0 if nothing changed.
+  static size_t encode(const Settings& from, const Settings& to, bool all, uint8_t* out, uint32_t& fields);
+
+  Settings committed_ {};
+  bool haveCommitted_ = false;
+  uint32_t sector_ = 0;
+  uint32_t sequence_ = 0;
+  uint32_t writePos_ = 0;
+  Stats stats_ {};
+};
@@ -1,13 +1,31 @@
 #include <cpp/Button.hpp>
 #include <cpp/Color.hpp>
 #include <cpp/DiscreteOut.hpp>
-#include <cpp/FlashStorage.hpp>
-#include <cpp/WiFi.hpp>
 
 #include "Animation.hpp"
+#include "CheckpointStore.hpp"
+#include "Command.hpp"
+#include "FlashScheduler.hpp"
+#include "Frame.hpp"
+#include "Log.hpp"
+#include "NtpClient.hpp"
+#include "PhaseProfile.hpp"
+#include "PumpActuator.hpp"
+#include "RtcBootTimeSync.hpp"
+#include "Schedule.hpp"
+#include "Scheduler.hpp"
+#include "SerialRx.hpp"
+#include "Trace.hpp"
 #include "Settings.hpp"
+#include "SettingsFields.hpp"
+#include "SettingsStore.hpp"
+#include "WiFiLink.hpp"
 
+#include <hardware/flash.h>
+#include <hardware/gpio.h>
+#include <hardware/irq.h>
 #include <hardware/rtc.h>
+#include <hardware/sync.h>
 #include <hardware/watchdog.h>
 #include <pico/stdlib.h>
 #include <pico/stdio.h>
@@ -15,29 +33,71 @@
 #include <pico/bootrom.h>
 #include <pico/multicore.h>
 #include <pico/unique_id.h>
-#include <pico/cyw43_arch.h>
-#include <pico/multicore.h>
-
-#include <lwip/dns.h>
-#include <lwip/pbuf.h>
-#include <lwip/udp.h>
 
+#include <algorithm>
 #include <iostream>
-#include <istream>
 #include <cmath>
 #include <memory>
-#include <sstream>
 #include <cstring>
-#include <string>
+#include <string_view>
 #include <time.h>
 
-#define NTP_MSG_LEN 48
-#define NTP_PORT 123
-#define NTP_DELTA 2208988800 // seconds between 1 Jan 1900 and 1 Jan 1970
+constexpr uint WaterButtonPin = 0;
+constexpr uint LightButtonPin = 1;
+
+// How often the main loop polls while a watering cycle runs or a button is in use
+constexpr uint32_t PollPeriodMs = 50;
+constexpr uint32_t ButtonSettleMs = 200;
+
+// How often to resync the clock with NTP to keep it from drifting, and how
+// soon to try again when that fails
+constexpr uint32_t TimeSyncPeriodMs = 6 * 60 * 60 * 1000;
+constexpr uint32_t TimeSyncRetryMs = 15 * 60 * 1000;
 
-Animator animator(6, 8);
-GPIOButton waterButton(0);
-GPIOButton lightButton(1, true);
+// How often to save the time to flash, so a reboot can start from it
+constexpr uint32_t ClockSaveMs = 10 * 60 * 1000;
+
+// How soon to carry on writing the log when the USB host falls behind
+constexpr uint32_t LogRetryMs = 20;
+
+// How soon to look for the next chance to write to flash while writes wait
+constexpr uint32_t FlashRetryMs = 10;
+
+// All the animations, placed statically. The names are only for the anim command.
+enum class Anim
+{
+  Idle,
+  ErrorIdle,
+  Blank,
+  WiFi,
+  Alert,
+  Ok,
+  WaterProgress,
+  Count
+};
+SolidAnimation idleAnim(HSVColor{147.0f, 0.8f, 0.15f}.toRGB());
+PulseAnimation errorIdleAnim(HSVColor{0.0f, 0.8f, 1.0f}.toRGB());
+BlankAnimation blankAnim;
+WiFiConnectAnimation wifiAnim;
+FlashAnimation alertAnim(RGBColor{128, 0, 0});
+FlashAnimation okAnim(HSVColor{200.0f, 0.7f, 0.5f}.toRGB());
+ProgressAnimation waterProgressAnim(RGBColor{0, 0, 255});
+Animator<Anim> animator(6, 8,
+{{
+  {"idle", &idleAnim},
+  {"errorIdle", &errorIdleAnim},
+  {"blank", &blankAnim},
+  {"wifi", &wifiAnim},
+  {"alert", &alertAnim},
+  {"ok", &okAnim},
+  {"water-progress", &waterProgressAnim},
+}});
+
+// Animator layers above the base, bottom to top
+constexpr int ProgressLayer = 1;
+constexpr int StatusLayer = 2;
+GPIOButton waterButton(WaterButtonPin);
+GPIOButton lightButton(LightButtonPin, true);
 
 DiscreteOut pump1(2);
 DiscreteOut pump2(3);
@@ -45,577 +105,1163 @@ DiscreteOut pump3(4);
 DiscreteOut pump4(5);
 std::vector<DiscreteOut*> pumps {&pump1, &pump2, &pump3, &pump4};
 
+PumpActuator pumpActuator1(pump1, 0);
+PumpActuator pumpActuator2(pump2, 1);
+PumpActuator pumpActuator3(pump3, 2);
+PumpActuator pumpActuator4(pump4, 3);
+std::vector<PumpActuator*> pumpActuators {&pumpActuator1, &pumpActuator2, &pumpActuator3, &pumpActuator4};
+
 DiscreteOut light1(7, false, true, true);
 DiscreteOut light2(8, false, true, true);
 std::vector<DiscreteOut*> lights {&light1, &light2};
 
-struct RtcBootTimeSync
+// Switch a light, tracing it if that changes anything
+void setLight(int i, bool on)
 {
-  static const uint64_t usPerDay = (24ull*60ull*60ull*1000ull*1000ull);
-  uint64_t firstMidnightUs;
-  
-  RtcBootTimeSync()
+  if (lights[i]->get() != on)
   {
-    datetime_t syncTimeRtc;
-    rtc_get_datetime(&syncTimeRtc);
-    firstMidnightUs = to_us_since_boot(get_absolute_time());
-
-    uint64_t offsetUs = (((uint64_t)syncTimeRtc.hour * 60ull + (uint64_t)syncTimeRtc.min) * 60ull + (uint64_t)syncTimeRtc.sec) * 1000ull * 1000ull;
-    
-    while (offsetUs > firstMidnightUs)
-    {
-      firstMidnightUs += usPerDay;
-    }
-    firstMidnightUs -= offsetUs;
+    Trace::record(on ? TraceEvent::LightOn : TraceEvent::LightOff, i);
   }
+  lights[i]->set(on);
+}
 
-  absolute_time_t absoluteTimeFromSecondsSinceMidnight(int32_t secondsSinceMidnight, absolute_time_t referenceTime = get_absolute_time())
-  {
-    uint64_t nowUs = to_us_since_boot(referenceTime);
-    if (nowUs < firstMidnightUs)
-    {
-      int64_t startOfDayUs = (int64_t)firstMidnightUs - (int64_t)usPerDay;
-      int64_t usSinceBoot = startOfDayUs + (int64_t)secondsSinceMidnight * 1000000ll;
-      if (usSinceBoot < 0)
-      {
-        usSinceBoot = 0;
-      }
-      return from_us_since_boot(usSinceBoot);
-    }
-    else
-    {
-      uint64_t days = (nowUs - firstMidnightUs) / usPerDay;
-      uint64_t startOfDayUs = firstMidnightUs + days * usPerDay;
-      uint64_t usSinceBoot = startOfDayUs + (uint64_t)secondsSinceMidnight * 1000000ull;
-      return from_us_since_boot(usSinceBoot);
-    }
-  }
+Scheduler scheduler;
+Schedule schedule;
+
+// Set from interrupts to get the main loop out of its sleep early
+volatile bool wakeRequested = false;
+volatile bool buttonEdge = false;
+uint32_t loopWakeups = 0;
+
+// What the main loop spends an iteration on, from waking up to sleeping
+enum class LoopPhase
+{
+  Events,
+  Checkpoint,
+  Watering,
+  Network,
+  Input,
+  Buttons,
+  Planning,
+  Log,
+  Flash,
+  Count
 };
+const char* const loopPhaseNames[] = {"events", "checkpoint", "watering", "network", "input", "buttons", "planning", "log", "flash"};
+PhaseProfile<LoopPhase> loopProfile(loopPhaseNames);
+
+// Serial input waits here for the main loop, and binary frames are put
+// together from it
+SerialRx serialRx;
+FrameReceiver frameReceiver;
+FrameWriter frameWriter;
+
+// The WiFi link stays up for anything that needs the network
+WiFiLink wifi;
+
+// Background time syncs, and the clock they discipline. Until the first
+// sync since boot the clock is only an estimate from flash, if that.
+NtpClient ntp(wifi);
+RtcBootTimeSync timeSync;
+CheckpointStore checkpoints;
+bool clockFromNtp = false;
+uint32_t timeSyncFailures = 0;
+absolute_time_t nextTimeSync = nil_time;
+absolute_time_t nextClockSave = at_the_end_of_time;
+uint64_t bootToScheduleUs = 0;
+
+std::ostream& operator<<( std::ostream& os, const datetime_t& t )
+{
+  os << (int)t.year << "/" << (int)t.month << "/" << (int)t.day << " " << (int)t.hour << ":" << (int)t.min << ":" << (int)t.sec;
+  return os;
+}
+
+LogLine& operator<<(LogLine& line, const datetime_t& t)
+{
+  return line << (int)t.year << "/" << (int)t.month << "/" << (int)t.day << " " << (int)t.hour << ":" << (int)t.min << ":" << (int)t.sec;
+}
 
-struct NtpRequest
+int64_t utcOffsetUs(const Settings& settings)
 {
-  std::string url;
-  bool dnsOk = false;
-  bool reqOk = false;
-  bool respOk = false;
-  bool error = false;
-  ip_addr_t address;
-  udp_pcb* ntp_pcb;
-  time_t time;
+  // The offset is a float, so round it to whole seconds on its own, a
+  // float can't hold today's epoch to the second
+  return (int64_t)std::lround(settings.offsetFromUtc * 60.0f * 60.0f) * 1000000ll;
+}
+
+void setRtc(uint64_t localUs)
+{
+  // Convert to an RTC datetime struct
+  time_t secondsSinceEpoch = (time_t)(localUs / 1000000ull);
+  tm* local = gmtime(&secondsSinceEpoch);
+  datetime_t dt
+  {
+    (int16_t) (local->tm_year + 1900), // int16_t year;    ///< 0..4095
+    (int8_t) (local->tm_mon + 1),      // int8_t month;    ///< 1..12, 1 is January
+    (int8_t) (local->tm_mday),         // int8_t day;      ///< 1..28,29,30,31 depending on month
+    (int8_t) (local->tm_wday),         // int8_t dotw;     ///< 0..6, 0 is Sunday
+    (int8_t) (local->tm_hour),         // int8_t hour;     ///< 0..23
+    (int8_t) (local->tm_min),          // int8_t min;      ///< 0..59
+    (int8_t) (local->tm_sec),          // int8_t sec;      ///< 0..59
+  };
+
+  LOG_INFO << "Setting RTC to " << dt;
+
+  // Finally push the struct into the RTC hardware
+  rtc_set_datetime(&dt);
+}
 
-  NtpRequest(const std::string& url) :
-    url(url)
+// UTC seconds since 1970 by our clock, 0 if it isn't set
+uint32_t utcSecs(const Settings& settings)
+{
+  if (!timeSync.synced())
   {
-    ntp_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
-    error = !ntp_pcb;
+    return 0;
   }
+  return (uint32_t)((timeSync.wallUsAt(get_absolute_time()) - utcOffsetUs(settings)) / 1000000ull);
+}
 
-  ~NtpRequest()
+// Checkpoint the clock and the WiFi cache to flash
+void saveCheckpoint(const Settings& settings)
+{
+  absolute_time_t now = get_absolute_time();
+  CheckpointStore::Record record {};
+  if (timeSync.synced())
   {
-    if (ntp_pcb)
-    {
-      udp_remove(ntp_pcb);
-      ntp_pcb = nullptr;
-    }
+    record.utcUs = timeSync.wallUsAt(now) - utcOffsetUs(settings);
+    record.driftPpb = timeSync.driftPpb();
+    nextClockSave = delayed_by_ms(now, ClockSaveMs);
   }
-};
+  record.ntpAddress = ntp.address();
+  record.wifi = wifi.cache();
+  checkpoints.save(record);
+}
 
-bool getSecondsSinceEpochNpt(time_t& epoch, uint32_t timeoutMs)
+// Start fetching the time in the background, the main loop finishes it off
+// with stepTimeSync(). False if a sync is already running.
+bool startTimeSync(const Settings& settings)
 {
-  bool success = false;
-  absolute_time_t timeout_time = make_timeout_time_ms(timeoutMs);
-  NtpRequest ntp("pool.ntp.org");
+  // Until we've heard from NTP once, keep trying harder
+  uint32_t timeoutMs = timeSyncFailures < 5 ? 10000 : (timeSyncFailures < 15 ? 15000 : 30000);
+  if (!ntp.start(timeoutMs))
+  {
+    return false;
+  }
+  animator.playAnimation(StatusLayer, Anim::WiFi, -1);
+  return true;
+}
 
-  // First, setup the UDP recieve callback. Might as well!
-  udp_recv(ntp.ntp_pcb, [](void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+// Advance a running time sync by one step and set the clocks once it's
+// done. Returns the sync's state.
+NtpClient::State stepTimeSync(const Settings& settings)
+{
+  if (!ntp.busy())
   {
-    // Parse time out of response
-    NtpRequest* ntp = (NtpRequest*)arg;
-    uint8_t mode = pbuf_get_at(p, 0) & 0x7;
-    uint8_t stratum = pbuf_get_at(p, 1);
+    return ntp.state();
+  }
 
-    // Check the result
-    if (ip_addr_cmp(addr, &ntp->address) && port == NTP_PORT && p->tot_len == NTP_MSG_LEN && mode == 0x4 && stratum != 0) 
-    {
-      uint8_t seconds_buf[4] = {0};
-      pbuf_copy_partial(p, seconds_buf, sizeof(seconds_buf), 40);
-      uint32_t seconds_since_1900 = seconds_buf[0] << 24 | seconds_buf[1] << 16 | seconds_buf[2] << 8 | seconds_buf[3];
-      uint32_t seconds_since_1970 = seconds_since_1900 - NTP_DELTA;
-      ntp->time = seconds_since_1970;
-      ntp->respOk = true;
-    } 
-    else
+  NtpClient::State state = ntp.step();
+  if (state == NtpClient::State::Failed)
+  {
+    // Back off slowly while the clock is only an estimate, or missing
+    uint32_t retryMs = TimeSyncRetryMs;
+    if (!clockFromNtp)
     {
-      std::cout << "Invalid NTP response" << std::endl << std::flush;
-      ntp->error = true;
+      retryMs = timeSyncFailures < 5 ? 5000 : (timeSyncFailures < 15 ? 15000 : 60000);
     }
-    pbuf_free(p);
-  }, &ntp);
-
-  // Next, resolve the NTP server with DNS and chain the request on to that
-  int dnsResult = dns_gethostbyname(ntp.url.c_str(), &ntp.address, [](const char* hostname, const ip_addr_t* ipaddr, void* arg)
+    timeSyncFailures++;
+    nextTimeSync = make_timeout_time_ms(retryMs);
+    LOG_WARN << "Error fetching time with NTP: " << ntp.error();
+    animator.playAnimation(StatusLayer, Anim::Alert, 3);
+    animator.changeBaseAnimation(Anim::ErrorIdle);
+  }
+  else if (state == NtpClient::State::Done)
   {
-    NtpRequest* ntp = (NtpRequest*)arg;
-    ntp->address = *ipaddr;
-    ntp->dnsOk = true;
-    std::cout << "DNS resolved!" << std::endl << std::flush;
-  }, &ntp);
+    nextTimeSync = make_timeout_time_ms(TimeSyncPeriodMs);
+    timeSyncFailures = 0;
+    clockFromNtp = true;
+
+    // Steer the schedule's clock and move what's planned along with it
+    uint64_t localUs = ntp.utcUs() + utcOffsetUs(settings);
+    RtcBootTimeSync before = timeSync;
+    auto sample = timeSync.discipline(localUs, ntp.sampleTime());
+    scheduler.retime(before);
+    LOG_INFO << "Clock " << (sample.stepped ? "set" : "slewing") << ", offset " << sample.offsetUs
+             << " us, drift " << sample.driftPpb / 1000.0f << " ppm";
+
+    setRtc(localUs);
+    saveCheckpoint(settings);
+
+    // Tell the user sync was successful
+    animator.playAnimation(StatusLayer, Anim::Ok, 3);
+    animator.changeBaseAnimation(Anim::Idle);
+  }
+  return state;
+}
+
+void rebootIntoProgMode()
+{
+  animator.changeBaseAnimation(Anim::Blank);
+  animator.playAnimation(StatusLayer, Anim::Alert, 3);
+  animator.waitForAnimationComplete(StatusLayer, 1200);
+  multicore_reset_core1();
+  reset_usb_boot(0,0);
+}
+
+// Command arguments are parsed straight from the input line, and any of
+// them that's wrong prints one of these errors
 
-  if (dnsResult == ERR_OK)
+template <typename T>
+bool setValFromArgs(T& val, T min, T max, Tokens& args)
+{
+  T input;
+  if (!parseNumber(args.next(), input))
+  {
+    std::cout << "parse error" << std::endl << std::flush;
+    return false;
+  }
+  if (input < min || input > max)
   {
-    std::cout << "DNS resolution skipped, value cached" << std::endl << std::flush;
-    ntp.dnsOk = true;
+    std::cout << "value out of range error" << std::endl << std::flush;
+    return false;
   }
-  else if (dnsResult == ERR_INPROGRESS)
+  val = input;
+  return true;
+}
+
+bool setValFromArgs(bool& val, Tokens& args)
+{
+  int input;
+  if (!setValFromArgs(input, 0, 1, args))
   {
-    std::cout << "DNS resolution in progress..." << std::endl << std::flush;
+    return false;
   }
-  else // dnsResult == ERR_ARG
+  val = (input == 1);
+  return true;
+}
+
+// An argument that can be left off, val keeps its default then
+template <typename T>
+bool optionalValFromArgs(T& val, Tokens& args)
+{
+  std::string_view token = args.next();
+  if (!token.empty() && !parseNumber(token, val))
   {
-    std::cout << "DNS resolution failed!" << std::endl << std::flush;
-    ntp.error = true;
+    std::cout << "parse error" << std::endl << std::flush;
+    return false;
   }
-  
-  bool timedOut = true;
-  while(absolute_time_diff_us(get_absolute_time(), timeout_time) > 0)
+  return true;
+}
+
+// Every command and subcommand handler gets the rest of its line, and
+// returns true if it went well and "ok" should be printed
+using CommandFn = bool (*)(Tokens& args, SettingsStore& settingsMgr);
+using SubcommandFn = bool (*)(Tokens& args);
+
+// Let everything that depends on a setting know it changed
+void settingChanged(const SettingField& field)
+{
+  switch (field.group)
   {
-    cyw43_arch_poll();
-    if (ntp.respOk || ntp.error)
-    {
-      // If the response is ok or an error was encountered at any point,
-      // then bail out of the work loop, we're done
-      timedOut = false;
-      break;
-    } 
-    else if (ntp.dnsOk && !ntp.reqOk)
+  case FieldGroup::General:
+    if (field.id == SettingFields::WifiSsidId || field.id == SettingFields::WifiPasswordId)
     {
-      std::cout << "Sending NTP request..." << std::endl << std::flush;
-      // Send the time request
-      pbuf* p = pbuf_alloc(PBUF_TRANSPORT, NTP_MSG_LEN, PBUF_RAM);
-      uint8_t* req = (uint8_t*) p->payload;
-      memset(req, 0, NTP_MSG_LEN);
-      req[0] = 0x1b;
-      udp_sendto(ntp.ntp_pcb, p, &ntp.address, NTP_PORT);
-      pbuf_free(p);
-      ntp.reqOk = true;
+      wifi.reconnect();
     }
-    cyw43_arch_wait_for_work_until(timeout_time);
+    break;
+  case FieldGroup::Pump:
+    scheduler.pumpChanged(field.channel);
+    break;
+  case FieldGroup::Light:
+    scheduler.lightChanged(field.channel);
+    break;
   }
+}
 
-  if (ntp.respOk)
+// Set the setting called name from the rest of the line
+bool setSettingFromArgs(FieldGroup group, uint8_t channel, std::string_view name, Tokens& args, Settings& settings)
+{
+  const SettingField* field = SettingFields::find(group, channel, name);
+  if (!field)
   {
-    epoch = ntp.time;
-    return true;
+    std::cout << "unknown property error" << std::endl << std::flush;
+    return false;
   }
-  else if (timedOut)
+  switch (SettingFields::parse(settings, *field, args))
   {
-    std::cout << "Timed out!" << std::endl << std::flush;
+  case FieldResult::Ok:
+    settingChanged(*field);
+    return true;
+  case FieldResult::OutOfRange:
+    std::cout << "value out of range error" << std::endl << std::flush;
+    return false;
+  case FieldResult::TooLong:
+    std::cout << "string param too long" << std::endl << std::flush;
+    return false;
+  default:
+    std::cout << "parse error" << std::endl << std::flush;
     return false;
   }
-  
-  return false;
 }
 
-std::ostream& operator<<( std::ostream& os, const datetime_t& t )
+bool forceOutput(Tokens& args, const std::vector<DiscreteOut*>& outputs)
 {
-  std::cout << (int)t.year << "/" << (int)t.month << "/" << (int)t.day << " " << (int)t.hour << ":" << (int)t.min << ":" << (int)t.sec;
-  return os;
+  int id;
+  if (!setValFromArgs(id, 1, (int)outputs.size(), args)) return false;
+  bool val;
+  if (!setValFromArgs(val, args)) return false;
+  // Force relevant I/O value
+  outputs[id-1]->set(val);
+  return true;
 }
 
-bool syncRtcWithNtp(Settings& settings, uint32_t timeoutMs = 10000)
+constexpr auto forceTargets = makeCommandTable<SubcommandFn>({
+  {"pump", [](Tokens& args) { return forceOutput(args, pumps); }},
+  {"light", [](Tokens& args) { return forceOutput(args, lights); }},
+});
+
+bool animPlay(Tokens& args)
 {
-  animator.playAnimation("wifi", -1);
-  auto start = get_absolute_time();
-  auto wifi = WiFiClient::Init(settings.wifiSsid, settings.wifiPassword, timeoutMs);
-  
-  if (!wifi.connected())
+  std::string_view name = args.next();
+  int loops = 1;
+  int layer = StatusLayer;
+  if (!optionalValFromArgs(loops, args) || !optionalValFromArgs(layer, args)) return false;
+  Anim id;
+  if (animator.find(name.empty() ? "idle" : name, id) && layer > 0 && layer < animator.LayerCount)
   {
-    animator.playAnimation("alert", 3);
-    animator.changeBaseAnimation("errorIdle");
-    return false;
+    animator.playAnimation(layer, id, loops);
   }
+  return true;
+}
 
-  // Get the time
-  time_t secondsSinceEpoch;
-  if (!getSecondsSinceEpochNpt(secondsSinceEpoch, timeoutMs))
+bool animBase(Tokens& args)
+{
+  std::string_view name = args.next();
+  Anim id;
+  if (animator.find(name.empty() ? "idle" : name, id))
   {
-    animator.playAnimation("alert", 3);
-    animator.changeBaseAnimation("errorIdle");
-    return false;
+    animator.changeBaseAnimation(id);
   }
+  return true;
+}
 
-  // Adjust to the local time
-  secondsSinceEpoch += (settings.offsetFromUtc * 60 * 60);
-  
-  // Convert to an RTC datetime struct
-  tm* local = gmtime(&secondsSinceEpoch);
-  datetime_t dt
+bool animStop(Tokens& args)
+{
+  int layer = StatusLayer;
+  if (!optionalValFromArgs(layer, args)) return false;
+  if (layer > 0 && layer < animator.LayerCount)
   {
-    (int16_t) (local->tm_year + 1900), // int16_t year;    ///< 0..4095
-    (int8_t) (local->tm_mon + 1),      // int8_t month;    ///< 1..12, 1 is January
-    (int8_t) (local->tm_mday),         // int8_t day;      ///< 1..28,29,30,31 depending on month
-    (int8_t) (local->tm_wday),         // int8_t dotw;     ///< 0..6, 0 is Sunday
-    (int8_t) (local->tm_hour),         // int8_t hour;     ///< 0..23
-    (int8_t) (local->tm_min),          // int8_t min;      ///< 0..59
-    (int8_t) (local->tm_sec),          // int8_t sec;      ///< 0..59
-  };
+    animator.stopAnimation(layer);
+  }
+  return true;
+}
+
+bool animBrightness(Tokens& args)
+{
+  int limit = 255;
+  if (!optionalValFromArgs(limit, args)) return false;
+  animator.brightness((uint8_t)std::clamp(limit, 0, 255));
+  return true;
+}
 
-  std::cout << "Setting RTC to " << dt << std::endl << std::flush;
+bool animBlend(Tokens& args)
+{
+  static const char* modes[] = {"normal", "add", "lighten", "multiply"};
+  int layer = -1;
+  if (!optionalValFromArgs(layer, args)) return false;
+  std::string_view mode = args.next();
+  int opacity = 255;
+  if (!optionalValFromArgs(opacity, args)) return false;
+  for (int i = 0; i < (int)BlendMode::Count; ++i)
+  {
+    if (mode == modes[i] && layer >= 0 && layer < animator.LayerCount)
+    {
+      animator.blend(layer, (BlendMode)i, (uint8_t)std::clamp(opacity, 0, 255));
+    }
+  }
+  return true;
+}
 
-  // Finally push the struct into the RTC hardware
-  rtc_set_datetime(&dt);
+bool animParam(Tokens& args)
+{
+  float t;
+  if (!parseNumber(args.next(), t))
+  {
+    std::cout << "parse error" << std::endl << std::flush;
+    return false;
+  }
+  animator.parameter(t);
+  return true;
+}
 
-  // Tell the user sync was successful
-  animator.playAnimation("ok", 3);
-  animator.changeBaseAnimation("idle");
-  animator.waitForAnimationComplete(1200);
+constexpr auto animSubcommands = makeCommandTable<SubcommandFn>({
+  {"play", animPlay},
+  {"base", animBase},
+  {"stop", animStop},
+  {"brightness", animBrightness},
+  {"blend", animBlend},
+  {"param", animParam},
+});
+
+// One event per line, "T <time us> <event> <arg0> <arg1>", oldest first,
+// for tools/trace2json.py
+bool traceDump(Tokens& args)
+{
+  uint32_t count = Trace::count();
+  uint32_t kept = std::min<uint32_t>(count, Trace::Size);
+  std::cout << "trace: " << kept << " events, " << count - kept << " overwritten, now " << time_us_32() << std::endl;
+  for (uint32_t i = 0; i < kept; ++i)
+  {
+    Trace::Record r = Trace::at(i);
+    std::cout << "T " << r.timeUs << " " << (int)r.event << " " << r.arg0 << " " << r.arg1 << "\n";
+  }
+  std::cout << std::flush;
+  return true;
+}
 
+bool traceClear(Tokens& args)
+{
+  Trace::clear();
   return true;
 }
 
-void rebootIntoProgMode()
+constexpr auto traceSubcommands = makeCommandTable<SubcommandFn>({
+  {"dump", traceDump},
+  {"clear", traceClear},
+});
+
+bool scheduleList(Tokens& args)
 {
-  animator.changeBaseAnimation("blank");
-  animator.playAnimation("alert", 3);
-  animator.waitForAnimationComplete(1200);
-  multicore_reset_core1();
-  reset_usb_boot(0,0);
+  schedule.print();
+  return true;
 }
 
-template <typename T>
-bool setValFromStream(T& val, T min, T max, std::istream& s)
+// The days and time every entry starts with
+bool scheduleWhen(Tokens& args, ScheduleEntry& entry)
 {
-  T input;
-  s >> input;
-  if (s.fail())
+  if (!Schedule::parseWeekdays(args.next(), entry.weekdays))
   {
     std::cout << "parse error" << std::endl << std::flush;
     return false;
   }
-  if (input < min || input > max)
+  return setValFromArgs(entry.time, 0, (int32_t)Schedule::SecondsPerDay - 1, args);
+}
+
+bool scheduleAdd(const ScheduleEntry& entry)
+{
+  if (!schedule.add(entry))
   {
-    std::cout << "value out of range error" << std::endl << std::flush;
+    std::cout << "Error: the entry is already there or the schedule is full" << std::endl << std::flush;
     return false;
   }
-  val = input;
   return true;
 }
 
-bool setValFromStream(bool& val, std::istream& s)
+bool scheduleWater(Tokens& args)
 {
-  int input;
-  s >> input;
-  if (s.fail())
+  int id;
+  ScheduleEntry entry {ScheduleAction::Water};
+  if (!setValFromArgs(id, 1, Settings::PumpCount, args)) return false;
+  if (!scheduleWhen(args, entry)) return false;
+  if (!setValFromArgs(entry.amount, 0.0f, 1000.0f, args)) return false;
+  entry.channel = id - 1;
+  if (!scheduleAdd(entry)) return false;
+  scheduler.pumpChanged(entry.channel);
+  return true;
+}
+
+bool scheduleLight(Tokens& args)
+{
+  int id;
+  ScheduleEntry entry {};
+  if (!setValFromArgs(id, 1, Settings::LightCount, args)) return false;
+  if (!scheduleWhen(args, entry)) return false;
+  std::string_view state = args.next();
+  if (state != "on" && state != "off")
   {
     std::cout << "parse error" << std::endl << std::flush;
     return false;
   }
-  if (input < 0 || input > 1)
+  entry.action = state == "on" ? ScheduleAction::LightOn : ScheduleAction::LightOff;
+  entry.channel = id - 1;
+  if (!scheduleAdd(entry)) return false;
+  scheduler.lightChanged(entry.channel);
+  return true;
+}
+
+bool scheduleRemove(Tokens& args)
+{
+  int index;
+  if (!setValFromArgs(index, 0, (int)schedule.size() - 1, args)) return false;
+  ScheduleEntry entry = schedule.entry(index);
+  schedule.remove(index);
+  if (entry.action == ScheduleAction::Water)
   {
-    std::cout << "value out of range error" << std::endl << std::flush;
-    return false;
+    scheduler.pumpChanged(entry.channel);
   }
-  val = (input == 1);
+  else
+  {
+    scheduler.lightChanged(entry.channel);
+  }
+  return true;
+}
+
+bool scheduleClear(Tokens& args)
+{
+  schedule.clear();
+  scheduler.allChanged();
   return true;
 }
 
-bool setValFromStream(char* val, size_t len, std::istream& ss)
+constexpr auto scheduleSubcommands = makeCommandTable<SubcommandFn>({
+  {"list", scheduleList},
+  {"water", scheduleWater},
+  {"light", scheduleLight},
+  {"remove", scheduleRemove},
+  {"clear", scheduleClear},
+});
+
+bool commandPump(Tokens& args, SettingsStore& settingsMgr)
+{
+  int id;
+  if (!setValFromArgs(id, 1, Settings::PumpCount, args)) return false;
+  return setSettingFromArgs(FieldGroup::Pump, id - 1, args.next(), args, settingsMgr.data);
+}
+
+bool commandLight(Tokens& args, SettingsStore& settingsMgr)
 {
-  // Eat any extra whitespace in the stream
-  ss >> std::ws;
-  // Get the whole rest of the line as a string
-  std::string str;
-  std::getline(ss, str);
+  int id;
+  if (!setValFromArgs(id, 1, Settings::LightCount, args)) return false;
+  return setSettingFromArgs(FieldGroup::Light, id - 1, args.next(), args, settingsMgr.data);
+}
 
-  // Check if the read was clean and if the string will fit
-  if (ss.fail())
+bool commandForce(Tokens& args, SettingsStore& settingsMgr)
+{
+  SubcommandFn target = forceTargets.find(args.next());
+  if (!target)
   {
-    std::cout << "parse error" << std::endl << std::flush;
+    std::cout << "unknown property error" << std::endl << std::flush;
     return false;
   }
-  if (str.size() >= len)
+  return target(args);
+}
+
+bool commandDefaults(Tokens& args, SettingsStore& settingsMgr)
+{
+  settingsMgr.data.setDefaults();
+  scheduler.allChanged();
+  return true;
+}
+
+bool commandFlash(Tokens& args, SettingsStore& settingsMgr)
+{
+  // Write the settings to flash
+  // The main loop writes them out when it won't be noticed
+  if (settingsMgr.writeToFlash())
+    std::cout << "Saving settings to flash!" << std::endl << std::flush;
+  else
+    std::cout << "Skipped writing to flash because contents were already correct." << std::endl << std::flush;
+  return true;
+}
+
+bool commandInfo(Tokens& args, SettingsStore& settingsMgr)
+{
+  std::cout << "silvanus-pico by Donkey Kong" << std::endl;
+  std::cout << "https://github.com/DonkeyKong/silvanus-pico" << std::endl;
+  std::cout << std::endl;
+  settingsMgr.data.print();
+  std::cout << std::endl;
+  std::cout << "-- Runtime Data --" << std::endl;
+  std::cout << "full settings size: " << sizeof(Settings) << std::endl;
+  std::cout << "main loop wakeups: " << loopWakeups << std::endl;
+  std::cout << "clock: " << (clockFromNtp ? "synced with NTP" : (timeSync.synced() ? "estimated from flash" : "not set")) << std::endl;
+  if (bootToScheduleUs)
+  {
+    std::cout << "boot to first schedule: " << bootToScheduleUs / 1000.0f << " ms" << std::endl;
+  }
+  else
   {
-    std::cout << "string param too long" << std::endl << std::flush;
-    return false;
+    std::cout << "boot to first schedule: waiting for the time" << std::endl;
   }
-  // Copy the string to the dest buffer will null terminator
-  memcpy(val, str.data(), str.size());
-  val[str.size()] = '\0';
+  std::cout << std::flush;
   return true;
 }
 
-void processCommand(std::string cmdAndArgs, FlashStorage<Settings>& settingsMgr)
+bool commandReboot(Tokens& args, SettingsStore& settingsMgr)
 {
-  Settings& settings = settingsMgr.data;
-  std::stringstream ss(cmdAndArgs);
-  std::string cmd;
-  ss >> cmd;
-  
-  if (cmd == "wifiSsid")
+  // Reboot the system immediately, with the time saved to start from
+  saveCheckpoint(settingsMgr.data);
+  FlashScheduler::flush();
+  std::cout << "ok" << std::endl << std::flush;
+  watchdog_reboot(0,0,0);
+  return false;
+}
+
+bool commandProg(Tokens& args, SettingsStore& settingsMgr)
+{
+  // Reboot into programming mode
+  saveCheckpoint(settingsMgr.data);
+  FlashScheduler::flush();
+  std::cout << "ok" << std::endl << std::flush;
+  rebootIntoProgMode();
+  return false;
+}
+
+bool commandAnim(Tokens& args, SettingsStore& settingsMgr)
+{
+  SubcommandFn subcommand = animSubcommands.find(args.next());
+  if (!subcommand)
   {
-    setValFromStream(settings.wifiSsid, 256ul, ss);
+    std::cout << "unknown command error" << std::endl << std::flush;
+    return false;
   }
-  else if (cmd == "wifiPassword")
+  return subcommand(args);
+}
+
+bool commandSchedule(Tokens& args, SettingsStore& settingsMgr)
+{
+  std::string_view name = args.next();
+  if (name.empty())
   {
-    setValFromStream(settings.wifiPassword, 256ul, ss);
+    return scheduleList(args);
   }
-  else if (cmd == "offsetFromUtc")
+  SubcommandFn subcommand = scheduleSubcommands.find(name);
+  if (!subcommand)
   {
-    setValFromStream(settings.offsetFromUtc, -24.0f, 24.0f , ss);
+    std::cout << "unknown command error" << std::endl << std::flush;
+    return false;
   }
-  else if (cmd == "pump")
+  return subcommand(args);
+}
+
+bool commandTrace(Tokens& args, SettingsStore& settingsMgr)
+{
+  SubcommandFn subcommand = traceSubcommands.find(args.next());
+  if (!subcommand)
   {
-    int id;
-    if (!setValFromStream(id, 1, 4, ss)) return;
-    std::string prop;
-    ss >> prop;
+    std::cout << "unknown command error" << std::endl << std::flush;
+    return false;
+  }
+  return subcommand(args);
+}
 
-    if (prop == "enable")
-    {
-      setValFromStream(settings.pump(id-1).enable, ss);
-    }
-    else if (prop == "rate")
-    {
-      setValFromStream(settings.pump(id-1).rate, 0.0f, 1000.0f, ss);
-    }
-    else if (prop == "amount")
-    {
-      setValFromStream(settings.pump(id-1).amount, 0.0f, 1000.0f, ss);
-    }
-    else if (prop == "activationTime")
-    {
-      setValFromStream(settings.pump(id-1).activationTime, 0l, (int32_t)24 * 60 * 60, ss);
-    }
-    else
+// A line per phase with its min, mean and max, then the histogram as k:n
+// for n runs of under 2^k cycles
+template <typename Profile>
+void printProfile(const char* what, const Profile& profile, uint32_t deadlineUs)
+{
+  auto printPhase = [&](const char* name, const typename Profile::Stats& stats)
+  {
+    std::cout << "  " << name << ": " << stats.count << " runs";
+    if (stats.count)
     {
-      std::cout << "unknown property error" << std::endl << std::flush;
+      std::cout << ", min " << stats.minCycles << ", mean " << stats.meanCycles() << ", max " << stats.maxCycles
+                << " cycles (" << stats.maxCycles / Profile::cyclesPerUs() << " us) |";
+      for (size_t k = 0; k < Profile::Buckets; ++k)
+      {
+        if (stats.histogram[k])
+        {
+          std::cout << " " << k << ":" << stats.histogram[k];
+        }
+      }
     }
+    std::cout << std::endl;
+  };
+
+  std::cout << what << ": " << profile.missed() << " of " << profile.total().count << " over "
+            << deadlineUs << " us" << std::endl;
+  for (size_t i = 0; i < Profile::PhaseCount; ++i)
+  {
+    printPhase(profile.name(i), profile.phase(i));
   }
-  else if (cmd == "light")
+  printPhase("total", profile.total());
+}
+
+bool commandStats(Tokens& args, SettingsStore& settingsMgr)
+{
+  if (args.next() == "reset")
   {
-    int id;
-    if (!setValFromStream(id, 1, 2, ss)) return;
-    std::string prop;
-    ss >> prop;
+    PumpActuator::resetStats();
+    wifi.resetStats();
+    serialRx.resetStats();
+    Log::resetStats();
+    settingsMgr.resetStats();
+    schedule.resetStats();
+    FlashScheduler::resetStats();
+    frameReceiver.resetStats();
+    animator.resetContention();
+    animator.resetFrameStats();
+    loopProfile.reset();
+    animator.profile().reset();
+    return true;
+  }
 
-    if (prop == "enable")
-    {
-      setValFromStream(settings.light(id-1).enable, ss);
-    }
-    else if (prop == "onTime")
-    {
-      setValFromStream(settings.light(id-1).onTime, 0l, (int32_t)24 * 60 * 60, ss);
-    }
-    else if (prop == "offTime")
-    {
-      setValFromStream(settings.light(id-1).offTime, 0l, (int32_t)24 * 60 * 60, ss);
-    }
-    else
-    {
-      std::cout << "unknown property error" << std::endl << std::flush;
-    }
+  auto pumpStats = PumpActuator::stats();
+  std::cout << "pump actuations: " << pumpStats.actuations << std::endl;
+  std::cout << "pump actuation error: worst " << pumpStats.worstErrorUs << " us, mean "
+            << (pumpStats.actuations ? pumpStats.totalErrorUs / pumpStats.actuations : 0) << " us" << std::endl;
+  auto frameStats = animator.frameStats();
+  std::cout << "LED frames: rendered " << frameStats.rendered << ", written " << frameStats.written << std::endl;
+  auto animStats = animator.contention();
+  std::cout << "animator commands: " << animStats.commands << ", waited for core 1 " << animStats.waits
+            << " times, worst " << animStats.worstWaitUs << " us, total " << animStats.totalWaitUs << " us" << std::endl;
+  static const char* wifiStates[] = {"off", "joining", "addressing", "up", "waiting to retry"};
+  auto wifiStats = wifi.stats();
+  std::cout << "WiFi: " << wifiStates[(int)wifi.state()] << ", connects " << wifiStats.connects << " ("
+            << wifiStats.fastConnects << " cached), failures " << wifiStats.failures << ", drops " << wifiStats.drops << std::endl;
+  if (wifiStats.connects)
+  {
+    std::cout << "WiFi connect time: last " << wifiStats.lastConnectMs << " ms, best " << wifiStats.bestConnectMs
+              << " ms, worst " << wifiStats.worstConnectMs << " ms, mean " << wifiStats.totalConnectMs / wifiStats.connects << " ms" << std::endl;
+  }
+  auto rxStats = serialRx.stats();
+  std::cout << "serial input: " << rxStats.bytes << " bytes, " << rxStats.lines << " lines, most waiting "
+            << rxStats.peakBuffered << " of " << SerialRx::BufferSize << " bytes, stalled " << rxStats.stalls << " times" << std::endl;
+  std::cout << "serial line latency: last " << rxStats.lastLatencyUs << " us, worst " << rxStats.worstLatencyUs << " us" << std::endl;
+  auto logStats = Log::stats();
+  std::cout << "log lines: " << logStats.lines << ", dropped " << logStats.dropped << ", most waiting "
+            << logStats.peak << " of " << Log::MaxLines << std::endl;
+  std::cout << "binary frames: " << frameReceiver.frames() << ", bad " << frameReceiver.errors() << std::endl;
+  auto storeStats = settingsMgr.stats();
+  std::cout << "settings commits: " << storeStats.commits << ", " << storeStats.fields << " fields, "
+            << storeStats.bytesWritten << " bytes written, " << storeStats.compactions << " compactions, "
+            << settingsMgr.used() << " of " << FLASH_SECTOR_SIZE << " bytes in use" << std::endl;
+  auto scheduleStats = schedule.stats();
+  std::cout << "schedule: " << schedule.size() << " entries, " << scheduleStats.edits << " edits, "
+            << scheduleStats.bytesWritten << " bytes written, " << scheduleStats.compactions << " compactions, "
+            << schedule.used() << " of " << FLASH_SECTOR_SIZE << " bytes in use" << std::endl;
+  auto flashStats = FlashScheduler::stats();
+  std::cout << "flash windows: " << flashStats.erases << " erases, " << flashStats.programs << " programs, "
+            << (FlashScheduler::pending() ? "more waiting, " : "") << "put off " << flashStats.deferrals
+            << " times, forced " << flashStats.forced << " times" << std::endl;
+  std::cout << "flash lockout: last " << flashStats.lastLockoutUs << " us, worst erase " << flashStats.worstEraseUs
+            << " us, worst program " << flashStats.worstProgramUs << " us, total " << flashStats.totalLockoutUs << " us" << std::endl;
+  printProfile("main loop", loopProfile, PollPeriodMs * 1000);
+  printProfile("LED frames", animator.profile(), decltype(animator)::TargetFrameTimeUs);
+  std::cout << std::flush;
+  return true;
+}
+
+bool commandSyncTime(Tokens& args, SettingsStore& settingsMgr)
+{
+  // The result is printed whenever the sync finishes
+  if (!startTimeSync(settingsMgr.data))
+  {
+    std::cout << "Error: a time sync is already running" << std::endl << std::flush;
+    return false;
   }
-  else if (cmd == "force")
+  return true;
+}
+
+bool commandClock(Tokens& args, SettingsStore& settingsMgr)
+{
+  if (!timeSync.synced())
   {
-    std::string prop;
-    ss >> prop;
+    std::cout << "Error: the clock hasn't been synced yet" << std::endl << std::flush;
+    return false;
+  }
+  std::cout << "drift " << timeSync.driftPpb() / 1000.0f << " ppm, slewing "
+            << timeSync.slewRemainingUs(get_absolute_time()) << " us" << std::endl;
+  for (int i = 0; i < timeSync.historyCount(); ++i)
+  {
+    const RtcBootTimeSync::Sample& sample = timeSync.history(i);
+    std::cout << "sync at " << to_us_since_boot(sample.time) / 1000000 << " s: offset " << sample.offsetUs
+              << " us, drift " << sample.driftPpb / 1000.0f << " ppm" << (sample.stepped ? ", stepped" : "") << std::endl;
+  }
+  std::cout << std::flush;
+  return true;
+}
 
-    if (prop == "pump")
-    {
-      int id;
-      if (!setValFromStream(id, 1, 4, ss)) return;
-      bool val;
-      if (!setValFromStream(val, ss)) return;
-      // Force relevant I/O value
-      pumps[id-1]->set(val);
-    }
-    else if (prop == "light")
-    {
-      int id;
-      if (!setValFromStream(id, 1, 2, ss)) return;
-      bool val;
-      if (!setValFromStream(val, ss)) return;
-      // Force relevant I/O value
-      lights[id-1]->set(val);
-    }
-    else
+bool commandTime(Tokens& args, SettingsStore& settingsMgr)
+{
+  datetime_t time;
+  if (!rtc_get_datetime(&time))
+  {
+    std::cout << "Error: realtime clock is not running! Call synctime at least once." << std::endl << std::flush;
+    return false;
+  }
+  std::cout << time << std::endl << std::flush;
+  return true;
+}
+
+constexpr auto commands = makeCommandTable<CommandFn>({
+  {"pump", commandPump},
+  {"light", commandLight},
+  {"force", commandForce},
+  {"defaults", commandDefaults},
+  {"flash", commandFlash},
+  {"info", commandInfo},
+  {"about", commandInfo},
+  {"reboot", commandReboot},
+  {"prog", commandProg},
+  {"anim", commandAnim},
+  {"stats", commandStats},
+  {"trace", commandTrace},
+  {"schedule", commandSchedule},
+  {"synctime", commandSyncTime},
+  {"clock", commandClock},
+  {"time", commandTime},
+});
+
+// Settings of their own, like offsetFromUtc, are commands too
+constexpr bool settingsAreNotCommands()
+{
+  for (size_t i = 0; i < SettingFields::generalNames.size(); ++i)
+  {
+    if (commands.find(SettingFields::generalNames.entry(i).name))
     {
-      std::cout << "unknown property error" << std::endl << std::flush;
+      return false;
     }
   }
-  else if (cmd == "defaults")
+  return true;
+}
+
+static_assert(commands.valid() && forceTargets.valid() && animSubcommands.valid() && traceSubcommands.valid() &&
+              scheduleSubcommands.valid() && settingsAreNotCommands(), "command names must be unique");
+
+void processCommand(std::string_view line, SettingsStore& settingsMgr)
+{
+  Tokens args(line);
+  std::string_view name = args.next();
+  CommandFn command = commands.find(name);
+  bool ok;
+  if (command)
   {
-    settings.setDefaults();
+    ok = command(args, settingsMgr);
   }
-  else if (cmd == "flash")
+  else if (SettingFields::find(FieldGroup::General, 0, name))
   {
-    // Write the settings to flash
-    if (settingsMgr.writeToFlash())
-      std::cout << "Wrote settings to flash!" << std::endl << std::flush;
-    else
-      std::cout << "Skipped writing to flash because contents were already correct." << std::endl << std::flush;
+    ok = setSettingFromArgs(FieldGroup::General, 0, name, args, settingsMgr.data);
   }
-  else if (cmd == "info" || cmd == "about")
+  else
   {
-    std::cout << "silvanus-pico by Donkey Kong" << std::endl;
-    std::cout << "https://github.com/DonkeyKong/silvanus-pico" << std::endl;
-    std::cout << std::endl;
-    settings.print();
-    std::cout << std::endl;
-    std::cout << "-- Runtime Data --" << std::endl;
-    std::cout << "full settings size: " << sizeof(Settings) << std::endl;
-    std::cout << std::flush;
+    std::cout << "unknown command error" << std::endl << std::flush;
+    return;
   }
-  else if (cmd == "reboot")
+  if (ok)
   {
-    // Reboot the system immediately
     std::cout << "ok" << std::endl << std::flush;
-    watchdog_reboot(0,0,0);
   }
-  else if (cmd == "prog")
+}
+
+// -- Binary protocol --
+//
+// A frame (see Frame.hpp) holds a batch of operations, each an op byte and
+// its arguments, run in order. The reply is one frame with the request's
+// sequence number and, for every operation, the op byte, a Status and
+// whatever it returns. Processing stops at the first operation that can't
+// be parsed. Multi-byte values are little endian, like the RP2040.
+
+enum class BinaryOp : uint8_t
+{
+  Get = 1,      // field id -> field id, length, value
+  Set = 2,      // field id, length, value -> field id
+  Status = 3,   // -> length, status block
+  Flash = 4,    // write the settings to flash
+  Defaults = 5, // reset the settings to their defaults
+};
+
+enum class BinaryStatus : uint8_t
+{
+  Ok = 0,
+  Unchanged = 1,    // flash was already up to date
+  UnknownOp = 2,
+  UnknownField = 3,
+  BadLength = 4,    // a value of the wrong size, or the request ran short
+  OutOfRange = 5,
+};
+
+// Setting results as binary statuses
+BinaryStatus binaryStatus(FieldResult result)
+{
+  switch (result)
   {
-    // Reboot into programming mode
-    std::cout << "ok" << std::endl << std::flush;
-    rebootIntoProgMode();
+  case FieldResult::Ok: return BinaryStatus::Ok;
+  case FieldResult::OutOfRange: return BinaryStatus::OutOfRange;
+  default: return BinaryStatus::BadLength;
   }
-  else if (cmd == "anim")
+}
+
+// What the Status op returns
+struct BinaryStatusBlock
+{
+  uint32_t uptimeMs;
+  uint32_t utcSecs;     // 0 if the clock isn't set
+  uint8_t clock;        // 0 not set, 1 estimated from flash, 2 synced with NTP
+  uint8_t wifi;         // WiFiLink::State
+  uint8_t pumpsOn;      // bit per pump
+  uint8_t lightsOn;     // bit per light
+  uint32_t loopWakeups;
+  uint32_t frames;      // good binary frames received
+  uint32_t frameErrors; // and bad ones thrown away
+};
+
+void processFrame(const uint8_t* frame, size_t len, SettingsStore& settingsMgr)
+{
+  FrameWriter& reply = frameWriter;
+  reply.begin(frame[2]);
+
+  // Ops that don't fit in the reply are left undone, the client sees them
+  // missing and sends them again
+  size_t i = FrameReceiver::HeaderSize;
+  while (i < len && reply.fits(3))
   {
-    std::string subcmd;
-    ss >> subcmd;
+    uint8_t op = frame[i++];
+    reply.put8(op);
 
-    if (subcmd == "play")
-    {
-      std::string name = "idle";
-      int loops = 1;
-      ss >> name >> loops;
-      animator.playAnimation(name, loops);
-    }
-    else if (subcmd == "base")
+    if (op == (uint8_t)BinaryOp::Get)
     {
-      std::string name = "idle";
-      ss >> name;
-      animator.changeBaseAnimation(name);
+      if (i + 1 > len)
+      {
+        reply.put8((uint8_t)BinaryStatus::BadLength);
+        break;
+      }
+      uint8_t id = frame[i++];
+      const SettingField* field = SettingFields::find(id);
+      if (!field)
+      {
+        reply.put8((uint8_t)BinaryStatus::UnknownField);
+        reply.put8(id);
+        continue;
+      }
+      size_t size;
+      const uint8_t* value = SettingFields::get(settingsMgr.data, *field, size);
+      if (!reply.fits(3 + size))
+      {
+        // Take the op back off, it'll be in the client's next batch
+        reply.unput(1);
+        break;
+      }
+      reply.put8((uint8_t)BinaryStatus::Ok);
+      reply.put8(id);
+      reply.put8((uint8_t)size);
+      reply.put(value, size);
     }
-    else if (subcmd == "stop")
+    else if (op == (uint8_t)BinaryOp::Set)
     {
-      animator.stopAnimation();
+      if (i + 2 > len || i + 2 + frame[i + 1] > len)
+      {
+        reply.put8((uint8_t)BinaryStatus::BadLength);
+        break;
+      }
+      uint8_t id = frame[i];
+      size_t size = frame[i + 1];
+      const uint8_t* value = frame + i + 2;
+      i += 2 + size;
+      const SettingField* field = SettingFields::find(id);
+      BinaryStatus status = BinaryStatus::UnknownField;
+      if (field)
+      {
+        status = binaryStatus(SettingFields::set(settingsMgr.data, *field, value, size));
+      }
+      if (status == BinaryStatus::Ok)
+      {
+        settingChanged(*field);
+      }
+      reply.put8((uint8_t)status);
+      reply.put8(id);
     }
-    else if (subcmd == "param")
+    else if (op == (uint8_t)BinaryOp::Status)
     {
-      float t;
-      ss >> t;
-      animator.parameter(t);
+      if (!reply.fits(2 + sizeof(BinaryStatusBlock)))
+      {
+        reply.unput(1);
+        break;
+      }
+      BinaryStatusBlock block {};
+      block.uptimeMs = to_ms_since_boot(get_absolute_time());
+      block.utcSecs = utcSecs(settingsMgr.data);
+      block.clock = clockFromNtp ? 2 : timeSync.synced() ? 1 : 0;
+      block.wifi = (uint8_t)wifi.state();
+      for (size_t p = 0; p < pumps.size(); ++p)
+      {
+        block.pumpsOn |= pumps[p]->get() << p;
+      }
+      for (size_t l = 0; l < lights.size(); ++l)
+      {
+        block.lightsOn |= lights[l]->get() << l;
+      }
+      block.loopWakeups = loopWakeups;
+      block.frames = frameReceiver.frames();
+      block.frameErrors = frameReceiver.errors();
+      reply.put8((uint8_t)BinaryStatus::Ok);
+      reply.put8((uint8_t)sizeof(block));
+      reply.put(&block, sizeof(block));
     }
-  }
-  else if (cmd == "synctime")
-  {
-    if (!syncRtcWithNtp(settings))
+    else if (op == (uint8_t)BinaryOp::Flash)
     {
-      std::cout << "Error fetching time with NTP!" << std::endl << std::flush;
-      return;
+      reply.put8((uint8_t)(settingsMgr.writeToFlash() ? BinaryStatus::Ok : BinaryStatus::Unchanged));
     }
-  }
-  else if (cmd == "time")
-  {
-    datetime_t time;
-    if (rtc_get_datetime(&time))
+    else if (op == (uint8_t)BinaryOp::Defaults)
     {
-      std::cout << time << std::endl << std::flush;
+      settingsMgr.data.setDefaults();
+      scheduler.allChanged();
+      reply.put8((uint8_t)BinaryStatus::Ok);
     }
     else
     {
-      std::cout << "Error: realtime clock is not running! Call synctime at least once." << std::endl << std::flush;
-      return;
+      reply.put8((uint8_t)BinaryStatus::UnknownOp);
+      break;
     }
   }
-  else
-  {
-    std::cout << "unknown command error" << std::endl << std::flush;
-    return;
-  }
 
-  if (!ss.fail())
-  {
-    std::cout << "ok" << std::endl << std::flush;
-  }
+  // Anything printed so far goes out first, so no text lands in the frame
+  std::cout << std::flush;
+  reply.send([](uint8_t c) { putchar_raw(c); });
+  stdio_flush();
 }
 
-void processStdIo(FlashStorage<Settings>& settingsMgr)
+void processStdIo(SettingsStore& settingsMgr)
 {
   static char inBuf[1024];
   static int pos = 0;
+  static bool tooLong = false;
 
-  while (true)
+  // Everything that came in since last time, however many lines that is
+  int inchar;
+  while ((inchar = serialRx.read()) >= 0)
   {
-    int inchar = getchar_timeout_us(0);
-    if (inchar > 31 && inchar < 127 && pos < 1023)
+    if (inchar == 0 || frameReceiver.receiving())
+    {
+      // Binary frames start with a 0, which text never has. They aren't
+      // echoed, and leave any half typed line alone.
+      if (frameReceiver.push((uint8_t)inchar))
+      {
+        processFrame(frameReceiver.payload(), frameReceiver.size(), settingsMgr);
+      }
+    }
+    else if (inchar > 31 && inchar < 127)
     {
-      inBuf[pos++] = (char)inchar;
+      if (pos < (int)sizeof(inBuf) - 1)
+      {
+        inBuf[pos++] = (char)inchar;
+      }
+      else
+      {
+        tooLong = true;
+      }
       std::cout << (char)inchar << std::flush; // echo to client
     }
     else if (inchar == '\n')
     {
       inBuf[pos] = '\0';
       std::cout << std::endl << std::flush; // echo to client
-      processCommand(inBuf, settingsMgr);
+      if (tooLong)
+      {
+        // Better than running whatever was cut off
+        std::cout << "line too long error" << std::endl << std::flush;
+      }
+      else
+      {
+        processCommand(std::string_view(inBuf, pos), settingsMgr);
+      }
       pos = 0;
-    }
-    else
-    {
-      return;
+      tooLong = false;
     }
   }
 }
 
-void processStdIoFor(FlashStorage<Settings>& settingsMgr, uint32_t milliseconds)
+uint64_t pumpOnTimeUs(const PumpConfig& pump, float amount)
 {
-  absolute_time_t exitTime = make_timeout_time_ms(milliseconds);
-  while (to_ms_since_boot(exitTime) > to_ms_since_boot(get_absolute_time()))
-  {
-    processStdIo(settingsMgr);
-    sleep_ms(50);
-  }
+  return (uint64_t)(amount / pump.rate * 1000000.0f);
 }
 
-bool withinRange(absolute_time_t val, absolute_time_t minEx, absolute_time_t maxInc)
+int32_t getRtcSecondsSinceMidnight()
 {
-  return to_us_since_boot(val) > to_us_since_boot(minEx) && to_us_since_boot(val) <= to_us_since_boot(maxInc);
+  datetime_t t;
+  if (rtc_get_datetime(&t))
+  {
+    return (uint32_t)t.hour * 60ul * 60ul + (uint32_t)t.min * 60ul + (uint32_t)t.sec;
+  }
+  return -1;
 }
 
-int32_t getRtcSecondsSinceMidnight()
+// Seconds since midnight on Sunday
+int32_t getRtcSecondsSinceSunday()
 {
   datetime_t t;
   if (rtc_get_datetime(&t))
   {
-    return (uint32_t)t.hour * 60ul * 60ul + (uint32_t)t.min * 60ul + (uint32_t)t.sec;
+    return (int32_t)t.dotw * Schedule::SecondsPerDay + getRtcSecondsSinceMidnight();
   }
   return -1;
 }
 
+// A light with schedule entries is in whatever state its latest one left
+// it, on for good if it only has on entries
+bool scheduledLight(uint8_t light, int32_t weekSecond)
+{
+  uint32_t onAt, offAt;
+  const ScheduleEntry* on = schedule.last(ScheduleAction::LightOn, light, (uint32_t)weekSecond, onAt);
+  const ScheduleEntry* off = schedule.last(ScheduleAction::LightOff, light, (uint32_t)weekSecond, offAt);
+  if (!on || !off)
+  {
+    return on != nullptr;
+  }
+  // Either can be from last week, then it's later in the week than now
+  auto ago = [&](uint32_t at) { return ((uint32_t)weekSecond + Schedule::SecondsPerWeek - at) % Schedule::SecondsPerWeek; };
+  return ago(onAt) <= ago(offAt);
+}
+
 void autoLights(const Settings& settings)
 {
   int32_t now = getRtcSecondsSinceMidnight();
+  int32_t weekNow = getRtcSecondsSinceSunday();
 
   for (int i = 0; i < lights.size(); ++i)
   {
     int32_t onTime = settings.light(i).onTime;
     int32_t offTime = settings.light(i).offTime;
-    if (settings.light(i).enable)
+    if (settings.light(i).enable && weekNow >= 0 && schedule.follows(ScheduleAction::LightOn, i))
+    {
+      setLight(i, scheduledLight(i, weekNow));
+    }
+    else if (settings.light(i).enable)
     {
       if (onTime < offTime)
       {
-        lights[i]->set(now < offTime && now >= onTime);
+        setLight(i, now < offTime && now >= onTime);
       }
       else
       {
-        lights[i]->set(now < offTime || now >= onTime);
+        setLight(i, now < offTime || now >= onTime);
       }
     }
     else
     {
-      lights[i]->set(false);
+      setLight(i, false);
+    }
+  }
+}
+
+void onButtonEdge()
+{
+  for (uint pin : {WaterButtonPin, LightButtonPin})
+  {
+    uint32_t events = gpio_get_irq_event_mask(pin);
+    if (events)
+    {
+      gpio_acknowledge_irq(pin, events);
+      Trace::record(TraceEvent::Button, pin, gpio_get(pin));
+      buttonEdge = true;
+      wakeRequested = true;
     }
   }
+  __sev();
+}
+
+void onSerialInput()
+{
+  wakeRequested = true;
+  __sev();
+}
+
+void enableInputWakeups()
+{
+  serialRx.begin(onSerialInput);
+  gpio_add_raw_irq_handler_masked((1u << WaterButtonPin) | (1u << LightButtonPin), onButtonEdge);
+  gpio_set_irq_enabled(WaterButtonPin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+  gpio_set_irq_enabled(LightButtonPin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+  irq_set_enabled(IO_IRQ_BANK0, true);
 }
 
 int main()
@@ -623,40 +1269,38 @@ int main()
   // Configure stdio
   stdio_init_all();
   rtc_init();
-
-  // Wait 1 second for remote terminals to connect
-  // before doing anything.
-  sleep_ms(1000);
+  startCycleCounter();
 
   // Init the settings object
-  FlashStorage<Settings> settingsMgr;
+  SettingsStore settingsMgr;
   Settings& settings = settingsMgr.data;
 
   // Read the current settings
-  std::cout << "Loading settings..." << std::endl << std::flush;
+  LOG_INFO << "Loading settings...";
   if (!settingsMgr.readFromFlash())
   {
-    std::cout << "No valid settings found, loading defaults..." << std::endl << std::flush;
+    LOG_WARN << "No valid settings found, loading defaults...";
     settings.setDefaults();
   }
-  std::cout << "Load complete!" << std::endl << std::flush;
+  LOG_INFO << "Load complete!";
 
   // Validate the current settings
-  std::cout << "Validating settings..." << std::endl << std::flush;
+  LOG_INFO << "Validating settings...";
   if (!settings.validateAll())
   {
-    std::cout << "Some settings were invalid and had to be reset." << std::endl<< std::flush;
+    LOG_WARN << "Some settings were invalid and had to be reset.";
+  }
+  LOG_INFO << "Validation complete!";
+
+  // Then the schedule entries on top of them
+  if (schedule.readFromFlash())
+  {
+    LOG_INFO << "Loaded " << schedule.size() << " schedule entries";
   }
-  std::cout << "Validation complete!" << std::endl << std::flush;
 
-  // Setup the animation system
-  animator.addAnimation("idle", std::make_unique<SolidAnimation>(HSVColor{147.0f, 0.8f, 0.15f}.toRGB()));
-  animator.addAnimation("errorIdle", std::make_unique<PulseAnimation>(HSVColor{0.0f, 0.8f, 1.0f}.toRGB()));
-  animator.addAnimation("blank", std::make_unique<BlankAnimation>());
-  animator.addAnimation("wifi", std::make_unique<WiFiConnectAnimation>());
-  animator.addAnimation("alert", std::make_unique<FlashAnimation>(RGBColor{128, 0, 0}));
-  animator.addAnimation("ok", std::make_unique<FlashAnimation>(HSVColor{200.0f, 0.7f, 0.5f}.toRGB()));
-  animator.addAnimation("water-progress", std::make_unique<ProgressAnimation>(RGBColor{0, 0, 255}));
+  // Setup the animation system. Watering progress only lightens what's
+  // below it, so an error pulse still shows through.
+  animator.blend(ProgressLayer, BlendMode::Lighten, 255);
   animator.startUpdateThread();
 
   // Configure button behavior
@@ -664,130 +1308,183 @@ int main()
   waterButton.debounce(2);
   lightButton.debounce(2);
   
-  // Try like crazy to establish a wifi connection and sync RTC
-  bool rtcOk = false;
-  uint32_t reconnectTries = 0;
-  uint32_t wifiTimeout = 10000;
-  while (!rtcOk)
+  enableInputWakeups();
+
+  // Start the schedule from the last time we knew right away. NTP sets it
+  // straight in the background, and only if there's nothing to go on does
+  // the schedule wait for it.
+  CheckpointStore::Record saved {};
+  if (checkpoints.load(saved))
   {
-    rtcOk = syncRtcWithNtp(settings, wifiTimeout);
-    if (!rtcOk)
+    ntp.useAddress(saved.ntpAddress);
+    if (saved.utcUs)
     {
-      if (reconnectTries < 5)
-      {
-        processStdIoFor(settingsMgr, 5000);
-      }
-      else if (reconnectTries < 15)
-      {
-        wifiTimeout = 15000;
-        processStdIoFor(settingsMgr, 15000);
-      }
-      else
-      {
-        wifiTimeout = 30000;
-        processStdIoFor(settingsMgr, 60000);
-      }
-      reconnectTries++;
+      uint64_t localUs = saved.utcUs + utcOffsetUs(settings);
+      timeSync.estimate(localUs, get_absolute_time(), saved.driftPpb);
+      LOG_INFO << "Estimating the time from flash";
+      setRtc(localUs);
     }
   }
 
-  // With the RTC set, create a type sync object which will allow
-  // us to feed in a "secondsFromMidnight" values and get out an
-  // absolute_time_t corresponding to that value for today.
+  // Get on the WiFi in the background, the way we did last time if that's known
+  wifi.begin(settings.wifiSsid, settings.wifiPassword, saved.wifi);
 
-  RtcBootTimeSync timeSync;
-  absolute_time_t evalTime = get_absolute_time();
-  absolute_time_t lastEvalTime = evalTime;
-  absolute_time_t nextFrameTime = evalTime;
-
-  std::vector<absolute_time_t> pumpOnTimes(pumps.size());
-  std::vector<absolute_time_t> pumpOffTimes(pumps.size());
-
-  bool autoLightsDone = false;
-  for (auto& time : pumpOffTimes)
+  // Keep each pump's alarm armed for its next scheduled cycle
+  auto armPumps = [&]()
   {
-    time = from_us_since_boot(0);
-  }
+    for (int i = 0; i < pumpActuators.size(); ++i)
+    {
+      pumpActuators[i]->arm(scheduler.pendingTime(Scheduler::EventType::PumpOn, i), pumpOnTimeUs(settings.pump(i), scheduler.pendingAmount(i)));
+    }
+  };
+
+  absolute_time_t evalTime = get_absolute_time();
+  absolute_time_t nextPollTime = at_the_end_of_time;
+  absolute_time_t buttonsSettledTime = evalTime;
 
   while (1)
   {
-    // Regulate loop speed
-    sleep_until(nextFrameTime);
-    nextFrameTime = make_timeout_time_ms(50);
+    // Start planning the daily pump and light events as soon as there's
+    // a clock to plan them by
+    if (!scheduler.started() && timeSync.synced())
+    {
+      scheduler.start(timeSync, settings, schedule);
+      autoLights(settings);
+      nextClockSave = make_timeout_time_ms(ClockSaveMs);
+    }
 
-    // Take a reading of the system time
-    lastEvalTime = evalTime;
+    // Sleep until the next scheduled event or poll, unless serial input
+    // or a button wakes us up first. While the network is busy any event
+    // could be for it, so the first one ends the sleep.
+    scheduler.refresh(evalTime);
+    if (!bootToScheduleUs && scheduler.started())
+    {
+      bootToScheduleUs = to_us_since_boot(get_absolute_time());
+    }
+    armPumps();
+    loopProfile.lap(LoopPhase::Planning);
+
+    // Nothing else to do, so now's the time to write out the log
+    bool logWaiting = Log::drain();
+    loopProfile.lap(LoopPhase::Log);
+
+    // And to write to flash, one short window at a time, while no pump is
+    // about to switch
+    absolute_time_t nextPumpSwitch = at_the_end_of_time;
+    for (auto& pump : pumpActuators)
+    {
+      nextPumpSwitch = absolute_time_min(nextPumpSwitch, pump->nextSwitchTime());
+    }
+    FlashScheduler::step(nextPumpSwitch, animator.moving());
+    loopProfile.lap(LoopPhase::Flash);
+    // Late when there was more to do than fits in a poll period
+    loopProfile.finish(absolute_time_diff_us(evalTime, get_absolute_time()) > PollPeriodMs * 1000);
+
+    absolute_time_t wakeTime = absolute_time_min(scheduler.nextEventTime(), nextPollTime);
+    wakeTime = absolute_time_min(wakeTime, ntp.busy() ? ntp.wakeTime() : nextTimeSync);
+    wakeTime = absolute_time_min(wakeTime, wifi.wakeTime());
+    wakeTime = absolute_time_min(wakeTime, nextClockSave);
+    if (logWaiting)
+    {
+      wakeTime = absolute_time_min(wakeTime, make_timeout_time_ms(LogRetryMs));
+    }
+    if (FlashScheduler::pending())
+    {
+      wakeTime = absolute_time_min(wakeTime, make_timeout_time_ms(FlashRetryMs));
+    }
+    while (!wakeRequested && absolute_time_diff_us(get_absolute_time(), wakeTime) > 0)
+    {
+      best_effort_wfe_or_timeout(wakeTime);
+      if (ntp.busy() || wifi.busy())
+      {
+        break;
+      }
+    }
+    wakeRequested = false;
     evalTime = get_absolute_time();
+    loopWakeups++;
+    loopProfile.start();
+
+    // Carry out everything that came due while we slept. The pumps have
+    // already been switched by their alarms, their events only make sure
+    // the next day's cycle gets armed.
+    Scheduler::Event ev;
+    bool eventsRan = false;
+    while (scheduler.popDue(evalTime, ev))
+    {
+      eventsRan = true;
+      switch (ev.type)
+      {
+        case Scheduler::EventType::LightOn:
+          setLight(ev.channel, true);
+          break;
+        case Scheduler::EventType::LightOff:
+          setLight(ev.channel, false);
+          break;
+        default:
+          break;
+      }
+    }
+    loopProfile.lap(LoopPhase::Events);
+
+    // Checkpoint the time now and then, and whenever something ran so a
+    // reboot can't plan it again for today
+    if (eventsRan || time_reached(nextClockSave))
+    {
+      saveCheckpoint(settings);
+    }
+    loopProfile.lap(LoopPhase::Checkpoint);
 
     // Watering cycle detection
     bool wateringCycleRunning = false;
     float waterCycleProgress = 1.0f;
-    for (int i = 0; i < pumps.size(); ++i)
+    for (int i = 0; i < pumpActuators.size(); ++i)
     {
-      if (to_ms_since_boot(evalTime) < to_ms_since_boot(pumpOffTimes[i]) && 
-          to_ms_since_boot(pumpOffTimes[i]) > to_ms_since_boot(pumpOnTimes[i]) &&
-          settingsMgr.data.pump(i).enable)
+      PumpActuator& pump = *pumpActuators[i];
+      if (pump.running() && settingsMgr.data.pump(i).enable)
       {
         wateringCycleRunning = true;
-        float progress = (float)(to_ms_since_boot(evalTime)-to_ms_since_boot(pumpOnTimes[i])) / 
-                         (float)(to_ms_since_boot(pumpOffTimes[i]) - to_ms_since_boot(pumpOnTimes[i]));
+        float progress = (float)absolute_time_diff_us(pump.onTime(), evalTime) / 
+                         (float)absolute_time_diff_us(pump.onTime(), pump.offTime());
         if (progress < waterCycleProgress)
         {
           waterCycleProgress = progress;
         }
       }
     }
-    animator.parameter("water-progress", waterCycleProgress);
+    // Only bother the animation core when there's something new to show
+    static float lastWaterCycleProgress = -1.0f;
+    if (waterCycleProgress != lastWaterCycleProgress)
+    {
+      animator.parameter(Anim::WaterProgress, waterCycleProgress);
+      lastWaterCycleProgress = waterCycleProgress;
+    }
     if (wateringCycleRunning)
     {
-      animator.playAnimation("water-progress");
+      animator.playAnimation(ProgressLayer, Anim::WaterProgress);
     }
-    
-    // Determine if between last frame and this frame, a light should have turned on
-    // or off
-    if (!autoLightsDone)
+    loopProfile.lap(LoopPhase::Watering);
+
+    // Keep the link up and the clock in sync in the background, and save
+    // how we got on the WiFi for next time
+    wifi.step(utcSecs(settings));
+    if (wifi.cacheChanged())
     {
-      autoLights(settings);
-      autoLightsDone = true;
+      saveCheckpoint(settings);
     }
-    else
+    if (ntp.busy())
     {
-      for (int i = 0; i < lights.size(); ++i)
-      {
-        if (settings.light(i).enable)
-        {
-          auto onTime = timeSync.absoluteTimeFromSecondsSinceMidnight(settings.light(i).onTime, evalTime);
-          auto offTime = timeSync.absoluteTimeFromSecondsSinceMidnight(settings.light(i).offTime, evalTime);
-          if (withinRange(onTime, lastEvalTime, evalTime))
-          {
-            lights[i]->set(true);
-          }
-          else if (withinRange(offTime, lastEvalTime, evalTime))
-          {
-            lights[i]->set(false);
-          }
-        }
-      }
+      stepTimeSync(settings);
     }
-
-    // Determine if between last frame and this frame, a watering event should have been triggered
-    for (int i = 0; i < pumps.size(); ++i)
+    else if (time_reached(nextTimeSync))
     {
-      if (settings.pump(i).enable)
-      {
-        auto onTime = timeSync.absoluteTimeFromSecondsSinceMidnight(settings.pump(i).activationTime, evalTime);
-        if (withinRange(onTime, lastEvalTime, evalTime))
-        {
-          uint64_t usPumpOnTime = (settings.pump(i).amount / settings.pump(i).rate * 1000000.0f);
-          pumpOffTimes[i] = from_us_since_boot(to_us_since_boot(onTime) + usPumpOnTime);
-          pumpOnTimes[i] = onTime;
-        }
-      }
-      pumps[i]->set(to_ms_since_boot(evalTime) < to_ms_since_boot(pumpOffTimes[i]));
+      startTimeSync(settings);
     }
+    loopProfile.lap(LoopPhase::Network);
 
     // Process input
     processStdIo(settingsMgr);
+    loopProfile.lap(LoopPhase::Input);
 
     waterButton.update();
     if (waterButton.buttonUp())
@@ -795,11 +1492,9 @@ int main()
       if (wateringCycleRunning)
       {
         // Cancel the watering cycle
-        for (int i = 0; i < pumps.size(); ++i)
+        for (auto& pump : pumpActuators)
         {
-          pumpOffTimes[i] = from_us_since_boot(0);
-          pumpOnTimes[i] = from_us_since_boot(0);
-          pumps[i]->set(false);
+          pump->stop();
         }
       }
       else
@@ -809,11 +1504,8 @@ int main()
         {
           if (settings.pump(i).enable)
           {
-            uint64_t usPumpOnTime = (settings.pump(i).amount / settings.pump(i).rate * 1000000.0f);
-            pumpOffTimes[i] = from_us_since_boot(to_us_since_boot(evalTime) + usPumpOnTime);
-            pumpOnTimes[i] = evalTime;
+            pumpActuators[i]->start(pumpOnTimeUs(settings.pump(i), settings.pump(i).amount));
           }
-          pumps[i]->set(to_ms_since_boot(evalTime) < to_ms_since_boot(pumpOffTimes[i]));
         }
       }
     }
@@ -821,7 +1513,7 @@ int main()
     lightButton.update();
     if (lightButton.heldActivate())
     {
-      std::cout << "Button held, set lights to auto state" << std::endl << std::flush;
+      LOG_INFO << "Button held, set lights to auto state";
       autoLights(settings);
     }
     
@@ -833,12 +1525,26 @@ int main()
       {
         lightState = lightState || light->get();
       }
-      std::cout << "Button tapped, set lights " << (lightState ? "off" : "on") << std::endl << std::flush;
-      for (auto& light : lights)
+      LOG_INFO << "Button tapped, set lights " << (lightState ? "off" : "on");
+      for (int i = 0; i < lights.size(); ++i)
       {
-        light->set(!lightState);
+        setLight(i, !lightState);
       }
     }
+
+    // Buttons are debounced and timed by polling, so keep polling from the
+    // first edge until they have been released for a while
+    if (buttonEdge || !gpio_get(WaterButtonPin) || !gpio_get(LightButtonPin))
+    {
+      buttonEdge = false;
+      buttonsSettledTime = make_timeout_time_ms(ButtonSettleMs);
+    }
+
+    // Only poll while there is something to watch. Otherwise the
+    // scheduler and the input interrupts decide when we wake up next.
+    bool buttonsSettling = absolute_time_diff_us(evalTime, buttonsSettledTime) > 0;
+    nextPollTime = (wateringCycleRunning || buttonsSettling) ? make_timeout_time_ms(PollPeriodMs) : at_the_end_of_time;
+    loopProfile.lap(LoopPhase::Buttons);
   }
   return 0;
 }
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free queue for exactly one producer and one consumer, e.g. one per
+// core. Only uses atomic loads and stores, which is all the M0+ has.
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert((N & (N - 1)) == 0, "size must be a power of 2");
+
+public:
+  // Producer side. False if the queue is full.
+  bool push(const T& item)
+  {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= N)
+    {
+      return false;
+    }
+    items_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Hands the oldest item to fn and only then frees its slot,
+  // so anything fn stores is visible to the producer once it sees the item
+  // gone. False if the queue is empty.
+  template <typename F>
+  bool consume(F&& fn)
+  {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    fn(items_[tail & (N - 1)]);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Like consume(), but the item is only taken if fn
+  // returns true, otherwise it stays first in line. False if it stayed or
+  // the queue is empty.
+  template <typename F>
+  bool consumeIf(F&& fn)
+  {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire) || !fn(items_[tail & (N - 1)]))
+    {
+      return false;
+    }
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side, true if there's nothing to consume
+  bool empty() const
+  {
+    return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire);
+  }
+
+  // How many items are queued. From the side that isn't moving it's only a
+  // snapshot, the other side may push or consume at any moment.
+  size_t size() const
+  {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  // True once the consumer has taken everything pushed so far
+  bool drained() const
+  {
+    return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_relaxed);
+  }
+
+private:
+  T items_[N];
+  std::atomic<uint32_t> head_ {0};
+  std::atomic<uint32_t> tail_ {0};
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <hardware/sync.h>
+#include <pico/time.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A flight recorder of what the board did and when, for working out after
+// the fact why a pump ran long or a light came on late. Every event is a
+// small fixed size record in a RAM ring that keeps the most recent ones.
+// Recording one is a timer read and a few stores with interrupts held off
+// for the moment, cheap enough for alarm callbacks.
+//
+// The trace dump command prints the ring, and tools/trace2json.py turns
+// that into a Chrome / Perfetto trace.
+//
+// Record from core 0 only, main loop or interrupts.
+
+enum class TraceEvent : uint8_t
+{
+  None = 0,
+  PumpOn,        // pump, how late the alarm was in us (NoArg if by hand)
+  PumpOff,       // pump, how late the alarm was in us (NoArg if by hand)
+  LightOn,       // light
+  LightOff,      // light
+  Button,        // GPIO pin, its level (0 while pressed)
+  NtpState,      // NtpClient::State it moved to
+  FlashBegin,    // TraceFlash what's being written, 1 for a sector erase (0 for a page)
+  FlashEnd,      // TraceFlash, how long core 1 and interrupts were held off in us
+  Animation,     // layer, Anim id it started playing (NoArg if stopped)
+};
+
+enum class TraceFlash : uint16_t
+{
+  Settings = 0,
+  Checkpoint = 1,
+  Schedule = 2,
+};
+
+class Trace
+{
+public:
+  // A power of 2
+  static constexpr size_t Size = 512;
+  // For an arg that doesn't apply this time
+  static constexpr uint32_t NoArg = 0xffffffff;
+
+  struct Record
+  {
+    uint32_t timeUs; // low 32 bits of the time since boot, wraps every 71 minutes
+    TraceEvent event;
+    uint8_t reserved;
+    uint16_t arg0;
+    uint32_t arg1;
+  };
+
+  static void record(TraceEvent event, uint16_t arg0 = 0, uint32_t arg1 = 0)
+  {
+    uint32_t ints = save_and_disable_interrupts();
+    records_[count_ & (Size - 1)] = Record {time_us_32(), event, 0, arg0, arg1};
+    count_ = count_ + 1;
+    restore_interrupts(ints);
+  }
+
+  // Events recorded since boot or clear(), including the ones since
+  // overwritten
+  static uint32_t count()
+  {
+    return count_;
+  }
+
+  // The i-th oldest event still in the ring, i < min(count(), Size)
+  static Record at(size_t i)
+  {
+    uint32_t count = count_;
+    uint32_t first = count > Size ? count - Size : 0;
+    return records_[(first + i) & (Size - 1)];
+  }
+
+  static void clear()
+  {
+    count_ = 0;
+  }
+
+private:
+  static inline Record records_[Size] = {};
+  static inline volatile uint32_t count_ = 0;
+};
+
+static_assert((Trace::Size & (Trace::Size - 1)) == 0, "trace size must be a power of 2");
+static_assert(sizeof(Trace::Record) == 12, "trace records are meant to be small");
@@ -0,0 +1,325 @@
+#include "WiFiLink.hpp"
+#include "Log.hpp"
+
+#include <pico/cyw43_arch.h>
+
+#include <lwip/dhcp.h>
+#include <lwip/netif.h>
+
+#include <cstring>
+
+// How often to check on the link while connecting. Link changes come in
+// through the driver's interrupt too, this is just so we never miss one.
+constexpr uint32_t LinkPollMs = 100;
+// Once it's up, how often to check it's still there and let lwIP run its
+// timers (DHCP renewals and the like)
+constexpr uint32_t LinkCheckMs = 30000;
+
+namespace
+{
+  netif* staNetif()
+  {
+    return &cyw43_state.netif[CYW43_ITF_STA];
+  }
+}
+
+void WiFiLink::begin(const char* ssid, const char* password, const Cache& cache)
+{
+  ssid_ = ssid;
+  password_ = password;
+  cache_ = cache;
+  failures_ = 0;
+
+  if (!radioOn_)
+  {
+    // Loading the radio firmware is the one part that can't be split up, it
+    // takes a moment but doesn't wait on the network
+    if (cyw43_arch_init())
+    {
+      LOG_ERROR << "WiFi chip failed to start";
+      return;
+    }
+    cyw43_arch_enable_sta_mode();
+    radioOn_ = true;
+  }
+  attempt();
+}
+
+void WiFiLink::reconnect()
+{
+  if (state_ == State::Off)
+  {
+    return;
+  }
+  cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+  failures_ = 0;
+  attempt();
+}
+
+void WiFiLink::step(uint32_t utcSecs)
+{
+  if (state_ == State::Off)
+  {
+    return;
+  }
+
+  // Runs the lwIP callbacks and timers for anything that came in
+  cyw43_arch_poll();
+  int link = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+
+  switch (state_)
+  {
+  case State::Joining:
+  case State::Addressing:
+    if (link == CYW43_LINK_UP)
+    {
+      connected(utcSecs);
+    }
+    else if (link == CYW43_LINK_NOIP && state_ == State::Joining)
+    {
+      // Associated. DHCP carries on in the background either way, but a
+      // lease that's still good can be used right away.
+      state_ = State::Addressing;
+      if (leaseUsable(utcSecs))
+      {
+        useLease();
+        connected(utcSecs);
+      }
+    }
+    else if (link == CYW43_LINK_BADAUTH)
+    {
+      fail("password rejected");
+    }
+    else if (link < 0)
+    {
+      fail("couldn't join the network");
+    }
+    else if (time_reached(deadline_))
+    {
+      fail("timed out connecting");
+    }
+    break;
+  case State::Up:
+    if (link != CYW43_LINK_UP)
+    {
+      stats_.drops++;
+      LOG_WARN << "WiFi link lost, reconnecting";
+      cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+      attempt();
+      break;
+    }
+    if (leasePending_ && dhcp_supplied_address(staNetif()))
+    {
+      leasePending_ = false;
+      remember(utcSecs);
+    }
+    else if (cache_.leaseEndSecs == 0 && leaseSecs_ != 0 && utcSecs != 0)
+    {
+      // Got the lease before we knew the time, date it now we do
+      uint32_t heldSecs = (uint32_t)(absolute_time_diff_us(leaseTime_, get_absolute_time()) / 1000000);
+      cache_.leaseEndSecs = utcSecs - heldSecs + leaseSecs_;
+      cacheChanged_ = true;
+    }
+    checkTime_ = make_timeout_time_ms(LinkCheckMs);
+    break;
+  case State::Waiting:
+    if (time_reached(retryTime_))
+    {
+      attempt();
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+WiFiLink::State WiFiLink::state() const
+{
+  return state_;
+}
+
+bool WiFiLink::up() const
+{
+  return state_ == State::Up;
+}
+
+bool WiFiLink::busy() const
+{
+  return state_ == State::Joining || state_ == State::Addressing || (state_ == State::Up && leasePending_);
+}
+
+absolute_time_t WiFiLink::wakeTime() const
+{
+  switch (state_)
+  {
+  case State::Joining:
+  case State::Addressing:
+    return absolute_time_min(deadline_, make_timeout_time_ms(LinkPollMs));
+  case State::Up:
+    return leasePending_ ? make_timeout_time_ms(LinkPollMs) : checkTime_;
+  case State::Waiting:
+    return retryTime_;
+  default:
+    return at_the_end_of_time;
+  }
+}
+
+const WiFiLink::Cache& WiFiLink::cache() const
+{
+  return cache_;
+}
+
+bool WiFiLink::cacheChanged()
+{
+  bool changed = cacheChanged_;
+  cacheChanged_ = false;
+  return changed;
+}
+
+const WiFiLink::Stats& WiFiLink::stats() const
+{
+  return stats_;
+}
+
+void WiFiLink::resetStats()
+{
+  stats_ = {};
+}
+
+uint32_t WiFiLink::hash(const char* s)
+{
+  // FNV-1a, never 0 so an empty cache can't match
+  uint32_t hash = 2166136261u;
+  for (; *s; ++s)
+  {
+    hash = (hash ^ (uint8_t)*s) * 16777619u;
+  }
+  return hash ? hash : 1;
+}
+
+bool WiFiLink::leaseUsable(uint32_t utcSecs) const
+{
+  // Without the time there's no telling whether it ran out
+  return cache_.ssidHash == hash(ssid_) && cache_.address != 0 && utcSecs != 0 &&
+         cache_.leaseEndSecs > utcSecs + MinLeaseLeftSecs;
+}
+
+void WiFiLink::attempt()
+{
+  attemptStart_ = get_absolute_time();
+  leasePending_ = false;
+  state_ = State::Joining;
+
+  // Straight to the access point we used last time if we know it, which
+  // skips the scan of every channel
+  fast_ = cache_.ssidHash == hash(ssid_) && cache_.channel != 0;
+  int err;
+  if (fast_)
+  {
+    deadline_ = make_timeout_time_ms(FastJoinTimeoutMs);
+    err = cyw43_wifi_join(&cyw43_state, strlen(ssid_), (const uint8_t*)ssid_, strlen(password_), (const uint8_t*)password_,
+                          CYW43_AUTH_WPA2_AES_PSK, cache_.bssid, cache_.channel);
+  }
+  else
+  {
+    deadline_ = make_timeout_time_ms(JoinTimeoutMs);
+    err = cyw43_arch_wifi_connect_async(ssid_, password_, CYW43_AUTH_WPA2_AES_PSK);
+  }
+  if (err)
+  {
+    fail("connect failed");
+  }
+}
+
+void WiFiLink::useLease()
+{
+  ip4_addr_t address;
+  ip4_addr_t netmask;
+  ip4_addr_t gateway;
+  ip4_addr_set_u32(&address, cache_.address);
+  ip4_addr_set_u32(&netmask, cache_.netmask);
+  ip4_addr_set_u32(&gateway, cache_.gateway);
+  netif_set_addr(staNetif(), &address, &netmask, &gateway);
+}
+
+void WiFiLink::connected(uint32_t utcSecs)
+{
+  uint32_t ms = (uint32_t)(absolute_time_diff_us(attemptStart_, get_absolute_time()) / 1000);
+  stats_.connects++;
+  if (fast_)
+  {
+    stats_.fastConnects++;
+  }
+  stats_.lastConnectMs = ms;
+  if (stats_.connects == 1 || ms < stats_.bestConnectMs)
+  {
+    stats_.bestConnectMs = ms;
+  }
+  if (ms > stats_.worstConnectMs)
+  {
+    stats_.worstConnectMs = ms;
+  }
+  stats_.totalConnectMs += ms;
+
+  LOG_INFO << "WiFi up in " << ms << " ms" << (fast_ ? " (cached access point)" : "");
+  state_ = State::Up;
+  failures_ = 0;
+  deadline_ = at_the_end_of_time;
+  checkTime_ = make_timeout_time_ms(LinkCheckMs);
+
+  // A reused lease is only remembered again once DHCP has confirmed it
+  if (dhcp_supplied_address(staNetif()))
+  {
+    remember(utcSecs);
+  }
+  else
+  {
+    leasePending_ = true;
+  }
+}
+
+void WiFiLink::remember(uint32_t utcSecs)
+{
+  netif* n = staNetif();
+  cache_.ssidHash = hash(ssid_);
+  cyw43_wifi_get_bssid(&cyw43_state, cache_.bssid);
+
+  // channel_info_t starts with the channel in use, little endian
+  uint8_t channelInfo[12] = {};
+  cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channelInfo), channelInfo, CYW43_ITF_STA);
+  cache_.channel = (uint16_t)(channelInfo[0] | channelInfo[1] << 8);
+
+  cache_.address = ip4_addr_get_u32(netif_ip4_addr(n));
+  cache_.netmask = ip4_addr_get_u32(netif_ip4_netmask(n));
+  cache_.gateway = ip4_addr_get_u32(netif_ip4_gw(n));
+  dhcp* lease = netif_dhcp_data(n);
+  leaseSecs_ = lease ? lease->offered_t0_lease : 0;
+  leaseTime_ = get_absolute_time();
+  cache_.leaseEndSecs = (utcSecs && leaseSecs_) ? utcSecs + leaseSecs_ : 0;
+  cacheChanged_ = true;
+}
+
+void WiFiLink::fail(const char* why)
+{
+  cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+  if (fast_)
+  {
+    // The access point moved or went away, forget it and scan for the network
+    LOG_INFO << "WiFi " << why << " at the cached access point, scanning";
+    cache_.channel = 0;
+    attempt();
+    return;
+  }
+
+  stats_.failures++;
+  uint32_t backoffMs = MinBackoffMs << (failures_ < 8 ? failures_ : 8);
+  if (backoffMs > MaxBackoffMs)
+  {
+    backoffMs = MaxBackoffMs;
+  }
+  failures_++;
+  LOG_WARN << "WiFi " << why << ", retrying in " << backoffMs / 1000 << " s";
+  retryTime_ = make_timeout_time_ms(backoffMs);
+  deadline_ = at_the_end_of_time;
+  state_ = State::Waiting;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <pico/time.h>
+
+#include <stdint.h>
+
+// Keeps the board on the WiFi for as long as it runs, so anything that
+// needs the network finds the link already up instead of spending seconds
+// of radio time bringing it up and tearing it down again.
+//
+// Nothing here blocks. The main loop calls step() whenever it wakes up,
+// which polls the radio and lwIP and moves the link along: joining, waiting
+// for an address, watching for it to drop, and retrying with a growing
+// back-off when the access point can't be reached.
+//
+// What the last good connection found out (the access point, its channel
+// and the DHCP lease) is kept in a Cache the caller saves to flash. The
+// next join goes straight to that access point without a scan, and while
+// the lease is still good the link is up as soon as it's associated. DHCP
+// runs on in the background to confirm the lease, or replace it.
+class WiFiLink
+{
+public:
+  enum class State : uint8_t
+  {
+    Off,        // not started, radio off
+    Joining,    // associating with the access point
+    Addressing, // associated, waiting for DHCP
+    Up,
+    Waiting,    // backing off before trying again
+  };
+
+  struct Cache
+  {
+    uint32_t ssidHash;     // the network it belongs to, 0 if empty
+    uint8_t bssid[6];      // the access point
+    uint16_t channel;
+    uint32_t address;      // the DHCP lease, IPv4 addresses
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t leaseEndSecs; // UTC seconds since 1970 the lease runs out, 0 if unknown
+  };
+
+  struct Stats
+  {
+    uint32_t connects;       // times the link came up
+    uint32_t fastConnects;   // of those, how many used the cache
+    uint32_t failures;       // attempts that gave up
+    uint32_t drops;          // times it went down by itself
+    uint32_t lastConnectMs;  // from starting an attempt to the link being up
+    uint32_t bestConnectMs;
+    uint32_t worstConnectMs;
+    uint64_t totalConnectMs;
+  };
+
+  // First retry after a failure, doubling up to the max
+  static constexpr uint32_t MinBackoffMs = 2000;
+  static constexpr uint32_t MaxBackoffMs = 5 * 60 * 1000;
+  // How long an attempt gets before giving up on it
+  static constexpr uint32_t JoinTimeoutMs = 20000;
+  static constexpr uint32_t FastJoinTimeoutMs = 3000;
+  // Cached leases with less left than this are left to DHCP
+  static constexpr uint32_t MinLeaseLeftSecs = 60 * 60;
+
+  // Start connecting and keep connected. The strings are read on every
+  // attempt, so they must outlive the link (the settings do).
+  void begin(const char* ssid, const char* password, const Cache& cache);
+
+  // Drop the link and start over, e.g. after the network settings changed
+  void reconnect();
+
+  // Poll the network and move the link along. utcSecs is the time if it's
+  // known, 0 if not, for the lease. Call it before anything else that uses
+  // the network in the same loop iteration.
+  void step(uint32_t utcSecs);
+
+  State state() const;
+  bool up() const;
+
+  // True while connecting, when a network event should end the main
+  // loop's sleep
+  bool busy() const;
+
+  // When step() next has something to do even if no network event wakes us
+  absolute_time_t wakeTime() const;
+
+  const Cache& cache() const;
+  // True once after the cache changed, so it can be saved
+  bool cacheChanged();
+
+  const Stats& stats() const;
+  void resetStats();
+
+private:
+  static uint32_t hash(const char* s);
+  bool leaseUsable(uint32_t utcSecs) const;
+  void attempt();
+  void useLease();
+  void connected(uint32_t utcSecs);
+  void remember(uint32_t utcSecs);
+  void fail(const char* why);
+
+  const char* ssid_ = nullptr;
+  const char* password_ = nullptr;
+  State state_ = State::Off;
+  bool radioOn_ = false;
+  Cache cache_ {};
+  bool cacheChanged_ = false;
+
+  // The attempt in flight
+  bool fast_ = false;
+  // Up on a reused lease, DHCP hasn't confirmed it yet
+  bool leasePending_ = false;
+  absolute_time_t attemptStart_ = nil_time;
+  absolute_time_t deadline_ = at_the_end_of_time;
+
+  // Back-off, and keeping an eye on the link once it's up
+  uint32_t failures_ = 0;
+  absolute_time_t retryTime_ = nil_time;
+  absolute_time_t checkTime_ = at_the_end_of_time;
+  // When the current lease was handed out and for how long
+  absolute_time_t leaseTime_ = nil_time;
+  uint32_t leaseSecs_ = 0;
+
+  Stats stats_ {};
+};
@@ -0,0 +1,238 @@
+// Per frame, per LED cost of the animation kernels, against the float
+// versions they replaced. Also checks the output still matches.
+
+#include "Bench.hpp"
+#include "Sim.hpp"
+
+#include <Animation.hpp>
+
+#include <cstdio>
+#include <memory>
+
+namespace
+{
+  // -- The float kernels as they were before Animation.hpp went fixed point --
+
+  namespace legacy
+  {
+    class Animation
+    {
+    public:
+      virtual ~Animation() = default;
+      void update(LEDBuffer& buffer, float deltaT)
+      {
+        updateInternal(buffer, deltaT);
+      }
+    protected:
+      virtual void updateInternal(LEDBuffer& buffer, float deltaT) = 0;
+      float t_ = 0.0f;
+      int loops_ = -1;
+    };
+
+    class FlashAnimation : public Animation
+    {
+    public:
+      FlashAnimation(RGBColor flashColor) : flashColor_(flashColor) {}
+    protected:
+      virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+      {
+        t_ += deltaT / 0.3f;
+        float loopLength = loops_ > 1 ? 1.0f : 2.0f;
+        while (t_ > loopLength)
+        {
+          t_ -= 1.0f;
+        }
+        RGBColor color;
+        if (t_ < 0.666f) color = flashColor_;
+        for (int i=0; i < buffer.size(); ++i)
+        {
+          buffer[i] = color;
+        }
+      }
+      RGBColor flashColor_;
+    };
+
+    class WaveAnimation : public Animation
+    {
+      virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+      {
+        t_ += deltaT / 16.0f;
+        while (t_ > 1.0f)
+        {
+          t_ -= 1.0f;
+        }
+        float mean = t_ * 16.0f - 4.0f;
+        for (int i=0; i < buffer.size(); ++i)
+        {
+          float v = 0.4f * expf(-0.5 * powf((((float)i - mean)/2.0f), 2.0f));
+          buffer[i] = HSVColor{147.0f, 0.8f, v}.toRGB();
+        }
+      }
+    };
+
+    class PulseAnimation : public Animation
+    {
+    public:
+      PulseAnimation(RGBColor color) : color_(color) {}
+    protected:
+      virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+      {
+        t_ += deltaT / 16.0f;
+        while (t_ > 1.0f)
+        {
+          t_ -= 1.0f;
+        }
+        float v;
+        if (t_ < 0.3f)
+        {
+          v = t_ / 0.3f;
+        }
+        else if (t_ >= 0.3f && t_ < 0.7)
+        {
+          v = 1.0f;
+        }
+        else
+        {
+          v = 1.0f - (t_ - 0.7f) / 0.3f;
+        }
+        float brightness = v * 0.333f + 0.1f;
+        RGBColor color = color_ * brightness;
+        for (int i=0; i < buffer.size(); ++i)
+        {
+          buffer[i] = color;
+        }
+      }
+      RGBColor color_;
+    };
+
+    class WiFiConnectAnimation : public Animation
+    {
+      virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+      {
+        t_ += deltaT / 2.0f;
+        while (t_ > 1.0f)
+        {
+          t_ -= 1.0f;
+        }
+        float loc;
+        if (t_ < 0.5f)
+        {
+          loc = t_ * 14.0f;
+        }
+        else
+        {
+          loc = 14.0f - (t_ * 14.0f);
+        }
+        for (int i=0; i < buffer.size(); ++i)
+        {
+          float v = std::clamp(1.0f - std::abs(loc - i), 0.0f, 1.0f);
+          buffer[i] = HSVColor{200.0f, 0.7f, 0.5f * v}.toRGB();
+        }
+      }
+    };
+
+    class ProgressAnimation : public Animation
+    {
+    public:
+      ProgressAnimation(RGBColor color) : color_(color) {}
+      void parameter(float t) { t_ = t; }
+    protected:
+      virtual void updateInternal(LEDBuffer& buffer, float deltaT) override
+      {
+        for (int i=0; i < buffer.size(); ++i)
+        {
+          float dist = t_ * 7.0f - i;
+          float v = std::clamp(dist + 1.0f, 0.25f, 1.0f);
+          buffer[i] = color_ * v;
+        }
+      }
+      RGBColor color_;
+    };
+  }
+
+  constexpr uint64_t FrameUs = 33333;
+
+  // Largest per-channel difference between the two versions, over a couple
+  // of loops of the animation at 30 fps
+  int maxDifference(::Animation& now, legacy::Animation& before, uint64_t runUs)
+  {
+    LEDBuffer a(bench::options().leds);
+    LEDBuffer b(bench::options().leds);
+    now.play(-1);
+    int worst = 0;
+    for (uint64_t t = 0; t < runUs; t += FrameUs)
+    {
+      sim::sleepUntil(sim::now() + FrameUs);
+      now.update(a);
+      before.update(b, (float)FrameUs / 1000000.0f);
+      for (size_t i = 0; i < a.size(); ++i)
+      {
+        worst = std::max({worst, std::abs(a[i].r - b[i].r), std::abs(a[i].g - b[i].g), std::abs(a[i].b - b[i].b)});
+      }
+    }
+    return worst;
+  }
+
+  void compare(const std::string& name, ::Animation& now, legacy::Animation& before, uint64_t loopUs)
+  {
+    int worst = maxDifference(now, before, 2 * loopUs);
+
+    LEDBuffer buffer(bench::options().leds);
+    uint64_t items = buffer.size();
+    // Both tick the virtual clock so they pay the same per frame overhead
+    bench::Result floatResult = bench::measure(items, [&]{
+      sim::sleepUntil(sim::now() + FrameUs);
+      before.update(buffer, (float)FrameUs / 1000000.0f);
+    });
+    bench::Result fixedResult = bench::measure(items, [&]{
+      sim::sleepUntil(sim::now() + FrameUs);
+      now.update(buffer);
+    });
+
+    char note[64];
+    snprintf(note, sizeof(note), "%.1fx, max diff %d", floatResult.nsPerItem / fixedResult.nsPerItem, worst);
+    bench::report(name + " float", floatResult);
+    bench::report(name + " fixed", fixedResult, note);
+  }
+}
+
+namespace bench
+{
+  void animations()
+  {
+    // The host has an FPU, so this understates what going fixed point saves
+    // on the M0+, where every float op is a soft-float library call
+    printf("  (per LED per frame, %d LEDs)\n", options().leds);
+
+    RGBColor errorRed = HSVColor{0.0f, 0.8f, 1.0f}.toRGB();
+    RGBColor okBlue = HSVColor{200.0f, 0.7f, 0.5f}.toRGB();
+
+    {
+      WaveAnimation now;
+      legacy::WaveAnimation before;
+      compare("wave", now, before, 16000000);
+    }
+    {
+      WiFiConnectAnimation now;
+      legacy::WiFiConnectAnimation before;
+      compare("wifi", now, before, 2000000);
+    }
+    {
+      PulseAnimation now(errorRed);
+      legacy::PulseAnimation before(errorRed);
+      compare("pulse", now, before, 16000000);
+    }
+    {
+      FlashAnimation now(okBlue);
+      legacy::FlashAnimation before(okBlue);
+      compare("flash", now, before, 300000);
+    }
+    {
+      ProgressAnimation now(RGBColor{0, 0, 255});
+      legacy::ProgressAnimation before(RGBColor{0, 0, 255});
+      now.parameter(0.55f);
+      before.parameter(0.55f);
+      compare("progress", now, before, FrameUs);
+    }
+  }
+}
@@ -0,0 +1,132 @@
+#include "Bench.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#endif
+
+namespace bench
+{
+  namespace
+  {
+    Options opts;
+
+    uint64_t cycles()
+    {
+#ifdef BENCH_HAVE_TSC
+      return __rdtsc();
+#else
+      return 0;
+#endif
+    }
+  }
+
+  const Options& options()
+  {
+    return opts;
+  }
+
+  Result measure(uint64_t items, const std::function<void()>& fn)
+  {
+    using Clock = std::chrono::steady_clock;
+
+    // Warm up, then time batches until we've run long enough
+    fn();
+    uint64_t calls = 0;
+    uint64_t batch = 1;
+    uint64_t startCycles = cycles();
+    auto start = Clock::now();
+    double elapsed = 0;
+    while (elapsed < opts.minSeconds)
+    {
+      for (uint64_t i = 0; i < batch; ++i)
+      {
+        fn();
+      }
+      calls += batch;
+      batch *= 2;
+      elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    uint64_t endCycles = cycles();
+
+    double n = (double)calls * (double)items;
+    return { elapsed * 1e9 / n, (double)(endCycles - startCycles) / n };
+  }
+
+  void report(const std::string& name, const Result& r, const std::string& note)
+  {
+    printf("  %-32s %10.2f ns %10.1f cyc  %s\n", name.c_str(), r.nsPerItem, r.cyclesPerItem, note.c_str());
+  }
+}
+
+namespace
+{
+  void usage(const char* argv0)
+  {
+    fprintf(stderr,
+      "usage: %s [options] [suite...]\n"
+      "\n"
+      "Suites: animations, compositor, commands, store, schedule (default: all)\n"
+      "\n"
+      "  --leds <n>          LEDs per frame (default 8)\n"
+      "  --seconds <s>       minimum run time per benchmark (default 0.2)\n",
+      argv0);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::map<std::string, void (*)()> suites =
+  {
+    {"animations", bench::animations},
+    {"compositor", bench::compositor},
+    {"commands", bench::commands},
+    {"store", bench::store},
+    {"schedule", bench::schedule},
+  };
+
+  std::vector<std::string> selected;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--leds" && hasValue)
+    {
+      bench::opts.leds = atoi(argv[++i]);
+    }
+    else if (arg == "--seconds" && hasValue)
+    {
+      bench::opts.minSeconds = atof(argv[++i]);
+    }
+    else if (suites.count(arg) > 0)
+    {
+      selected.push_back(arg);
+    }
+    else
+    {
+      usage(argv[0]);
+      return arg == "--help" ? 0 : 1;
+    }
+  }
+  if (selected.empty())
+  {
+    for (const auto& suite : suites)
+    {
+      selected.push_back(suite.first);
+    }
+  }
+
+  for (const std::string& name : selected)
+  {
+    printf("%s\n", name.c_str());
+    suites[name]();
+  }
+  return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Host micro-benchmarks for the hot paths of the firmware
+//
+// Host timings are no substitute for the Cortex-M0+, but comparing two
+// implementations of the same thing here does show which way things moved.
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace bench
+{
+  struct Options
+  {
+    int leds = 8;
+    double minSeconds = 0.2;
+  };
+
+  struct Result
+  {
+    double nsPerItem;
+    double cyclesPerItem; // TSC ticks, 0 where there is no cycle counter
+  };
+
+  const Options& options();
+
+  // Run fn (which handles `items` items per call) over and over for at least
+  // options().minSeconds and report the cost per item
+  Result measure(uint64_t items, const std::function<void()>& fn);
+
+  // Print a row of the results table
+  void report(const std::string& name, const Result& r, const std::string& note = "");
+
+  // The suites
+  void animations();
+  void compositor();
+  void commands();
+  void store();
+  void schedule();
+}
@@ -0,0 +1,391 @@
+// Cost of parsing and dispatching a serial command, the way processCommand
+// used to (a stringstream and a chain of string compares) against the
+// in-place tokenizer and perfect hash tables, and how many heap
+// allocations each one makes per command.
+
+#include "Bench.hpp"
+
+#include <Command.hpp>
+#include <Settings.hpp>
+#include <SettingsFields.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+
+namespace
+{
+  uint64_t allocations = 0;
+}
+
+// Count every heap allocation in the process, the benchmarks look at the
+// difference over a run
+void* operator new(size_t size)
+{
+  allocations++;
+  if (void* p = malloc(size ? size : 1))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+namespace
+{
+  // A mix of what provisioning scripts send
+  const char* lines[] =
+  {
+    "pump 2 rate 12.5",
+    "light 1 onTime 3600",
+    "offsetFromUtc -5.5",
+    "pump 4 activationTime 28800",
+    "wifiSsid my home network",
+    "force pump 3 1",
+    "anim play wifi 2 2",
+    "stats",
+  };
+  constexpr size_t LineCount = sizeof(lines) / sizeof(lines[0]);
+
+  Settings settings;
+  int sink = 0;
+
+  // -- The old way --
+
+  template <typename T>
+  bool oldSetVal(T& val, T min, T max, std::istream& s)
+  {
+    T input;
+    s >> input;
+    if (s.fail() || input < min || input > max)
+    {
+      return false;
+    }
+    val = input;
+    return true;
+  }
+
+  bool oldSetVal(bool& val, std::istream& s)
+  {
+    int input;
+    s >> input;
+    if (s.fail() || input < 0 || input > 1)
+    {
+      return false;
+    }
+    val = input == 1;
+    return true;
+  }
+
+  bool oldSetVal(char* val, size_t len, std::istream& ss)
+  {
+    ss >> std::ws;
+    std::string str;
+    std::getline(ss, str);
+    if (ss.fail() || str.size() >= len)
+    {
+      return false;
+    }
+    memcpy(val, str.data(), str.size());
+    val[str.size()] = '\0';
+    return true;
+  }
+
+  bool oldProcess(std::string cmdAndArgs)
+  {
+    std::stringstream ss(cmdAndArgs);
+    std::string cmd;
+    ss >> cmd;
+
+    if (cmd == "wifiSsid")
+    {
+      oldSetVal(settings.wifiSsid, sizeof(settings.wifiSsid), ss);
+    }
+    else if (cmd == "wifiPassword")
+    {
+      oldSetVal(settings.wifiPassword, sizeof(settings.wifiPassword), ss);
+    }
+    else if (cmd == "offsetFromUtc")
+    {
+      oldSetVal(settings.offsetFromUtc, -24.0f, 24.0f, ss);
+    }
+    else if (cmd == "pump")
+    {
+      int id;
+      if (!oldSetVal(id, 1, 4, ss)) return false;
+      std::string prop;
+      ss >> prop;
+      if (prop == "enable") oldSetVal(settings.pump(id-1).enable, ss);
+      else if (prop == "rate") oldSetVal(settings.pump(id-1).rate, 0.0f, 1000.0f, ss);
+      else if (prop == "amount") oldSetVal(settings.pump(id-1).amount, 0.0f, 1000.0f, ss);
+      else if (prop == "activationTime") oldSetVal(settings.pump(id-1).activationTime, 0, 24 * 60 * 60, ss);
+      else return false;
+    }
+    else if (cmd == "light")
+    {
+      int id;
+      if (!oldSetVal(id, 1, 2, ss)) return false;
+      std::string prop;
+      ss >> prop;
+      if (prop == "enable") oldSetVal(settings.light(id-1).enable, ss);
+      else if (prop == "onTime") oldSetVal(settings.light(id-1).onTime, 0, 24 * 60 * 60, ss);
+      else if (prop == "offTime") oldSetVal(settings.light(id-1).offTime, 0, 24 * 60 * 60, ss);
+      else return false;
+    }
+    else if (cmd == "force")
+    {
+      std::string prop;
+      ss >> prop;
+      int id;
+      bool val;
+      if (prop == "pump" && oldSetVal(id, 1, 4, ss) && oldSetVal(val, ss)) sink += id + val;
+      else if (prop == "light" && oldSetVal(id, 1, 2, ss) && oldSetVal(val, ss)) sink += id + val;
+      else return false;
+    }
+    else if (cmd == "defaults" || cmd == "flash" || cmd == "info" || cmd == "about" || cmd == "reboot" || cmd == "prog")
+    {
+      sink++;
+    }
+    else if (cmd == "anim")
+    {
+      std::string subcmd;
+      ss >> subcmd;
+      if (subcmd == "play")
+      {
+        std::string name = "idle";
+        int loops = 1;
+        int layer = 2;
+        ss >> name >> loops >> layer;
+        sink += (int)name.size() + loops + layer;
+      }
+      else if (subcmd == "base" || subcmd == "stop" || subcmd == "brightness" || subcmd == "blend" || subcmd == "param")
+      {
+        sink++;
+      }
+    }
+    else if (cmd == "stats" || cmd == "synctime" || cmd == "clock" || cmd == "time")
+    {
+      sink++;
+    }
+    else
+    {
+      return false;
+    }
+    return !ss.fail();
+  }
+
+  // -- The new way, the same handlers as the firmware minus the side effects --
+
+  template <typename T>
+  bool setVal(T& val, T min, T max, Tokens& args)
+  {
+    T input;
+    if (!parseNumber(args.next(), input) || input < min || input > max)
+    {
+      return false;
+    }
+    val = input;
+    return true;
+  }
+
+  bool setVal(bool& val, Tokens& args)
+  {
+    int input;
+    if (!setVal(input, 0, 1, args))
+    {
+      return false;
+    }
+    val = input == 1;
+    return true;
+  }
+
+  // Settings go through the field table
+  bool setSetting(FieldGroup group, uint8_t channel, std::string_view name, Tokens& args)
+  {
+    const SettingField* field = SettingFields::find(group, channel, name);
+    return field && SettingFields::parse(settings, *field, args) == FieldResult::Ok;
+  }
+
+  using CommandFn = bool (*)(Tokens& args);
+
+  bool force(Tokens& args, int count)
+  {
+    int id;
+    bool val;
+    if (!setVal(id, 1, count, args) || !setVal(val, args))
+    {
+      return false;
+    }
+    sink += id + val;
+    return true;
+  }
+
+  constexpr auto forceTargets = makeCommandTable<CommandFn>({
+    {"pump", [](Tokens& args) { return force(args, 4); }},
+    {"light", [](Tokens& args) { return force(args, 2); }},
+  });
+
+  bool noop(Tokens& args)
+  {
+    sink++;
+    return true;
+  }
+
+  constexpr auto animSubcommands = makeCommandTable<CommandFn>({
+    {"play", [](Tokens& args)
+      {
+        std::string_view name = args.next();
+        int loops = 1;
+        int layer = 2;
+        std::string_view token = args.next();
+        if (!token.empty() && !parseNumber(token, loops)) return false;
+        token = args.next();
+        if (!token.empty() && !parseNumber(token, layer)) return false;
+        sink += (int)name.size() + loops + layer;
+        return true;
+      }},
+    {"base", noop},
+    {"stop", noop},
+    {"brightness", noop},
+    {"blend", noop},
+    {"param", noop},
+  });
+
+  constexpr auto commandTable = makeCommandTable<CommandFn>({
+    {"pump", [](Tokens& args)
+      {
+        int id;
+        if (!setVal(id, 1, 4, args)) return false;
+        return setSetting(FieldGroup::Pump, id - 1, args.next(), args);
+      }},
+    {"light", [](Tokens& args)
+      {
+        int id;
+        if (!setVal(id, 1, 2, args)) return false;
+        return setSetting(FieldGroup::Light, id - 1, args.next(), args);
+      }},
+    {"force", [](Tokens& args)
+      {
+        CommandFn target = forceTargets.find(args.next());
+        return target && target(args);
+      }},
+    {"defaults", noop},
+    {"flash", noop},
+    {"info", noop},
+    {"about", noop},
+    {"reboot", noop},
+    {"prog", noop},
+    {"anim", [](Tokens& args)
+      {
+        CommandFn subcommand = animSubcommands.find(args.next());
+        return subcommand && subcommand(args);
+      }},
+    {"stats", noop},
+    {"synctime", noop},
+    {"clock", noop},
+    {"time", noop},
+  });
+
+  static_assert(commandTable.valid() && forceTargets.valid() && animSubcommands.valid(),
+                "command names must be unique");
+
+  bool newProcess(std::string_view line)
+  {
+    Tokens args(line);
+    std::string_view name = args.next();
+    CommandFn command = commandTable.find(name);
+    return command ? command(args) : setSetting(FieldGroup::General, 0, name, args);
+  }
+
+  // Just the name lookup, a compare chain against the table
+  const char* names[] =
+  {
+    "wifiSsid", "wifiPassword", "offsetFromUtc", "pump", "light", "force", "defaults", "flash", "info",
+    "about", "reboot", "prog", "anim", "stats", "synctime", "clock", "time",
+  };
+  constexpr size_t NameCount = sizeof(names) / sizeof(names[0]);
+
+  int chainLookup(std::string_view name)
+  {
+    for (size_t i = 0; i < NameCount; ++i)
+    {
+      if (name == names[i])
+      {
+        return (int)i;
+      }
+    }
+    return -1;
+  }
+
+  std::string note(const bench::Result& r, uint64_t allocs, uint64_t commands)
+  {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%.2fM commands/s, %.1f allocations/command",
+             1e3 / r.nsPerItem, (double)allocs / (double)commands);
+    return buf;
+  }
+}
+
+namespace bench
+{
+  void commands()
+  {
+    settings.setDefaults();
+
+    // Both have to agree on what every line does first
+    for (const char* line : lines)
+    {
+      Settings before = settings;
+      bool oldOk = oldProcess(line);
+      Settings oldResult = settings;
+      settings = before;
+      bool newOk = newProcess(line);
+      if (oldOk != newOk || memcmp(&oldResult, &settings, sizeof(Settings)) != 0)
+      {
+        printf("  MISMATCH on \"%s\"\n", line);
+      }
+    }
+
+    // One allocation count per version over a single pass of the mix
+    auto countAllocations = [](auto process)
+    {
+      uint64_t start = allocations;
+      for (const char* line : lines)
+      {
+        process(line);
+      }
+      return allocations - start;
+    };
+    uint64_t oldAllocs = countAllocations([](const char* line) { oldProcess(line); });
+    uint64_t newAllocs = countAllocations([](const char* line) { newProcess(std::string_view(line)); });
+
+    // The lines are copied in like the serial buffer hands them over
+    Result r = measure(LineCount, [] { for (const char* line : lines) oldProcess(line); });
+    report("stringstream + compare chain", r, note(r, oldAllocs, LineCount));
+    std::string_view views[LineCount];
+    for (size_t i = 0; i < LineCount; ++i)
+    {
+      views[i] = lines[i];
+    }
+    r = measure(LineCount, [&] { for (std::string_view line : views) sink += newProcess(line); });
+    report("tokens + perfect hash", r, note(r, newAllocs, LineCount));
+
+    // Name lookup alone over every command name
+    r = measure(NameCount, [] { for (const char* name : names) sink += chainLookup(name); });
+    report("lookup: compare chain", r);
+    r = measure(NameCount, [] { for (const char* name : names) sink += commandTable.find(name) != nullptr; });
+    report("lookup: perfect hash", r);
+  }
+}
@@ -0,0 +1,130 @@
+// Cost of blending one layer into the frame, per LED, for each blend mode
+// and the opacity early-outs, and of the output stage after it. Also checks
+// the packed math against plain per-channel arithmetic, and that dithering
+// averages out to the gamma corrected level.
+
+#include "Bench.hpp"
+
+#include <Compositor.hpp>
+#include <OutputStage.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+  const char* modeNames[] = {"normal", "add", "lighten", "multiply"};
+
+  uint8_t referenceChannel(uint8_t below, uint8_t above, BlendMode mode, uint8_t opacity)
+  {
+    int c = above;
+    switch (mode)
+    {
+    case BlendMode::Add: c = std::min(255, below + above); break;
+    case BlendMode::Lighten: c = std::max(below, above); break;
+    case BlendMode::Multiply: c = (below * above + 127) / 255; break;
+    default: break;
+    }
+    return (uint8_t)(below + (c - below) * opacity / 255.0f + 0.5f);
+  }
+
+  // Worst difference, in 1/256ths of a PWM step, between what dithering puts
+  // out on average and the exact gamma corrected level, over all inputs
+  double worstDitherError()
+  {
+    constexpr int Frames = 256;
+    double worst = 0.0;
+    for (int v = 0; v < 256; ++v)
+    {
+      OutputStage stage(1);
+      LEDBuffer out(1);
+      uint32_t frame = (uint32_t)v << 16;
+      double sum = 0.0;
+      for (int f = 0; f < Frames; ++f)
+      {
+        stage.process(&frame, out, true);
+        sum += out[0].r;
+      }
+      double exact = std::min(255.0, 255.0 * std::pow(v / 255.0, 2.2));
+      worst = std::max(worst, std::abs(sum / Frames - exact) * 256.0);
+    }
+    return worst;
+  }
+
+  // Largest per-channel difference from the reference over random colors
+  int maxError(BlendMode mode, uint8_t opacity)
+  {
+    std::mt19937 rng(1);
+    int worst = 0;
+    for (int n = 0; n < 100000; ++n)
+    {
+      RGBColor below {(uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng()};
+      RGBColor above {(uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng()};
+      uint32_t frame = packColor(below);
+      blendLayer(&frame, &above, 1, mode, opacity);
+      RGBColor got = unpackColor(frame);
+      worst = std::max({worst,
+        std::abs(got.r - referenceChannel(below.r, above.r, mode, opacity)),
+        std::abs(got.g - referenceChannel(below.g, above.g, mode, opacity)),
+        std::abs(got.b - referenceChannel(below.b, above.b, mode, opacity))});
+    }
+    return worst;
+  }
+}
+
+namespace bench
+{
+  void compositor()
+  {
+    printf("  (per layer per LED, %d LEDs)\n", options().leds);
+
+    std::mt19937 rng(2);
+    LEDBuffer layer(options().leds);
+    for (RGBColor& c : layer)
+    {
+      c = {(uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng()};
+    }
+    std::vector<uint32_t> frame(options().leds, 0x204060);
+
+    for (int m = 0; m < (int)BlendMode::Count; ++m)
+    {
+      for (uint8_t opacity : {(uint8_t)0, (uint8_t)128, (uint8_t)255})
+      {
+        BlendMode mode = (BlendMode)m;
+        if (opacity == 0 && m > 0)
+        {
+          // Transparent is the same early-out for every mode
+          continue;
+        }
+        Result r = measure(layer.size(), [&]{
+          blendLayer(frame.data(), layer.data(), frame.size(), mode, opacity);
+          // Keep the compiler from proving the frame is never read
+          asm volatile("" : : "r"(frame.data()) : "memory");
+        });
+        char name[48];
+        snprintf(name, sizeof(name), "%s @ %u", modeNames[m], opacity);
+        char note[48];
+        snprintf(note, sizeof(note), "max error %d", maxError(mode, opacity));
+        report(name, r, note);
+      }
+    }
+
+    OutputStage stage(options().leds);
+    for (bool dither : {false, true})
+    {
+      Result r = measure(layer.size(), [&]{
+        stage.process(frame.data(), layer, dither);
+        asm volatile("" : : "r"(layer.data()) : "memory");
+      });
+      char note[64] = "";
+      if (dither)
+      {
+        snprintf(note, sizeof(note), "average within %.1f/256 of a step", worstDitherError());
+      }
+      report(dither ? "output stage, dithered" : "output stage, rounded", r, note);
+    }
+  }
+}
@@ -0,0 +1,60 @@
+// --led-check: instead of the firmware, core 1 hands LedStripDma one frame
+// after another with a growing gap between them, so new frames land before,
+// right on and after the latch timer that starts the queued one. The
+// simulated DMA reports torn frames, restarts while busy and frames started
+// from the core that doesn't take its interrupt.
+
+#include "Sim.hpp"
+
+#include <LedStripDma.hpp>
+
+#include <pico/multicore.h>
+#include <pico/time.h>
+
+#include <string>
+
+int ledCheckMain();
+
+namespace
+{
+  constexpr uint NumLeds = 8;
+  // Past a whole frame and its latch, 8 * 30 + 300 us
+  constexpr uint32_t MaxGapUs = 1000;
+  constexpr int Rounds = 4;
+
+  LedStripDma* strip = nullptr;
+
+  void core1()
+  {
+    strip->begin();
+    LEDBuffer frame(NumLeds);
+    uint64_t handed = 0;
+    for (int round = 0; round < Rounds; ++round)
+    {
+      for (uint32_t gapUs = 0; gapUs < MaxGapUs; ++gapUs)
+      {
+        // Every frame differs from the one before, so none are skipped
+        frame[handed % NumLeds].r++;
+        strip->writeColors(frame);
+        handed++;
+        busy_wait_us(gapUs);
+      }
+    }
+    while (strip->busy())
+    {
+      busy_wait_us(100);
+    }
+    sim::exit("LED check done, " + std::to_string(handed) + " frames handed over", sim::ledErrorCount() ? 1 : 0);
+  }
+}
+
+int ledCheckMain()
+{
+  static LedStripDma leds(6, NumLeds);
+  strip = &leds;
+  multicore_launch_core1(core1);
+  while (true)
+  {
+    sleep_ms(1000);
+  }
+}
@@ -0,0 +1,451 @@
+// Simulated CYW43 + lwIP: an access point with a DHCP server, a DNS
+// resolver and an NTP server that answers with the simulator's wall clock
+
+#include "Sim.hpp"
+
+#include <lwip/dhcp.h>
+#include <lwip/dns.h>
+#include <lwip/udp.h>
+#include <pico/cyw43_arch.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+struct udp_pcb
+{
+  udp_recv_fn recv = nullptr;
+  void* recvArg = nullptr;
+};
+
+namespace
+{
+  // A full connect takes about 1.8 s, most of it scanning the channels
+  constexpr uint64_t ScanUs = 1100000;
+  constexpr uint64_t AssociateUs = 300000;
+  constexpr uint64_t DhcpUs = 400000;
+  constexpr uint8_t ApBssid[6] = {0x02, 0x00, 0x5e, 0x10, 0x00, 0x01};
+  constexpr uint32_t ApChannel = 6;
+  constexpr uint32_t LeaseAddr = 0xc0a80132; // 192.168.1.50
+  constexpr uint32_t LeaseNetmask = 0xffffff00;
+  constexpr uint32_t LeaseGateway = 0xc0a80101;
+  constexpr uint32_t LeaseSecs = 24 * 60 * 60;
+  constexpr uint64_t DnsLatencyUs = 30000;
+  constexpr uint64_t NtpLatencyUs = 25000;
+  constexpr uint32_t NtpServerAddr = 0xc000027b; // 192.0.2.123
+  constexpr uint64_t NtpDelta = 2208988800ull;
+
+  enum class Join
+  {
+    Down,
+    Joining,
+    Joined,
+    Failed,
+  };
+
+  bool radioOn = false;
+  Join join = Join::Down;
+  // Bumped to call off a join or DHCP exchange in flight
+  uint32_t joinGen = 0;
+  uint32_t dhcpGen = 0;
+  bool dhcpBound = false;
+  dhcp lease {};
+  std::set<std::string> dnsCache;
+  std::set<udp_pcb*> livePcbs;
+  // Timed events that belong to the radio, dropped when it's shut down
+  std::set<sim::EventId> radioEvents;
+
+  // Work lwIP would do on the next poll, by due time
+  std::multimap<uint64_t, std::function<void()>>& pending()
+  {
+    static std::multimap<uint64_t, std::function<void()>> p;
+    return p;
+  }
+
+  // Like the radio's interrupt: a timed event raises an event so a WFE
+  // wakes up, and the work itself waits for the next poll
+  void radioEvent(uint64_t delayUs, std::function<void()> fn)
+  {
+    auto id = std::make_shared<sim::EventId>();
+    *id = sim::at(sim::now() + delayUs, [id, fn]
+    {
+      radioEvents.erase(*id);
+      fn();
+      sim::signalEvent();
+    });
+    radioEvents.insert(*id);
+  }
+
+  void later(uint64_t delayUs, std::function<void()> fn)
+  {
+    pending().emplace(sim::now() + delayUs, std::move(fn));
+    radioEvent(delayUs, []{});
+  }
+
+  netif& sta()
+  {
+    return cyw43_state.netif[CYW43_ITF_STA];
+  }
+
+  bool linkUp()
+  {
+    return join == Join::Joined && sta().ip_addr.addr != 0;
+  }
+
+  bool apInRange()
+  {
+    if (!sim::options().wifiOk)
+    {
+      return false;
+    }
+    for (const sim::Outage& outage : sim::options().wifiOutages)
+    {
+      if (sim::now() >= outage.startUs && sim::now() < outage.endUs)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void dropLink()
+  {
+    join = Join::Down;
+    joinGen++;
+    dhcpGen++;
+    dhcpBound = false;
+    sta() = {};
+  }
+
+  void startDhcp()
+  {
+    uint32_t gen = ++dhcpGen;
+    radioEvent(DhcpUs, [gen]
+    {
+      if (gen != dhcpGen || join != Join::Joined)
+      {
+        return;
+      }
+      // Always the same lease, as if the server remembers us
+      dhcpBound = true;
+      lease.offered_t0_lease = LeaseSecs;
+      sta().ip_addr.addr = LeaseAddr;
+      sta().netmask.addr = LeaseNetmask;
+      sta().gw.addr = LeaseGateway;
+      sta().dhcp = &lease;
+    });
+  }
+
+  // The access point going away drops whoever is on it
+  void scheduleOutages()
+  {
+    static bool scheduled = false;
+    if (scheduled)
+    {
+      return;
+    }
+    scheduled = true;
+    for (const sim::Outage& outage : sim::options().wifiOutages)
+    {
+      sim::at(outage.startUs, []
+      {
+        if (join == Join::Joined)
+        {
+          dropLink();
+        }
+        sim::signalEvent();
+      });
+    }
+  }
+
+  void ntpReply(udp_pcb* pcb, uint64_t wallUs)
+  {
+    if (!linkUp() || livePcbs.count(pcb) == 0 || !pcb->recv)
+    {
+      return;
+    }
+    uint32_t secs = (uint32_t)(wallUs / 1000000ull + NtpDelta);
+    uint32_t frac = (uint32_t)(((wallUs % 1000000ull) << 32) / 1000000ull);
+
+    pbuf* p = pbuf_alloc(PBUF_TRANSPORT, 48, PBUF_RAM);
+    uint8_t* msg = (uint8_t*)p->payload;
+    memset(msg, 0, 48);
+    msg[0] = 0x24; // LI 0, version 4, mode 4 (server)
+    msg[1] = 2;    // stratum
+    for (int i = 0; i < 4; ++i)
+    {
+      msg[40 + i] = (uint8_t)(secs >> (24 - 8 * i));
+      msg[44 + i] = (uint8_t)(frac >> (24 - 8 * i));
+    }
+    ip_addr_t from {NtpServerAddr};
+    pcb->recv(pcb->recvArg, pcb, p, &from, 123);
+  }
+}
+
+// -- pico/cyw43_arch.h --
+
+cyw43_t cyw43_state;
+
+int cyw43_arch_init()
+{
+  radioOn = true;
+  dropLink();
+  scheduleOutages();
+  return 0;
+}
+
+void cyw43_arch_deinit()
+{
+  // Tearing down the radio takes lwIP and everything it knew with it
+  radioOn = false;
+  dropLink();
+  dnsCache.clear();
+  pending().clear();
+  for (sim::EventId id : radioEvents)
+  {
+    sim::cancel(id);
+  }
+  radioEvents.clear();
+}
+
+void cyw43_arch_enable_sta_mode()
+{
+}
+
+int cyw43_arch_wifi_connect_async(const char* ssid, const char* pw, uint32_t auth)
+{
+  return cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t*)ssid, strlen(pw), (const uint8_t*)pw, auth,
+                         nullptr, CYW43_CHANNEL_NONE);
+}
+
+int cyw43_tcpip_link_status(cyw43_t* self, int itf)
+{
+  switch (join)
+  {
+  case Join::Joining:
+    return CYW43_LINK_JOIN;
+  case Join::Joined:
+    return linkUp() ? CYW43_LINK_UP : CYW43_LINK_NOIP;
+  case Join::Failed:
+    return CYW43_LINK_NONET;
+  default:
+    return CYW43_LINK_DOWN;
+  }
+}
+
+int cyw43_wifi_join(cyw43_t* self, size_t ssid_len, const uint8_t* ssid, size_t key_len, const uint8_t* key,
+                    uint32_t auth_type, const uint8_t* bssid, uint32_t channel)
+{
+  if (!radioOn)
+  {
+    return -1;
+  }
+  dropLink();
+  join = Join::Joining;
+
+  // Given the access point and its channel there's no need to scan. Any
+  // password will do.
+  bool direct = bssid && channel != CYW43_CHANNEL_NONE;
+  bool right = (!bssid || memcmp(bssid, ApBssid, sizeof(ApBssid)) == 0) &&
+               (channel == CYW43_CHANNEL_NONE || channel == ApChannel);
+  uint32_t gen = joinGen;
+  radioEvent((direct ? 0 : ScanUs) + AssociateUs, [gen, right]
+  {
+    if (gen != joinGen)
+    {
+      return;
+    }
+    if (!right || !apInRange())
+    {
+      join = Join::Failed;
+      return;
+    }
+    // The driver starts DHCP as soon as the link is up
+    join = Join::Joined;
+    startDhcp();
+  });
+  return 0;
+}
+
+int cyw43_wifi_leave(cyw43_t* self, int itf)
+{
+  dropLink();
+  return 0;
+}
+
+int cyw43_wifi_get_bssid(cyw43_t* self, uint8_t bssid[6])
+{
+  if (join != Join::Joined)
+  {
+    return -1;
+  }
+  memcpy(bssid, ApBssid, sizeof(ApBssid));
+  return 0;
+}
+
+int cyw43_ioctl(cyw43_t* self, uint32_t cmd, size_t len, uint8_t* buf, uint32_t iface)
+{
+  if (cmd != CYW43_IOCTL_GET_CHANNEL || len < 4 || join != Join::Joined)
+  {
+    return -1;
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    buf[i] = (uint8_t)(ApChannel >> (8 * i));
+  }
+  return 0;
+}
+
+void cyw43_arch_poll()
+{
+  auto& p = pending();
+  while (!p.empty() && p.begin()->first <= sim::now())
+  {
+    auto fn = std::move(p.begin()->second);
+    p.erase(p.begin());
+    fn();
+  }
+}
+
+void cyw43_arch_wait_for_work_until(absolute_time_t until)
+{
+  auto& p = pending();
+  if (p.empty() || p.begin()->first > sim::now())
+  {
+    sim::waitForEvent(until);
+  }
+}
+
+// -- lwip --
+
+void netif_set_addr(netif* n, const ip4_addr_t* ipaddr, const ip4_addr_t* netmask, const ip4_addr_t* gw)
+{
+  n->ip_addr = *ipaddr;
+  n->netmask = *netmask;
+  n->gw = *gw;
+}
+
+err_t dhcp_start(netif* n)
+{
+  if (join == Join::Joined)
+  {
+    startDhcp();
+  }
+  return ERR_OK;
+}
+
+void dhcp_stop(netif* n)
+{
+  dhcpGen++;
+  if (dhcpBound)
+  {
+    dhcpBound = false;
+    n->ip_addr.addr = 0;
+  }
+}
+
+u8_t dhcp_supplied_address(const netif* n)
+{
+  return dhcpBound ? 1 : 0;
+}
+
+const char* ipaddr_ntoa(const ip_addr_t* addr)
+{
+  static char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u",
+           (unsigned)(addr->addr >> 24) & 0xff, (unsigned)(addr->addr >> 16) & 0xff,
+           (unsigned)(addr->addr >> 8) & 0xff, (unsigned)addr->addr & 0xff);
+  return buf;
+}
+
+pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
+{
+  pbuf* p = new pbuf {};
+  p->payload = malloc(length);
+  p->tot_len = length;
+  p->len = length;
+  return p;
+}
+
+u8_t pbuf_free(pbuf* p)
+{
+  free(p->payload);
+  delete p;
+  return 1;
+}
+
+u8_t pbuf_get_at(const pbuf* p, u16_t offset)
+{
+  return offset < p->len ? ((const u8_t*)p->payload)[offset] : 0;
+}
+
+u16_t pbuf_copy_partial(const pbuf* p, void* dataptr, u16_t len, u16_t offset)
+{
+  if (offset >= p->len) return 0;
+  u16_t n = (u16_t)std::min<int>(len, p->len - offset);
+  memcpy(dataptr, (const u8_t*)p->payload + offset, n);
+  return n;
+}
+
+udp_pcb* udp_new_ip_type(u8_t type)
+{
+  udp_pcb* pcb = new udp_pcb;
+  livePcbs.insert(pcb);
+  return pcb;
+}
+
+void udp_remove(udp_pcb* pcb)
+{
+  livePcbs.erase(pcb);
+  delete pcb;
+}
+
+void udp_recv(udp_pcb* pcb, udp_recv_fn recv, void* recv_arg)
+{
+  pcb->recv = recv;
+  pcb->recvArg = recv_arg;
+}
+
+err_t udp_sendto(udp_pcb* pcb, pbuf* p, const ip_addr_t* dst_ip, u16_t dst_port)
+{
+  if (!linkUp())
+  {
+    return ERR_VAL;
+  }
+  // Only the NTP server lives on this network, and it answers client requests
+  if (dst_ip->addr == NtpServerAddr && dst_port == 123 && p->len >= 48 && (pbuf_get_at(p, 0) & 0x7) == 3)
+  {
+    // The server reads its clock halfway through the round trip
+    later(NtpLatencyUs / 2, [pcb]
+    {
+      uint64_t stampUs = sim::wallUs();
+      later(NtpLatencyUs / 2, [pcb, stampUs]{ ntpReply(pcb, stampUs); });
+    });
+  }
+  return ERR_OK;
+}
+
+err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg)
+{
+  if (!linkUp())
+  {
+    return ERR_VAL;
+  }
+  std::string name = hostname;
+  if (dnsCache.count(name))
+  {
+    addr->addr = NtpServerAddr;
+    return ERR_OK;
+  }
+  later(DnsLatencyUs, [name, found, callback_arg]
+  {
+    dnsCache.insert(name);
+    ip_addr_t resolved {NtpServerAddr};
+    found(name.c_str(), &resolved, callback_arg);
+  });
+  return ERR_INPROGRESS;
+}
@@ -0,0 +1,374 @@
+// Simulated pi-pico-cpp peripherals: outputs, buttons and the LED strip
+
+#include "Sim.hpp"
+
+#include <cpp/Button.hpp>
+#include <cpp/DiscreteOut.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/pio.h>
+#include <LedStripDma.pio.h>
+
+#include <cstring>
+
+#include <map>
+#include <vector>
+
+namespace
+{
+  // WS2812B: 24 bits at 800 kHz per LED, then a >50 us low to latch
+  constexpr uint64_t UsPerLed = 30;
+  constexpr uint64_t LatchUs = 50;
+
+  struct RawIrqHandler
+  {
+    uint32_t mask;
+    irq_handler_t handler;
+  };
+
+  std::vector<RawIrqHandler> rawIrqHandlers;
+  std::map<uint, uint32_t> irqEnabled;
+  std::map<uint, uint32_t> irqPending;
+  bool bankIrqEnabled = false;
+
+  // The one DMA channel there is, feeding the WS2812 PIO program. It checks
+  // the driver doesn't touch a frame while it's being sent and waits out the
+  // reset latch between frames.
+  struct DmaChannel
+  {
+    bool claimed = false;
+    bool busy = false;
+    bool irqEnabled = false;
+    const uint32_t* readAddr = nullptr;
+    uint32_t count = 0;
+    std::vector<uint32_t> sending;
+    bool sentAny = false;
+    uint64_t lineIdleUs = 0;
+  };
+
+  DmaChannel dma;
+  irq_handler_t dmaIrqHandler = nullptr;
+  bool dmaIrqEnabled = false;
+  bool dmaIrqPending = false;
+  // Interrupts go to the core that enabled them
+  int dmaIrqCore = 0;
+
+  void raiseDmaIrq()
+  {
+    dmaIrqPending = true;
+    if (dmaIrqEnabled && dma.irqEnabled && dmaIrqHandler)
+    {
+      dmaIrqHandler();
+    }
+  }
+
+  void gpioEdge(uint gpio, uint32_t event)
+  {
+    if ((irqEnabled[gpio] & event) == 0) return;
+    irqPending[gpio] |= event;
+    if (!bankIrqEnabled) return;
+    for (const RawIrqHandler& h : rawIrqHandlers)
+    {
+      if (h.mask & (1u << gpio))
+      {
+        h.handler();
+      }
+    }
+  }
+}
+
+// -- hardware/gpio.h --
+
+bool gpio_get(uint gpio)
+{
+  return sim::inputLevel(gpio);
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled)
+{
+  uint32_t& mask = irqEnabled[gpio];
+  bool firstEnable = mask == 0 && enabled;
+  mask = enabled ? (mask | event_mask) : (mask & ~event_mask);
+  if (firstEnable)
+  {
+    // The button presses are known up front, so queue their edges now
+    for (const sim::Press& p : sim::options().presses)
+    {
+      if (p.pin == gpio && p.startUs >= sim::now())
+      {
+        sim::at(p.startUs, [gpio]{ gpioEdge(gpio, GPIO_IRQ_EDGE_FALL); });
+        sim::at(p.endUs, [gpio]{ gpioEdge(gpio, GPIO_IRQ_EDGE_RISE); });
+      }
+    }
+  }
+}
+
+void gpio_add_raw_irq_handler_masked(uint32_t gpio_mask, irq_handler_t handler)
+{
+  rawIrqHandlers.push_back({gpio_mask, handler});
+}
+
+uint32_t gpio_get_irq_event_mask(uint gpio)
+{
+  return irqPending[gpio];
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t event_mask)
+{
+  irqPending[gpio] &= ~event_mask;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+  if (num == IO_IRQ_BANK0)
+  {
+    bankIrqEnabled = enabled;
+  }
+  else if (num == DMA_IRQ_0)
+  {
+    dmaIrqEnabled = enabled;
+    dmaIrqCore = (int)get_core_num();
+  }
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+  if (num == DMA_IRQ_0)
+  {
+    dmaIrqHandler = handler;
+  }
+}
+
+// -- hardware/pio.h --
+
+pio_hw_t pio0_hw_sim;
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+  return 0;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t* program)
+{
+  return 0;
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+  return sm;
+}
+
+// -- LedStripDma.pio.h --
+
+const pio_program_t silvanus_ws2812_program = {nullptr, 4};
+
+void silvanus_ws2812_program_init(PIO pio, uint sm, uint offset, uint pin, float freq)
+{
+}
+
+// -- hardware/dma.h --
+
+int dma_claim_unused_channel(bool required)
+{
+  if (dma.claimed)
+  {
+    if (required) sim::exit("out of DMA channels", 1);
+    return -1;
+  }
+  dma.claimed = true;
+  return 0;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+  return {};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) {}
+void channel_config_set_read_increment(dma_channel_config* c, bool incr) {}
+void channel_config_set_write_increment(dma_channel_config* c, bool incr) {}
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) {}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger)
+{
+  dma.count = transfer_count;
+  if (trigger)
+  {
+    dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+  }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_addr, uint32_t transfer_count)
+{
+  if (dma.busy)
+  {
+    sim::ledProtocolError("DMA restarted while busy");
+  }
+  // Interrupts only keep the driver's state to itself on the core they're
+  // disabled on, so starting frames from the core that doesn't take the
+  // DMA interrupt races with it
+  if (dmaIrqEnabled && (int)get_core_num() != dmaIrqCore)
+  {
+    sim::ledProtocolError("DMA started on core " + std::to_string(get_core_num()) + ", its interrupt is taken on core " +
+                          std::to_string(dmaIrqCore));
+  }
+  if (dma.sentAny && sim::now() < dma.lineIdleUs + LatchUs)
+  {
+    sim::ledProtocolError("frame started " + std::to_string(sim::now() - dma.lineIdleUs) + " us after the last one, before the strip latched");
+  }
+
+  dma.busy = true;
+  dma.readAddr = (const uint32_t*)read_addr;
+  dma.count = transfer_count;
+  dma.sending.assign(dma.readAddr, dma.readAddr + transfer_count);
+
+  // The PIO takes the first words straight into its FIFO and OSR, after
+  // that DMA goes at the speed the bits shift out
+  constexpr uint32_t PioWords = 8 + 1;
+  uint64_t doneUs = sim::now() + (transfer_count > PioWords ? transfer_count - PioWords : 0) * UsPerLed;
+  dma.lineIdleUs = sim::now() + transfer_count * UsPerLed;
+  dma.sentAny = true;
+  sim::at(doneUs, []
+  {
+    if (memcmp(dma.sending.data(), dma.readAddr, dma.sending.size() * sizeof(uint32_t)) != 0)
+    {
+      sim::ledProtocolError("frame buffer changed while DMA was reading it");
+    }
+    dma.busy = false;
+    sim::ledFrameWritten(dma.count);
+    raiseDmaIrq();
+  }, dmaIrqCore);
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+  return dma.busy;
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled)
+{
+  dma.irqEnabled = enabled;
+}
+
+void dma_channel_acknowledge_irq0(uint channel)
+{
+  dmaIrqPending = false;
+}
+
+// -- cpp/DiscreteOut.hpp --
+
+DiscreteOut::DiscreteOut(uint pin, bool value, bool invert, bool openDrain) :
+  pin_(pin),
+  value_(value)
+{
+  sim::outputChanged(pin_, value_);
+}
+
+void DiscreteOut::set(bool value)
+{
+  value_ = value;
+  sim::outputChanged(pin_, value_);
+}
+
+bool DiscreteOut::get() const
+{
+  return value_;
+}
+
+// -- cpp/Button.hpp --
+
+GPIOButton::GPIOButton(uint pin, bool enableHold) :
+  pin_(pin),
+  enableHold_(enableHold)
+{
+}
+
+void GPIOButton::debounce(int samples)
+{
+  debounceSamples_ = samples < 1 ? 1 : samples;
+}
+
+void GPIOButton::holdActivationMs(int ms)
+{
+  holdActivationMs_ = ms;
+}
+
+void GPIOButton::holdActivationRepeatMs(int ms)
+{
+  holdActivationRepeatMs_ = ms;
+}
+
+void GPIOButton::update()
+{
+  buttonDown_ = false;
+  buttonUp_ = false;
+  heldActivate_ = false;
+
+  bool level = !sim::inputLevel(pin_);
+  if (level != pressed_)
+  {
+    if (++pendingSamples_ >= debounceSamples_)
+    {
+      pendingSamples_ = 0;
+      pressed_ = level;
+      if (pressed_)
+      {
+        buttonDown_ = true;
+        heldFired_ = false;
+        nextHoldActivation_ = make_timeout_time_ms(holdActivationMs_);
+      }
+      else
+      {
+        // A hold already did something, so don't also count it as a tap
+        buttonUp_ = !heldFired_;
+      }
+    }
+  }
+  else
+  {
+    pendingSamples_ = 0;
+  }
+
+  if (pressed_ && enableHold_ && !is_nil_time(nextHoldActivation_) &&
+      absolute_time_diff_us(nextHoldActivation_, get_absolute_time()) >= 0)
+  {
+    heldActivate_ = true;
+    heldFired_ = true;
+    nextHoldActivation_ = holdActivationRepeatMs_ < 0 ? nil_time : make_timeout_time_ms(holdActivationRepeatMs_);
+  }
+}
+
+bool GPIOButton::pressed() const
+{
+  return pressed_;
+}
+
+bool GPIOButton::buttonDown() const
+{
+  return buttonDown_;
+}
+
+bool GPIOButton::buttonUp() const
+{
+  return buttonUp_;
+}
+
+bool GPIOButton::heldActivate() const
+{
+  return heldActivate_;
+}
+
+// -- cpp/LedStripWs2812b.hpp --
+
+LedStripWs2812b::LedStripWs2812b(uint pin) :
+  pin_(pin)
+{
+}
+
+void LedStripWs2812b::writeColors(const LEDBuffer& buffer)
+{
+  sim::busyWait(buffer.size() * UsPerLed + LatchUs);
+  sim::ledFrameWritten(buffer.size());
+}
@@ -0,0 +1,410 @@
+// Simulated pico-sdk: time, stdio, RTC, multicore, mutexes and flash
+
+#include "Sim.hpp"
+
+#include <hardware/clocks.h>
+#include <hardware/flash.h>
+#include <hardware/rtc.h>
+#include <hardware/structs/systick.h>
+#include <hardware/sync.h>
+#include <hardware/watchdog.h>
+#include <pico/bootrom.h>
+#include <pico/multicore.h>
+#include <pico/mutex.h>
+#include <pico/stdlib.h>
+#include <pico/unique_id.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+
+namespace
+{
+  bool rtcRunning = false;
+  time_t rtcBaseSecs = 0;
+  uint64_t rtcBaseUs = 0;
+
+  // Typical W25Q16JV timings
+  constexpr uint64_t SectorEraseUs = 45000;
+  constexpr uint64_t PageProgramUs = 700;
+
+  constexpr uint32_t SysClockHz = 125000000;
+}
+
+// -- pico.h --
+
+uint get_core_num()
+{
+  int core = sim::currentCore() < 0 ? sim::interruptCore() : sim::currentCore();
+  return core == 1 ? 1 : 0;
+}
+
+void tight_loop_contents()
+{
+  // Spinning on a simulated core must let the clock move or nothing
+  // it could be waiting for would ever happen
+  sim::busyWait(1);
+}
+
+// -- pico/time.h --
+
+absolute_time_t get_absolute_time()
+{
+  return sim::now();
+}
+
+uint64_t time_us_64()
+{
+  return sim::now();
+}
+
+uint32_t time_us_32()
+{
+  return (uint32_t)sim::now();
+}
+
+void sleep_until(absolute_time_t t)
+{
+  sim::sleepUntil(t);
+}
+
+void sleep_us(uint64_t us)
+{
+  sim::sleepUntil(delayed_by_us(sim::now(), us));
+}
+
+void sleep_ms(uint32_t ms)
+{
+  sleep_us((uint64_t)ms * 1000ull);
+}
+
+void busy_wait_us(uint64_t us)
+{
+  sim::busyWait(us);
+}
+
+// -- pico/stdio.h --
+
+bool stdio_init_all()
+{
+  return true;
+}
+
+int getchar_timeout_us(uint32_t timeout_us)
+{
+  int c = sim::readSerial();
+  if (c < 0 && timeout_us > 0)
+  {
+    sleep_us(timeout_us);
+    c = sim::readSerial();
+  }
+  return c < 0 ? PICO_ERROR_TIMEOUT : c;
+}
+
+void stdio_set_chars_available_callback(void (*fn)(void*), void* param)
+{
+  if (fn)
+  {
+    sim::watchSerial([fn, param]{ fn(param); });
+  }
+  else
+  {
+    sim::watchSerial(nullptr);
+  }
+}
+
+int putchar_raw(int c)
+{
+  // The serial console is stdout, which cout shares
+  return putchar(c);
+}
+
+void stdio_flush()
+{
+  fflush(stdout);
+}
+
+// -- hardware/sync.h --
+
+uint32_t save_and_disable_interrupts()
+{
+  return sim::setInterruptsEnabled(false) ? 1 : 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+  sim::setInterruptsEnabled(status != 0);
+}
+
+void __wfe()
+{
+  sim::waitForEvent();
+}
+
+void __sev()
+{
+  sim::signalEvent();
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp)
+{
+  sim::waitForEvent(timeout_timestamp);
+  return sim::now() >= timeout_timestamp;
+}
+
+// -- hardware/clocks.h, hardware/structs/systick.h --
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+  return SysClockHz;
+}
+
+systick_hw_t simSystick = {};
+
+SimSystickCvr::operator uint32_t() const
+{
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  return 0xffffff - (uint32_t)(ns * (SysClockHz / 1000000) / 1000 & 0xffffff);
+}
+
+// -- alarms --
+
+namespace
+{
+  struct Alarm
+  {
+    sim::EventId event;
+    absolute_time_t target;
+    alarm_callback_t callback;
+    void* userData;
+    int core;
+  };
+
+  std::map<alarm_id_t, Alarm> alarms;
+  alarm_id_t nextAlarmId = 1;
+
+  void fireAlarm(alarm_id_t id)
+  {
+    auto it = alarms.find(id);
+    if (it == alarms.end()) return;
+    Alarm alarm = it->second;
+    alarms.erase(it);
+    int64_t reschedule = alarm.callback(id, alarm.userData);
+    if (reschedule != 0)
+    {
+      // Positive is relative to when it was meant to fire, negative to now
+      absolute_time_t next = reschedule > 0 ? delayed_by_us(alarm.target, reschedule) : delayed_by_us(sim::now(), -reschedule);
+      alarm.target = next;
+      alarm.event = sim::at(next, [id]{ fireAlarm(id); }, alarm.core);
+      alarms[id] = alarm;
+    }
+  }
+}
+
+struct alarm_pool
+{
+  int core;
+};
+
+namespace
+{
+  // The default pool's timer interrupt is core 0's
+  alarm_pool_t defaultPool {0};
+
+  alarm_id_t addAlarm(alarm_pool_t* pool, absolute_time_t time, alarm_callback_t callback, void* user_data,
+                      bool fire_if_past)
+  {
+    if (time <= sim::now())
+    {
+      if (!fire_if_past)
+      {
+        return 0;
+      }
+    }
+    alarm_id_t id = nextAlarmId++;
+    alarms[id] = {sim::at(time, [id]{ fireAlarm(id); }, pool->core), time, callback, user_data, pool->core};
+    return id;
+  }
+}
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void* user_data, bool fire_if_past)
+{
+  return addAlarm(&defaultPool, time, callback, user_data, fire_if_past);
+}
+
+alarm_pool_t* alarm_pool_create_with_unused_hardware_alarm(uint max_timers)
+{
+  return new alarm_pool_t {(int)get_core_num()};
+}
+
+alarm_id_t alarm_pool_add_alarm_in_us(alarm_pool_t* pool, uint64_t us, alarm_callback_t callback, void* user_data,
+                                      bool fire_if_past)
+{
+  return addAlarm(pool, delayed_by_us(sim::now(), us), callback, user_data, fire_if_past);
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void* user_data, bool fire_if_past)
+{
+  return add_alarm_at(delayed_by_us(sim::now(), us), callback, user_data, fire_if_past);
+}
+
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void* user_data, bool fire_if_past)
+{
+  return add_alarm_in_us((uint64_t)ms * 1000ull, callback, user_data, fire_if_past);
+}
+
+bool cancel_alarm(alarm_id_t alarm_id)
+{
+  auto it = alarms.find(alarm_id);
+  if (it == alarms.end())
+  {
+    return false;
+  }
+  sim::cancel(it->second.event);
+  alarms.erase(it);
+  return true;
+}
+
+// -- hardware/rtc.h --
+
+void rtc_init()
+{
+  rtcRunning = false;
+}
+
+bool rtc_set_datetime(const datetime_t* t)
+{
+  tm tmv {};
+  tmv.tm_year = t->year - 1900;
+  tmv.tm_mon = t->month - 1;
+  tmv.tm_mday = t->day;
+  tmv.tm_hour = t->hour;
+  tmv.tm_min = t->min;
+  tmv.tm_sec = t->sec;
+  rtcBaseSecs = timegm(&tmv);
+  rtcBaseUs = sim::now();
+  rtcRunning = true;
+  return true;
+}
+
+bool rtc_get_datetime(datetime_t* t)
+{
+  if (!rtcRunning)
+  {
+    return false;
+  }
+  time_t secs = rtcBaseSecs + (time_t)((sim::now() - rtcBaseUs) / 1000000ull);
+  tm tmv;
+  gmtime_r(&secs, &tmv);
+  t->year = (int16_t)(tmv.tm_year + 1900);
+  t->month = (int8_t)(tmv.tm_mon + 1);
+  t->day = (int8_t)tmv.tm_mday;
+  t->dotw = (int8_t)tmv.tm_wday;
+  t->hour = (int8_t)tmv.tm_hour;
+  t->min = (int8_t)tmv.tm_min;
+  t->sec = (int8_t)tmv.tm_sec;
+  return true;
+}
+
+bool rtc_running()
+{
+  return rtcRunning;
+}
+
+// -- hardware/watchdog.h, pico/bootrom.h --
+
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms)
+{
+  sim::exit("watchdog reboot");
+}
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask)
+{
+  sim::exit("reboot to usb bootloader");
+}
+
+void pico_get_unique_board_id(pico_unique_board_id_t* id_out)
+{
+  static const uint8_t simId[PICO_UNIQUE_BOARD_ID_SIZE_BYTES] = {'s', 'i', 'l', 'v', 's', 'i', 'm', '0'};
+  memcpy(id_out->id, simId, sizeof(simId));
+}
+
+// -- pico/multicore.h --
+
+void multicore_launch_core1(void (*entry)(void))
+{
+  sim::launchCore1(entry);
+}
+
+void multicore_reset_core1()
+{
+  sim::resetCore1();
+}
+
+void multicore_lockout_victim_init()
+{
+}
+
+void multicore_lockout_start_blocking()
+{
+  sim::lockoutCore1(true);
+}
+
+void multicore_lockout_end_blocking()
+{
+  sim::lockoutCore1(false);
+}
+
+// -- pico/mutex.h --
+
+void mutex_init(mutex_t* mtx)
+{
+  mtx->owner = -1;
+}
+
+void mutex_enter_blocking(mutex_t* mtx)
+{
+  uint32_t owner;
+  while (!mutex_try_enter(mtx, &owner))
+  {
+    tight_loop_contents();
+  }
+}
+
+bool mutex_try_enter(mutex_t* mtx, uint32_t* owner_out)
+{
+  if (mtx->owner >= 0)
+  {
+    if (owner_out) *owner_out = (uint32_t)mtx->owner;
+    return false;
+  }
+  mtx->owner = (int)get_core_num();
+  return true;
+}
+
+void mutex_exit(mutex_t* mtx)
+{
+  mtx->owner = -1;
+}
+
+// -- hardware/flash.h --
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+  memset(sim::flashImage() + flash_offs, 0xff, count);
+  sim::busyWait((count + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE * SectorEraseUs);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count)
+{
+  // NOR flash can only clear bits
+  uint8_t* dst = sim::flashImage() + flash_offs;
+  for (size_t i = 0; i < count; ++i)
+  {
+    dst[i] &= data[i];
+  }
+  sim::busyWait((count + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * PageProgramUs);
+}
@@ -0,0 +1,116 @@
+// Cost of finding a channel's next event in the schedule table, with the
+// sorted index against scanning every entry and every day it's on, at a
+// few table sizes. The index should cost about the same however many
+// entries there are.
+
+#include "Bench.hpp"
+#include "Sim.hpp"
+
+#include <FlashScheduler.hpp>
+#include <Schedule.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace
+{
+  // Spread entries over every pump and light, on different days and times
+  void fill(Schedule& schedule, size_t count)
+  {
+    memset(sim::flashImage(), 0xff, sim::flashSize());
+    schedule.readFromFlash();
+    for (size_t i = 0; schedule.size() < count; ++i)
+    {
+      ScheduleEntry entry {};
+      entry.action = (ScheduleAction)(i % (size_t)ScheduleAction::Count);
+      entry.channel = (uint8_t)(i / 3 % (entry.action == ScheduleAction::Water ? Settings::PumpCount : Settings::LightCount));
+      entry.weekdays = (uint8_t)(i * 37 % Schedule::EveryDay + 1);
+      entry.time = (int32_t)(i * 7919 % Schedule::SecondsPerDay);
+      entry.amount = 50.0f;
+      schedule.add(entry);
+      FlashScheduler::flush();
+    }
+  }
+
+  // What next() would take without the index
+  const ScheduleEntry* scan(const Schedule& schedule, ScheduleAction action, uint8_t channel, uint32_t weekSecond,
+                            uint32_t& at)
+  {
+    const ScheduleEntry* best = nullptr;
+    uint32_t bestWait = 0;
+    for (size_t i = 0; i < schedule.size(); ++i)
+    {
+      const ScheduleEntry& entry = schedule.entry(i);
+      if (entry.action != action || entry.channel != channel)
+      {
+        continue;
+      }
+      for (uint32_t day = 0; day < 7; ++day)
+      {
+        if (entry.weekdays & (1u << day))
+        {
+          uint32_t when = day * Schedule::SecondsPerDay + (uint32_t)entry.time;
+          uint32_t wait = (when + Schedule::SecondsPerWeek - weekSecond - 1) % Schedule::SecondsPerWeek;
+          if (!best || wait < bestWait)
+          {
+            best = &entry;
+            bestWait = wait;
+            at = when;
+          }
+        }
+      }
+    }
+    return best;
+  }
+
+  std::string entries(size_t n)
+  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%zu entries", n);
+    return buf;
+  }
+}
+
+namespace bench
+{
+  void schedule()
+  {
+    static Schedule table;
+    printf("  (in RAM: %zu bytes)\n", sizeof(Schedule));
+
+    for (size_t count : {4, 32, 256})
+    {
+      fill(table, count);
+
+      // Every channel of every action, at times through the week
+      constexpr uint64_t Lookups = 64;
+      volatile uint32_t sink = 0;
+      auto lookups = [&](auto find)
+      {
+        return [&, find]
+        {
+          for (uint64_t i = 0; i < Lookups; ++i)
+          {
+            ScheduleAction action = (ScheduleAction)(i % (uint64_t)ScheduleAction::Count);
+            uint32_t at = 0;
+            find(action, (uint8_t)(i / 3 % Settings::LightCount), (uint32_t)(i * 9973 % Schedule::SecondsPerWeek), at);
+            sink = sink + at;
+          }
+        };
+      };
+
+      Result r = measure(Lookups, lookups([&](ScheduleAction action, uint8_t channel, uint32_t weekSecond, uint32_t& at)
+      {
+        return scan(table, action, channel, weekSecond, at);
+      }));
+      report("next event: scan " + std::to_string(count), r, entries(table.size()));
+
+      r = measure(Lookups, lookups([&](ScheduleAction action, uint8_t channel, uint32_t weekSecond, uint32_t& at)
+      {
+        return table.next(action, channel, weekSecond, at);
+      }));
+      report("next event: index " + std::to_string(count), r, entries(table.size()));
+    }
+  }
+}
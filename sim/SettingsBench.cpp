@@ -0,0 +1,109 @@
+// Cost of saving and loading the settings: how many bytes of flash a
+// snapshot and a one field commit take, and how long SettingsStore spends
+// building a commit and replaying the log at boot. The flash itself is the
+// simulated one, so the times are the CPU's share only.
+
+#include "Bench.hpp"
+#include "Sim.hpp"
+
+#include <FlashScheduler.hpp>
+#include <Settings.hpp>
+#include <SettingsStore.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace
+{
+  // Commits in the log when timing a replay
+  constexpr int ReplayCommits = 16;
+
+  // Back to a board that's never been flashed
+  void eraseFlash()
+  {
+    memset(sim::flashImage(), 0xff, sim::flashSize());
+  }
+
+  void typicalSettings(Settings& settings)
+  {
+    settings.setDefaults();
+    strcpy(settings.wifiSsid, "my home network");
+    strcpy(settings.wifiPassword, "correct horse battery");
+    settings.pumps[1].enable = true;
+    settings.pumps[1].rate = 2.5f;
+    settings.lights[1].enable = true;
+  }
+
+  // Change one field, back and forth
+  void touch(Settings& settings, int i)
+  {
+    settings.pumps[1].rate = i % 2 ? 3.5f : 2.5f;
+  }
+
+  std::string bytes(const char* what, double n)
+  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.0f bytes %s", n, what);
+    return buf;
+  }
+}
+
+namespace bench
+{
+  void store()
+  {
+    printf("  (in RAM: %zu bytes)\n", sizeof(Settings));
+
+    eraseFlash();
+
+    // A store that has never written anything starts its first sector with
+    // a snapshot
+    Result r = measure(1, []
+    {
+      SettingsStore store;
+      typicalSettings(store.data);
+      store.writeToFlash();
+      FlashScheduler::flush();
+    });
+    SettingsStore snapshot;
+    typicalSettings(snapshot.data);
+    snapshot.writeToFlash();
+    FlashScheduler::flush();
+    report("write: snapshot", r, bytes("per snapshot", snapshot.stats().bytesWritten));
+
+    // Then a field at a time, with a compaction whenever the sector fills
+    SettingsStore store;
+    store.readFromFlash();
+    int i = 0;
+    store.resetStats();
+    r = measure(1, [&]
+    {
+      touch(store.data, i++);
+      store.writeToFlash();
+      FlashScheduler::flush();
+    });
+    SettingsStore::Stats stats = store.stats();
+    report("write: one field changed", r, bytes("per commit", (double)stats.bytesWritten / stats.commits));
+
+    // Boot with a snapshot and a few commits after it
+    eraseFlash();
+    SettingsStore filled;
+    typicalSettings(filled.data);
+    filled.writeToFlash();
+    for (int c = 0; c < ReplayCommits; ++c)
+    {
+      touch(filled.data, c);
+      filled.writeToFlash();
+    }
+    FlashScheduler::flush();
+    r = measure(1, []
+    {
+      SettingsStore boot;
+      boot.readFromFlash();
+    });
+    SettingsStore boot;
+    boot.readFromFlash();
+    report("read: replay", r, bytes("in the active sector", boot.used()));
+  }
+}
@@ -0,0 +1,652 @@
+#include "Sim.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <unordered_set>
+#include <poll.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace sim
+{
+  namespace
+  {
+    struct Core
+    {
+      ucontext_t ctx;
+      std::unique_ptr<char[]> stack;
+      void (*entry)() = nullptr;
+      uint64_t wakeUs = 0;
+      bool running = false;
+      bool event = false;
+      bool waitingForEvent = false;
+    };
+
+    struct TimedEvent
+    {
+      uint64_t us;
+      EventId id;
+      std::function<void()> fn;
+      int core;
+    };
+
+    struct Later
+    {
+      bool operator()(const TimedEvent& a, const TimedEvent& b) const
+      {
+        return a.us > b.us || (a.us == b.us && a.id > b.id);
+      }
+    };
+
+    struct OutputStats
+    {
+      bool value = false;
+      uint64_t lastChangeUs = 0;
+      uint64_t onUs = 0;
+      uint64_t onCount = 0;
+    };
+
+    constexpr size_t StackSize = 1024 * 1024;
+    constexpr size_t FlashSize = 2 * 1024 * 1024;
+
+    Options opts;
+    Core cores[2];
+    int current = -1;
+    ucontext_t schedulerCtx;
+    uint64_t nowUs = 0;
+    bool core1LockedOut = false;
+    std::priority_queue<TimedEvent, std::vector<TimedEvent>, Later> events;
+    std::unordered_set<EventId> cancelled;
+    EventId nextEventId = 1;
+    std::chrono::steady_clock::time_point wallStart;
+    uint64_t ledFrames = 0;
+    uint64_t ledErrors = 0;
+
+    // Checking stdin costs a syscall, so in fast-forward it's only looked
+    // at once per StdinCheckUs of virtual time
+    constexpr uint64_t StdinCheckUs = 1000;
+    std::function<void()> serialReadable;
+    bool stdinNotified = false;
+    bool stdinEof = false;
+    uint64_t nextStdinCheckUs = 0;
+    std::string injected;
+    bool interruptsEnabled = true;
+    int interruptOn = -1;
+
+    std::map<unsigned, OutputStats>& outputs()
+    {
+      // Outputs register from static constructors, so this can't be a plain global
+      static std::map<unsigned, OutputStats> o;
+      return o;
+    }
+
+    std::vector<uint8_t>& flash()
+    {
+      static std::vector<uint8_t> f(FlashSize, 0xff);
+      return f;
+    }
+
+    void coreMain()
+    {
+      Core& core = cores[current];
+      core.entry();
+      core.running = false;
+      if (&core == &cores[0])
+      {
+        sim::exit("main() returned");
+      }
+      swapcontext(&core.ctx, &schedulerCtx);
+    }
+
+    void startCore(int num, void (*entry)())
+    {
+      Core& core = cores[num];
+      if (!core.stack)
+      {
+        core.stack = std::make_unique<char[]>(StackSize);
+      }
+      getcontext(&core.ctx);
+      core.ctx.uc_stack.ss_sp = core.stack.get();
+      core.ctx.uc_stack.ss_size = StackSize;
+      core.ctx.uc_link = nullptr;
+      makecontext(&core.ctx, coreMain, 0);
+      core.entry = entry;
+      core.wakeUs = nowUs;
+      core.running = true;
+    }
+
+    bool runnable(int num)
+    {
+      return cores[num].running && !(num == 1 && core1LockedOut);
+    }
+
+    void loadFlash()
+    {
+      if (opts.flashFile.empty()) return;
+      std::ifstream f(opts.flashFile, std::ios::binary);
+      if (f)
+      {
+        f.read((char*)flash().data(), flash().size());
+      }
+    }
+
+    void saveFlash()
+    {
+      if (opts.flashFile.empty()) return;
+      std::ofstream f(opts.flashFile, std::ios::binary | std::ios::trunc);
+      f.write((const char*)flash().data(), flash().size());
+    }
+
+    void printSummary(const std::string& reason)
+    {
+      double wallSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+      double simDays = (double)nowUs / (double)UsPerDay;
+      fprintf(stderr, "sim: %s at %s\n", reason.c_str(), formatTime(nowUs).c_str());
+      fprintf(stderr, "sim: %.3f simulated days in %.3f s (%.1f days/s)\n", simDays, wallSecs, wallSecs > 0.0 ? simDays / wallSecs : 0.0);
+      for (auto& [pin, out] : outputs())
+      {
+        uint64_t onUs = out.onUs + (out.value ? nowUs - out.lastChangeUs : 0);
+        fprintf(stderr, "sim: GP%u switched on %llu times, on for %.3f s total\n", pin, (unsigned long long)out.onCount, (double)onUs / 1e6);
+      }
+      fprintf(stderr, "sim: %llu LED frames written\n", (unsigned long long)ledFrames);
+      if (ledErrors > 0)
+      {
+        fprintf(stderr, "sim: %llu LED protocol errors\n", (unsigned long long)ledErrors);
+      }
+    }
+
+    bool stdinWatched()
+    {
+      return serialReadable && !stdinNotified && !stdinEof;
+    }
+
+    bool pollStdin(int timeoutMs)
+    {
+      pollfd pfd {STDIN_FILENO, POLLIN, 0};
+      return poll(&pfd, 1, timeoutMs) == 1;
+    }
+
+    void interrupt(const std::function<void()>& fn, int core = 0)
+    {
+      int was = interruptOn;
+      interruptOn = core;
+      fn();
+      interruptOn = was;
+      // Taking an interrupt wakes a core out of WFE
+      signalEvent();
+    }
+
+    void notifyStdin()
+    {
+      stdinNotified = true;
+      interrupt(serialReadable);
+    }
+
+    void injectCommand(const std::string& line)
+    {
+      injected += line;
+      injected += '\n';
+      if (serialReadable)
+      {
+        serialReadable();
+      }
+    }
+
+    // Block the wall clock until virtual time next, returning early (with
+    // the virtual clock caught up to the wall clock) if stdin gets input
+    bool waitWallClock(uint64_t next)
+    {
+      auto deadline = wallStart + std::chrono::microseconds(next);
+      while (stdinWatched())
+      {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+        {
+          return false;
+        }
+        if (pollStdin((int)std::min<int64_t>(remaining.count(), 1000)))
+        {
+          uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wallStart).count();
+          nowUs = std::clamp(elapsed, nowUs, next);
+          notifyStdin();
+          return true;
+        }
+      }
+      std::this_thread::sleep_until(deadline);
+      return false;
+    }
+
+    int (*coreZeroMain)() = nullptr;
+
+    [[noreturn]] void run()
+    {
+      wallStart = std::chrono::steady_clock::now();
+      startCore(0, []{ coreZeroMain(); });
+      for (const TimedCommand& cmd : opts.commands)
+      {
+        at(cmd.atUs, [line = cmd.line]{ injectCommand(line); });
+      }
+
+      while (true)
+      {
+        uint64_t next = Forever;
+        int who = -2;
+        if (!events.empty() && interruptsEnabled)
+        {
+          next = events.top().us;
+          who = -1;
+        }
+        for (int c = 0; c < 2; ++c)
+        {
+          if (runnable(c) && cores[c].wakeUs < next)
+          {
+            next = cores[c].wakeUs;
+            who = c;
+          }
+        }
+
+        if (who == -2)
+        {
+          sim::exit("nothing left to run");
+        }
+        if (next >= opts.runForUs)
+        {
+          nowUs = opts.runForUs;
+          sim::exit("run time reached");
+        }
+
+        if (opts.realtime && next > nowUs)
+        {
+          if (waitWallClock(next))
+          {
+            continue;
+          }
+        }
+        else if (stdinWatched() && nowUs >= nextStdinCheckUs)
+        {
+          nextStdinCheckUs = nowUs + StdinCheckUs;
+          if (pollStdin(0))
+          {
+            notifyStdin();
+            continue;
+          }
+        }
+        nowUs = std::max(nowUs, next);
+
+        if (who == -1)
+        {
+          TimedEvent ev = events.top();
+          events.pop();
+          if (cancelled.erase(ev.id) == 0)
+          {
+            interrupt(ev.fn, ev.core);
+          }
+        }
+        else
+        {
+          current = who;
+          swapcontext(&schedulerCtx, &cores[who].ctx);
+          current = -1;
+        }
+      }
+    }
+
+    uint64_t parseDuration(const char* s)
+    {
+      return (uint64_t)(strtod(s, nullptr) * 1e6);
+    }
+
+    void usage(const char* argv0)
+    {
+      fprintf(stderr,
+        "usage: %s [options]\n"
+        "Runs the silvanus-pico firmware against a simulated Pico W. The serial\n"
+        "console is stdin/stdout, simulator messages go to stderr.\n"
+        "\n"
+        "  --days <n>          run n simulated days as fast as possible, then exit\n"
+        "  --seconds <n>       run n simulated seconds as fast as possible, then exit\n"
+        "  --realtime          pace the virtual clock to the wall clock (default\n"
+        "                      unless --days or --seconds is given)\n"
+        "  --epoch <secs>      UTC unix time at boot (default %lld)\n"
+        "  --no-wifi           the access point is never in range\n"
+        "  --wifi-outage <s>+<secs>\n"
+        "                      take the access point away at s seconds after\n"
+        "                      boot for secs seconds\n"
+        "  --skew <ppm>        the pico's crystal runs ppm fast (negative: slow)\n"
+        "                      compared to the time server\n"
+        "  --press <pin>@<s>[+<ms>]\n"
+        "                      press the button on GPIO pin at s seconds after\n"
+        "                      boot and hold it for ms milliseconds (default 100)\n"
+        "  --at <s> <line>     send a line to the serial console at s seconds\n"
+        "                      after boot\n"
+        "  --trace-io          log every output pin transition\n"
+        "  --flash <file>      back the flash with a file that survives between runs\n"
+        "  --led-check         run a check of the LED driver's frame hand-off\n"
+        "                      instead of the firmware\n",
+        argv0, (long long)Options{}.epochSecs);
+    }
+
+    void parseArgs(int argc, char** argv)
+    {
+      bool realtimeSet = false;
+      for (int i = 1; i < argc; ++i)
+      {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ((arg == "--days") && hasValue)
+        {
+          opts.runForUs = (uint64_t)(strtod(argv[++i], nullptr) * (double)UsPerDay);
+          if (!realtimeSet) opts.realtime = false;
+        }
+        else if (arg == "--seconds" && hasValue)
+        {
+          opts.runForUs = parseDuration(argv[++i]);
+          if (!realtimeSet) opts.realtime = false;
+        }
+        else if (arg == "--realtime")
+        {
+          opts.realtime = true;
+          realtimeSet = true;
+        }
+        else if (arg == "--epoch" && hasValue)
+        {
+          opts.epochSecs = strtoll(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--no-wifi")
+        {
+          opts.wifiOk = false;
+        }
+        else if (arg == "--wifi-outage" && hasValue)
+        {
+          const char* spec = argv[++i];
+          const char* plus = strchr(spec, '+');
+          if (!plus)
+          {
+            usage(argv[0]);
+            std::exit(2);
+          }
+          uint64_t startUs = parseDuration(spec);
+          opts.wifiOutages.push_back({startUs, startUs + parseDuration(plus + 1)});
+        }
+        else if (arg == "--skew" && hasValue)
+        {
+          opts.skewPpm = strtod(argv[++i], nullptr);
+        }
+        else if (arg == "--press" && hasValue)
+        {
+          const char* spec = argv[++i];
+          const char* atSign = strchr(spec, '@');
+          if (!atSign)
+          {
+            usage(argv[0]);
+            std::exit(2);
+          }
+          const char* plus = strchr(atSign, '+');
+          Press p;
+          p.pin = (unsigned)strtoul(spec, nullptr, 10);
+          p.startUs = parseDuration(atSign + 1);
+          p.endUs = p.startUs + (plus ? strtoull(plus + 1, nullptr, 10) : 100ull) * 1000ull;
+          opts.presses.push_back(p);
+        }
+        else if (arg == "--at" && i + 2 < argc)
+        {
+          uint64_t atUs = parseDuration(argv[++i]);
+          opts.commands.push_back({atUs, argv[++i]});
+        }
+        else if (arg == "--trace-io")
+        {
+          opts.traceIo = true;
+        }
+        else if (arg == "--flash" && hasValue)
+        {
+          opts.flashFile = argv[++i];
+        }
+        else if (arg == "--led-check")
+        {
+          opts.ledCheck = true;
+          if (!realtimeSet) opts.realtime = false;
+        }
+        else
+        {
+          usage(argv[0]);
+          std::exit(arg == "--help" || arg == "-h" ? 0 : 2);
+        }
+      }
+    }
+  }
+
+  const Options& options()
+  {
+    return opts;
+  }
+
+  uint64_t now()
+  {
+    return nowUs;
+  }
+
+  uint64_t wallUs()
+  {
+    // The virtual clock is the pico's timer, so with a skewed crystal the
+    // real time runs that much slower than it
+    int64_t skewUs = (int64_t)((double)nowUs * opts.skewPpm / 1e6);
+    return (uint64_t)opts.epochSecs * 1000000ull + nowUs - skewUs;
+  }
+
+  int currentCore()
+  {
+    return current;
+  }
+
+  int interruptCore()
+  {
+    return current < 0 ? interruptOn : -1;
+  }
+
+  void sleepUntil(uint64_t us)
+  {
+    if (current < 0)
+    {
+      nowUs = std::max(nowUs, us);
+      return;
+    }
+    Core& core = cores[current];
+    core.wakeUs = std::max(us, nowUs);
+    swapcontext(&core.ctx, &schedulerCtx);
+  }
+
+  void busyWait(uint64_t us)
+  {
+    sleepUntil(nowUs + us);
+  }
+
+  void waitForEvent(uint64_t untilUs)
+  {
+    if (current < 0)
+    {
+      return;
+    }
+    Core& core = cores[current];
+    if (!core.event)
+    {
+      core.waitingForEvent = true;
+      sleepUntil(untilUs);
+      core.waitingForEvent = false;
+    }
+    core.event = false;
+  }
+
+  void signalEvent()
+  {
+    for (Core& core : cores)
+    {
+      core.event = true;
+      if (core.waitingForEvent)
+      {
+        core.wakeUs = nowUs;
+      }
+    }
+  }
+
+  bool setInterruptsEnabled(bool enabled)
+  {
+    bool was = interruptsEnabled;
+    interruptsEnabled = enabled;
+    return was;
+  }
+
+  void watchSerial(std::function<void()> onReadable)
+  {
+    serialReadable = std::move(onReadable);
+    stdinNotified = false;
+  }
+
+  int readSerial()
+  {
+    if (!injected.empty())
+    {
+      unsigned char c = injected.front();
+      injected.erase(0, 1);
+      return c;
+    }
+    if (!stdinEof)
+    {
+      pollfd pfd {STDIN_FILENO, POLLIN, 0};
+      bool ready = poll(&pfd, 1, 0) == 1;
+      unsigned char c;
+      if (ready && (pfd.revents & POLLIN) && read(STDIN_FILENO, &c, 1) == 1)
+      {
+        return c;
+      }
+      // Readable with nothing to read means the input has ended
+      stdinEof = ready;
+      stdinNotified = false;
+    }
+    return -1;
+  }
+
+  EventId at(uint64_t us, std::function<void()> fn, int core)
+  {
+    EventId id = nextEventId++;
+    events.push({std::max(us, nowUs), id, std::move(fn), core});
+    return id;
+  }
+
+  bool cancel(EventId id)
+  {
+    return cancelled.insert(id).second;
+  }
+
+  void launchCore1(void (*entry)())
+  {
+    startCore(1, entry);
+  }
+
+  void resetCore1()
+  {
+    cores[1].running = false;
+  }
+
+  void lockoutCore1(bool lockedOut)
+  {
+    core1LockedOut = lockedOut;
+  }
+
+  void exit(const std::string& reason, int code)
+  {
+    std::cout << std::flush;
+    printSummary(reason);
+    saveFlash();
+    std::_Exit(code);
+  }
+
+  void outputChanged(unsigned pin, bool value)
+  {
+    OutputStats& out = outputs()[pin];
+    if (out.value == value) return;
+    if (value)
+    {
+      out.onCount++;
+    }
+    else
+    {
+      out.onUs += nowUs - out.lastChangeUs;
+    }
+    out.value = value;
+    out.lastChangeUs = nowUs;
+    if (opts.traceIo)
+    {
+      fprintf(stderr, "sim: [%s] GP%u -> %d\n", formatTime(nowUs).c_str(), pin, value ? 1 : 0);
+    }
+  }
+
+  bool inputLevel(unsigned pin)
+  {
+    // Inputs are pulled up and pressing a button shorts them to ground
+    for (const Press& p : opts.presses)
+    {
+      if (p.pin == pin && nowUs >= p.startUs && nowUs < p.endUs)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void ledFrameWritten(size_t numLeds)
+  {
+    ledFrames++;
+  }
+
+  void ledProtocolError(const std::string& what)
+  {
+    // Say what went wrong the first few times, then just count
+    if (ledErrors++ < 10)
+    {
+      fprintf(stderr, "sim: %s LED protocol error: %s\n", formatTime(nowUs).c_str(), what.c_str());
+    }
+  }
+
+  uint64_t ledErrorCount()
+  {
+    return ledErrors;
+  }
+
+  uint8_t* flashImage()
+  {
+    return flash().data();
+  }
+
+  size_t flashSize()
+  {
+    return flash().size();
+  }
+
+  std::string formatTime(uint64_t us)
+  {
+    char buf[64];
+    uint64_t secs = us / 1000000ull;
+    snprintf(buf, sizeof(buf), "%llu+%02u:%02u:%02u.%06u",
+             (unsigned long long)(us / UsPerDay),
+             (unsigned)(secs / 3600 % 24), (unsigned)(secs / 60 % 60), (unsigned)(secs % 60),
+             (unsigned)(us % 1000000ull));
+    return buf;
+  }
+
+  void runFirmware(int argc, char** argv, int (*firmwareMain)())
+  {
+    coreZeroMain = firmwareMain;
+    parseArgs(argc, argv);
+    loadFlash();
+    run();
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// The simulation kernel behind the host stand-ins for the pico-sdk and
+// pi-pico-cpp headers in sim/include.
+//
+// Time is virtual. Both cores are cooperative contexts that only give up
+// control when they sleep (or busy wait on simulated hardware), and the
+// clock jumps straight to whatever happens next: a core waking up or a
+// timed event firing. Timed events run in "interrupt context" between the
+// cores, which is where the simulated alarms, network replies and so on
+// live. A simulated day therefore only costs as much as the work done in it.
+namespace sim
+{
+  constexpr uint64_t Forever = UINT64_MAX;
+  constexpr uint64_t UsPerDay = 24ull * 60ull * 60ull * 1000000ull;
+
+  struct Press
+  {
+    unsigned pin;
+    uint64_t startUs;
+    uint64_t endUs;
+  };
+
+  struct Outage
+  {
+    uint64_t startUs;
+    uint64_t endUs;
+  };
+
+  struct TimedCommand
+  {
+    uint64_t atUs;
+    std::string line;
+  };
+
+  struct Options
+  {
+    uint64_t runForUs = Forever;
+    bool realtime = true;
+    int64_t epochSecs = 1767268800; // 2026-01-01 12:00:00 UTC
+    bool wifiOk = true;
+    std::vector<Outage> wifiOutages;
+    double skewPpm = 0.0;
+    bool traceIo = false;
+    std::string flashFile;
+    bool ledCheck = false;
+    std::vector<Press> presses;
+    std::vector<TimedCommand> commands;
+  };
+
+  const Options& options();
+
+  // Virtual microseconds since boot
+  uint64_t now();
+
+  // Simulated UTC microseconds since the unix epoch, i.e. the "real" time
+  // a time server on the simulated network hands out
+  uint64_t wallUs();
+
+  // 0 or 1 when running on a core, -1 in interrupt context
+  int currentCore();
+
+  // In interrupt context, the core the interrupt was taken on, else -1
+  int interruptCore();
+
+  // Block the calling core until the given virtual time. In interrupt
+  // context this just moves the clock forward.
+  void sleepUntil(uint64_t us);
+
+  // Hardware the calling core waits on (PIO shifting, flash programming...)
+  void busyWait(uint64_t us);
+
+  // WFE/SEV. Waiting returns early when any core signals an event or an
+  // interrupt runs, just like the real thing.
+  void waitForEvent(uint64_t untilUs = Forever);
+  void signalEvent();
+
+  // Run fn in interrupt context at the given virtual time, as an interrupt
+  // taken on core. The default alarm pool's timer and most peripherals
+  // interrupt core 0.
+  using EventId = uint64_t;
+  EventId at(uint64_t us, std::function<void()> fn, int core = 0);
+  bool cancel(EventId id);
+
+  // Timed events don't run while interrupts are disabled, they run late
+  // once interrupts are enabled again
+  bool setInterruptsEnabled(bool enabled);
+
+  // Serial input comes from stdin and from lines injected with --at.
+  // onReadable runs in interrupt context when there is unread input.
+  void watchSerial(std::function<void()> onReadable);
+  int readSerial();
+
+  void launchCore1(void (*entry)());
+  void resetCore1();
+  void lockoutCore1(bool lockedOut);
+
+  // Parse the command line and run firmwareMain on core 0 until the run ends
+  [[noreturn]] void runFirmware(int argc, char** argv, int (*firmwareMain)());
+
+  // Print the run summary and leave the simulator
+  [[noreturn]] void exit(const std::string& reason, int code = 0);
+
+  // Peripherals
+  void outputChanged(unsigned pin, bool value);
+  bool inputLevel(unsigned pin);
+  void ledFrameWritten(size_t numLeds);
+  // The LED driver broke the strip's protocol, e.g. tore a frame
+  void ledProtocolError(const std::string& what);
+  uint64_t ledErrorCount();
+  uint8_t* flashImage();
+  size_t flashSize();
+
+  // "d+hh:mm:ss.uuuuuu" for log lines
+  std::string formatTime(uint64_t us);
+}
@@ -0,0 +1,20 @@
+#include "Sim.hpp"
+
+#include <cstring>
+
+// Silvanus.cpp is compiled with main renamed so we can run it on core 0
+int silvanus_main();
+// Or the LED driver check in LedCheck.cpp
+int ledCheckMain();
+
+int main(int argc, char** argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--led-check") == 0)
+    {
+      sim::runFirmware(argc, argv, ledCheckMain);
+    }
+  }
+  sim::runFirmware(argc, argv, silvanus_main);
+}
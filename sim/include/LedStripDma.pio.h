@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stand-in for the header pioasm generates from LedStripDma.pio
+
+#include <hardware/pio.h>
+
+extern const pio_program_t silvanus_ws2812_program;
+
+void silvanus_ws2812_program_init(PIO pio, uint sm, uint offset, uint pin, float freq);
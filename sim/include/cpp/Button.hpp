@@ -0,0 +1,35 @@
+#pragma once
+
+// Host stand-in for pi-pico-cpp's polled, debounced button. Presses come
+// from the simulator's --press option.
+
+#include <pico/time.h>
+
+class GPIOButton
+{
+public:
+  GPIOButton(uint pin, bool enableHold = false);
+  void update();
+  void debounce(int samples);
+  void holdActivationMs(int ms);
+  void holdActivationRepeatMs(int ms);
+
+  bool pressed() const;
+  bool buttonDown() const;
+  bool buttonUp() const;
+  bool heldActivate() const;
+private:
+  uint pin_;
+  bool enableHold_;
+  int debounceSamples_ = 1;
+  int holdActivationMs_ = 1000;
+  int holdActivationRepeatMs_ = 1000;
+
+  bool pressed_ = false;
+  int pendingSamples_ = 0;
+  bool buttonDown_ = false;
+  bool buttonUp_ = false;
+  bool heldActivate_ = false;
+  bool heldFired_ = false;
+  absolute_time_t nextHoldActivation_ = nil_time;
+};
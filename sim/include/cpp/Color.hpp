@@ -0,0 +1,62 @@
+#pragma once
+
+// Host stand-in for pi-pico-cpp's color types
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+struct RGBColor
+{
+  uint8_t r = 0;
+  uint8_t g = 0;
+  uint8_t b = 0;
+
+  RGBColor operator*(float scale) const
+  {
+    return
+    {
+      (uint8_t)std::clamp((float)r * scale, 0.0f, 255.0f),
+      (uint8_t)std::clamp((float)g * scale, 0.0f, 255.0f),
+      (uint8_t)std::clamp((float)b * scale, 0.0f, 255.0f),
+    };
+  }
+
+  bool operator==(const RGBColor& other) const
+  {
+    return r == other.r && g == other.g && b == other.b;
+  }
+
+  bool operator!=(const RGBColor& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+struct HSVColor
+{
+  float h; // degrees
+  float s; // 0..1
+  float v; // 0..1
+
+  RGBColor toRGB() const
+  {
+    float c = v * s;
+    float hp = std::fmod(h, 360.0f) / 60.0f;
+    float x = c * (1.0f - std::fabs(std::fmod(hp, 2.0f) - 1.0f));
+    float m = v - c;
+    float r = 0, g = 0, b = 0;
+    if (hp < 1)      { r = c; g = x; }
+    else if (hp < 2) { r = x; g = c; }
+    else if (hp < 3) { g = c; b = x; }
+    else if (hp < 4) { g = x; b = c; }
+    else if (hp < 5) { r = x; b = c; }
+    else             { r = c; b = x; }
+    return
+    {
+      (uint8_t)std::clamp((r + m) * 255.0f, 0.0f, 255.0f),
+      (uint8_t)std::clamp((g + m) * 255.0f, 0.0f, 255.0f),
+      (uint8_t)std::clamp((b + m) * 255.0f, 0.0f, 255.0f),
+    };
+  }
+};
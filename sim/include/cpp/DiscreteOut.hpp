@@ -0,0 +1,16 @@
+#pragma once
+
+// Host stand-in for pi-pico-cpp's digital output
+
+#include <pico/types.h>
+
+class DiscreteOut
+{
+public:
+  DiscreteOut(uint pin, bool value = false, bool invert = false, bool openDrain = false);
+  void set(bool value);
+  bool get() const;
+private:
+  uint pin_;
+  bool value_;
+};
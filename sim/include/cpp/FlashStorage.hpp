@@ -0,0 +1,83 @@
+#pragma once
+
+// Host stand-in for pi-pico-cpp's FlashStorage: keeps a T plus a small
+// header in the last sector of the simulated flash.
+
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#include <pico/multicore.h>
+
+#include <cstring>
+
+template <typename T>
+class FlashStorage
+{
+  static constexpr uint32_t Magic = 0x534c564e;
+  static constexpr uint32_t Offset = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t checksum;
+  };
+
+  static_assert(sizeof(Header) + sizeof(T) <= FLASH_SECTOR_SIZE, "FlashStorage type too large");
+
+  static uint32_t checksum(const T& val)
+  {
+    // FNV-1a, all we need is to tell a valid image from garbage
+    uint32_t hash = 2166136261u;
+    const uint8_t* bytes = (const uint8_t*)&val;
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+public:
+  T data;
+
+  bool readFromFlash()
+  {
+    const uint8_t* src = (const uint8_t*)(XIP_BASE + Offset);
+    Header header;
+    memcpy(&header, src, sizeof(Header));
+    if (header.magic != Magic || header.size != sizeof(T))
+    {
+      return false;
+    }
+    T val;
+    memcpy(&val, src + sizeof(Header), sizeof(T));
+    if (header.checksum != checksum(val))
+    {
+      return false;
+    }
+    data = val;
+    return true;
+  }
+
+  bool writeToFlash()
+  {
+    const uint8_t* src = (const uint8_t*)(XIP_BASE + Offset);
+    Header header {Magic, sizeof(T), checksum(data)};
+    if (memcmp(src, &header, sizeof(Header)) == 0 && memcmp(src + sizeof(Header), &data, sizeof(T)) == 0)
+    {
+      return false;
+    }
+
+    static uint8_t page[((sizeof(Header) + sizeof(T) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE) * FLASH_PAGE_SIZE];
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, &header, sizeof(Header));
+    memcpy(page + sizeof(Header), &data, sizeof(T));
+
+    multicore_lockout_start_blocking();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(Offset, FLASH_SECTOR_SIZE);
+    flash_range_program(Offset, page, sizeof(page));
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+    return true;
+  }
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+// Host stand-in for pi-pico-cpp's WS2812B driver. Writes take as long as
+// the real strip would keep the calling core busy.
+
+#include <cpp/Color.hpp>
+
+#include <pico/types.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using LEDBuffer = std::vector<RGBColor>;
+
+class LedStripWs2812b
+{
+public:
+  LedStripWs2812b(uint pin);
+  void writeColors(const LEDBuffer& buffer);
+private:
+  uint pin_;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <pico.h>
+
+enum clock_index
+{
+  clk_sys = 5,
+};
+
+// The simulated clocks run at the RP2040 defaults
+uint32_t clock_get_hz(enum clock_index clk_index);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <pico.h>
+
+#define DMA_IRQ_0 11
+#define IO_IRQ_BANK0 13
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_enabled(uint num, bool enabled);
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
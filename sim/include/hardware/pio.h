@@ -0,0 +1,24 @@
+#pragma once
+
+#include <pico.h>
+
+// Just enough of a PIO block to load a program and point DMA at a FIFO
+typedef struct
+{
+  volatile uint32_t txf[4];
+} pio_hw_t;
+
+typedef pio_hw_t* PIO;
+
+extern pio_hw_t pio0_hw_sim;
+#define pio0 (&pio0_hw_sim)
+
+typedef struct
+{
+  const uint16_t* instructions;
+  uint8_t length;
+} pio_program_t;
+
+int pio_claim_unused_sm(PIO pio, bool required);
+uint pio_add_program(PIO pio, const pio_program_t* program);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <pico.h>
+
+// The simulator's SysTick counts down at the simulated clock rate with the
+// host's own time rather than the virtual clock, which stands still while
+// code runs. Cycle counts taken from it are what the host spent.
+struct SimSystickCvr
+{
+  operator uint32_t() const;
+  SimSystickCvr& operator=(uint32_t value)
+  {
+    return *this;
+  }
+};
+
+typedef struct
+{
+  uint32_t csr;
+  uint32_t rvr;
+  SimSystickCvr cvr;
+  uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t simSystick;
+#define systick_hw (&simSystick)
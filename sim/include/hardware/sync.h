@@ -0,0 +1,12 @@
+#pragma once
+
+#include <pico.h>
+
+// Interrupts are global in the simulator rather than per core. While they
+// are disabled, timed events (alarms, edges...) wait and run late.
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+static inline void __dmb() {}
+
+void __wfe();
+void __sev();
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <pico.h>
+
+[[noreturn]] void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms);
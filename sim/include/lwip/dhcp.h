@@ -0,0 +1,15 @@
+#pragma once
+
+#include <lwip/err.h>
+#include <lwip/netif.h>
+
+struct dhcp
+{
+  u32_t offered_t0_lease; // seconds
+};
+
+#define netif_dhcp_data(netif) ((netif)->dhcp)
+
+err_t dhcp_start(struct netif* netif);
+void dhcp_stop(struct netif* netif);
+u8_t dhcp_supplied_address(const struct netif* netif);
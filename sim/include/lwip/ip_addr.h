@@ -0,0 +1,22 @@
+#pragma once
+
+#include <lwip/arch.h>
+
+typedef struct
+{
+  u32_t addr;
+} ip_addr_t;
+
+// IPv4 only, like the firmware's lwIP build
+typedef ip_addr_t ip4_addr_t;
+
+#define IPADDR_TYPE_V4 0U
+#define IPADDR_TYPE_ANY 46U
+
+#define ip_addr_cmp(addr1, addr2) ((addr1)->addr == (addr2)->addr)
+#define ip_2_ip4(ipaddr) (ipaddr)
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+#define ip_addr_set_ip4_u32(ipaddr, val) ((ipaddr)->addr = (val))
+#define ip4_addr_set_u32(dest_ipaddr, src_u32) ((dest_ipaddr)->addr = (src_u32))
+
+const char* ipaddr_ntoa(const ip_addr_t* addr);
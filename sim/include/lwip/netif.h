@@ -0,0 +1,19 @@
+#pragma once
+
+#include <lwip/ip_addr.h>
+
+struct dhcp;
+
+struct netif
+{
+  ip4_addr_t ip_addr;
+  ip4_addr_t netmask;
+  ip4_addr_t gw;
+  struct dhcp* dhcp;
+};
+
+#define netif_ip4_addr(netif) ((const ip4_addr_t*)&((netif)->ip_addr))
+#define netif_ip4_netmask(netif) ((const ip4_addr_t*)&((netif)->netmask))
+#define netif_ip4_gw(netif) ((const ip4_addr_t*)&((netif)->gw))
+
+void netif_set_addr(struct netif* netif, const ip4_addr_t* ipaddr, const ip4_addr_t* netmask, const ip4_addr_t* gw);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <lwip/err.h>
+
+typedef enum
+{
+  PBUF_TRANSPORT,
+  PBUF_IP,
+  PBUF_RAW,
+} pbuf_layer;
+
+typedef enum
+{
+  PBUF_RAM,
+  PBUF_POOL,
+} pbuf_type;
+
+struct pbuf
+{
+  struct pbuf* next;
+  void* payload;
+  u16_t tot_len;
+  u16_t len;
+};
+
+struct pbuf* pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+u8_t pbuf_free(struct pbuf* p);
+u8_t pbuf_get_at(const struct pbuf* p, u16_t offset);
+u16_t pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset);
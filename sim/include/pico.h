@@ -0,0 +1,29 @@
+#pragma once
+
+// Host stand-in for the pico-sdk base header. Only the parts of the SDK
+// silvanus-pico uses are provided, backed by the simulation kernel in
+// sim/Sim.hpp.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef unsigned int uint;
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+
+typedef struct
+{
+  int16_t year;  ///< 0..4095
+  int8_t month;  ///< 1..12, 1 is January
+  int8_t day;    ///< 1..28,29,30,31 depending on month
+  int8_t dotw;   ///< 0..6, 0 is Sunday
+  int8_t hour;   ///< 0..23
+  int8_t min;    ///< 0..59
+  int8_t sec;    ///< 0..59
+} datetime_t;
+
+uint get_core_num();
+void tight_loop_contents();
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <pico/time.h>
+#include <lwip/netif.h>
+
+#include <stddef.h>
+
+// Just enough of the CYW43 driver for station mode
+typedef struct
+{
+  struct netif netif[2];
+} cyw43_t;
+
+extern cyw43_t cyw43_state;
+
+#define CYW43_ITF_STA 0
+#define CYW43_AUTH_WPA2_AES_PSK 0x00400004
+#define CYW43_CHANNEL_NONE 0xffffffff
+#define CYW43_IOCTL_GET_CHANNEL 0x3a
+
+#define CYW43_LINK_DOWN 0
+#define CYW43_LINK_JOIN 1
+#define CYW43_LINK_NOIP 2
+#define CYW43_LINK_UP 3
+#define CYW43_LINK_FAIL -1
+#define CYW43_LINK_NONET -2
+#define CYW43_LINK_BADAUTH -3
+
+int cyw43_arch_init();
+void cyw43_arch_deinit();
+void cyw43_arch_enable_sta_mode();
+int cyw43_arch_wifi_connect_async(const char* ssid, const char* pw, uint32_t auth);
+int cyw43_tcpip_link_status(cyw43_t* self, int itf);
+int cyw43_wifi_join(cyw43_t* self, size_t ssid_len, const uint8_t* ssid, size_t key_len, const uint8_t* key,
+                    uint32_t auth_type, const uint8_t* bssid, uint32_t channel);
+int cyw43_wifi_leave(cyw43_t* self, int itf);
+int cyw43_wifi_get_bssid(cyw43_t* self, uint8_t bssid[6]);
+int cyw43_ioctl(cyw43_t* self, uint32_t cmd, size_t len, uint8_t* buf, uint32_t iface);
+
+// lwIP is driven by polling (pico_cyw43_arch_lwip_poll), so network
+// callbacks only ever run from inside these two calls
+void cyw43_arch_poll();
+void cyw43_arch_wait_for_work_until(absolute_time_t until);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <pico.h>
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1();
+void multicore_lockout_victim_init();
+void multicore_lockout_start_blocking();
+void multicore_lockout_end_blocking();
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <pico.h>
+
+typedef struct
+{
+  int owner;
+} mutex_t;
+
+void mutex_init(mutex_t* mtx);
+void mutex_enter_blocking(mutex_t* mtx);
+bool mutex_try_enter(mutex_t* mtx, uint32_t* owner_out);
+void mutex_exit(mutex_t* mtx);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <pico.h>
+
+bool stdio_init_all();
+int getchar_timeout_us(uint32_t timeout_us);
+void stdio_set_chars_available_callback(void (*fn)(void*), void* param);
+int putchar_raw(int c);
+void stdio_flush();
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <pico.h>
+#include <pico/stdio.h>
+#include <pico/time.h>
@@ -0,0 +1,384 @@
+#!/usr/bin/env python3
+"""Talks to silvanus-pico's serial console, in text or the binary protocol.
+
+Connects to a board on a serial port, or runs the simulator and talks to it
+over its stdin/stdout, then either runs one operation or benchmarks the two
+protocols against each other: round trip time of a single set, and the
+throughput of many sets in a row.
+
+    tools/silvanus_client.py --sim _build/sim/silvanus-sim status
+    tools/silvanus_client.py --port /dev/ttyACM0 get 17
+    tools/silvanus_client.py --sim _build/sim/silvanus-sim bench
+
+The serial port needs pyserial (pip install pyserial), the simulator doesn't.
+"""
+
+import argparse
+import os
+import select
+import struct
+import subprocess
+import sys
+import time
+
+MAGIC = b"SV"
+
+OP_GET = 1
+OP_SET = 2
+OP_STATUS = 3
+OP_FLASH = 4
+OP_DEFAULTS = 5
+
+STATUS_NAMES = ["ok", "unchanged", "unknown op", "unknown field", "bad length", "out of range"]
+
+PUMP_FIELD_BASE = 16
+LIGHT_FIELD_BASE = 32
+
+# id -> (name, struct format, or None for strings)
+FIELDS = {0: ("wifiSsid", None), 1: ("wifiPassword", None), 2: ("offsetFromUtc", "<f")}
+for _pump in range(4):
+    for _prop, (_name, _fmt) in enumerate([("enable", "<?"), ("rate", "<f"), ("amount", "<f"), ("activationTime", "<i")]):
+        FIELDS[PUMP_FIELD_BASE + 4 * _pump + _prop] = ("pump %d %s" % (_pump + 1, _name), _fmt)
+for _light in range(2):
+    for _prop, (_name, _fmt) in enumerate([("enable", "<?"), ("onTime", "<i"), ("offTime", "<i")]):
+        FIELDS[LIGHT_FIELD_BASE + 4 * _light + _prop] = ("light %d %s" % (_light + 1, _name), _fmt)
+
+STATUS_BLOCK = struct.Struct("<IIBBBBIII")
+WIFI_STATES = ["off", "joining", "addressing", "up", "waiting to retry"]
+CLOCK_STATES = ["not set", "estimated from flash", "synced with NTP"]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, as in Frame.hpp"""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos = 0
+    code = 1
+    for b in data:
+        if b != 0:
+            out.append(b)
+            code += 1
+        if b == 0 or code == 0xFF:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            raise ValueError("bad COBS")
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class Connection:
+    """Bytes to and from the console, with text and frames split apart"""
+
+    def __init__(self, write, read):
+        self._write = write
+        self._read = read
+        self._buf = bytearray()
+        self.text = bytearray()
+        self.frames = []
+
+    def send(self, data):
+        self._write(data)
+
+    def _pump(self, timeout):
+        data = self._read(timeout)
+        if not data:
+            return
+        self._buf += data
+        while True:
+            start = self._buf.find(0)
+            if start < 0:
+                self.text += self._buf
+                self._buf.clear()
+                return
+            end = self._buf.find(0, start + 1)
+            if end < 0:
+                # Keep the partial frame for next time
+                self.text += self._buf[:start]
+                del self._buf[:start]
+                return
+            self.text += self._buf[:start]
+            encoded = bytes(self._buf[start + 1:end])
+            del self._buf[:end + 1]
+            if encoded:
+                self.frames.append(encoded)
+
+    def wait_text(self, marker, timeout=5.0):
+        """Wait for marker to show up in the text, and take everything up to
+        it out. Returns the text before the marker."""
+        deadline = time.monotonic() + timeout
+        while marker not in self.text:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise TimeoutError("no %r from the console" % marker)
+            self._pump(remaining)
+        end = self.text.index(marker)
+        before = bytes(self.text[:end])
+        del self.text[:end + len(marker)]
+        return before
+
+    def wait_frame(self, timeout=5.0):
+        deadline = time.monotonic() + timeout
+        while not self.frames:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise TimeoutError("no reply frame")
+            self._pump(remaining)
+        return self.frames.pop(0)
+
+    def drain(self, quiet=0.3):
+        """Read until the console has been quiet for a moment, and forget it"""
+        while True:
+            before = len(self.text) + len(self._buf)
+            self._pump(quiet)
+            if len(self.text) + len(self._buf) == before:
+                break
+        self.text.clear()
+        self.frames.clear()
+
+
+def open_serial(port, baud):
+    try:
+        import serial
+    except ImportError:
+        sys.exit("talking to a serial port needs pyserial: pip install pyserial")
+    s = serial.Serial(port, baud, timeout=0)
+
+    def read(timeout):
+        s.timeout = timeout
+        first = s.read(1)
+        return first + s.read(s.in_waiting) if first else b""
+
+    return Connection(s.write, read), lambda: s.close()
+
+
+def open_sim(path, extra):
+    proc = subprocess.Popen([path, "--realtime"] + extra, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL, bufsize=0)
+    fd = proc.stdout.fileno()
+
+    def write(data):
+        proc.stdin.write(data)
+        proc.stdin.flush()
+
+    def read(timeout):
+        ready, _, _ = select.select([fd], [], [], timeout)
+        return os.read(fd, 65536) if ready else b""
+
+    def close():
+        proc.kill()
+        proc.wait()
+
+    return Connection(write, read), close
+
+
+class Client:
+    def __init__(self, conn):
+        self.conn = conn
+        self.seq = 0
+
+    def request(self, ops):
+        """Send a batch of ops in one frame, and return the reply's payload after the header"""
+        self.seq = (self.seq + 1) & 0xFF
+        payload = MAGIC + bytes([self.seq]) + ops
+        crc = crc16(payload)
+        payload += bytes([crc & 0xFF, crc >> 8])
+        self.conn.send(b"\0" + cobs_encode(payload) + b"\0")
+        while True:
+            reply = cobs_decode(self.conn.wait_frame())
+            if len(reply) < 5 or reply[:2] != MAGIC or crc16(reply[:-2]) != reply[-2] | reply[-1] << 8:
+                raise ValueError("bad reply frame")
+            if reply[2] == self.seq:
+                return reply[3:-2]
+
+    def command(self, line):
+        """Send a text command and wait for its ok"""
+        self.conn.send(line.encode() + b"\n")
+        self.conn.wait_text(b"ok\n")
+
+    @staticmethod
+    def set_op(field, value):
+        _, fmt = FIELDS[field]
+        data = value.encode() if fmt is None else struct.pack(fmt, value)
+        return bytes([OP_SET, field, len(data)]) + data
+
+    @staticmethod
+    def parse_replies(reply):
+        """Split a reply into (op, status, data) tuples"""
+        results = []
+        i = 0
+        while i < len(reply):
+            op, status = reply[i], reply[i + 1]
+            i += 2
+            data = b""
+            # A request cut short ends the reply without the field id
+            if op in (OP_GET, OP_SET) and i < len(reply):
+                field = reply[i]
+                i += 1
+                data = bytes([field])
+                if op == OP_GET and status == 0:
+                    size = reply[i]
+                    data += reply[i + 1:i + 1 + size]
+                    i += 1 + size
+            elif op == OP_STATUS and status == 0:
+                size = reply[i]
+                data = reply[i + 1:i + 1 + size]
+                i += 1 + size
+            results.append((op, status, data))
+        return results
+
+
+def field_value(field, data):
+    _, fmt = FIELDS[field]
+    if fmt is None:
+        return data.decode(errors="replace")
+    value = struct.unpack(fmt, data)[0]
+    return "%g" % value if fmt == "<f" else value
+
+
+def parse_value(field, text):
+    if field not in FIELDS:
+        sys.exit("unknown field %d" % field)
+    _, fmt = FIELDS[field]
+    if fmt is None:
+        return text
+    if fmt == "<f":
+        return float(text)
+    if fmt == "<?":
+        return text.lower() in ("1", "true", "on", "yes")
+    return int(text)
+
+
+def print_status(data):
+    uptime, utc, clock, wifi, pumps, lights, wakeups, frames, errors = STATUS_BLOCK.unpack(data[:STATUS_BLOCK.size])
+    print("uptime: %.1f s" % (uptime / 1000))
+    print("clock: %s%s" % (CLOCK_STATES[clock], ", UTC %s" % time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(utc)) if utc else ""))
+    print("WiFi: %s" % WIFI_STATES[wifi])
+    print("pumps on: %s" % (", ".join(str(p + 1) for p in range(4) if pumps >> p & 1) or "none"))
+    print("lights on: %s" % (", ".join(str(l + 1) for l in range(2) if lights >> l & 1) or "none"))
+    print("main loop wakeups: %d" % wakeups)
+    print("binary frames: %d, bad %d" % (frames, errors))
+
+
+def percentile(samples, p):
+    s = sorted(samples)
+    return s[min(len(s) - 1, int(len(s) * p))]
+
+
+def bench(client, count):
+    # Alternate the rate so every set is a real change
+    rates = [1.0 + (i % 10) for i in range(count)]
+    field = PUMP_FIELD_BASE + 1
+
+    def report(name, rtts, total, n):
+        rtts_ms = [r * 1000 for r in rtts]
+        print("%-22s median %7.2f ms  p95 %7.2f ms  %8.0f sets/s" %
+              (name, percentile(rtts_ms, 0.5), percentile(rtts_ms, 0.95), n / total))
+
+    text_rtts = []
+    start = time.monotonic()
+    for rate in rates:
+        t = time.monotonic()
+        client.command("pump 1 rate %g" % rate)
+        text_rtts.append(time.monotonic() - t)
+    report("text, one per line", text_rtts, time.monotonic() - start, count)
+
+    binary_rtts = []
+    start = time.monotonic()
+    for rate in rates:
+        t = time.monotonic()
+        client.request(Client.set_op(field, rate))
+        binary_rtts.append(time.monotonic() - t)
+    report("binary, one per frame", binary_rtts, time.monotonic() - start, count)
+
+    # As many sets as fit in a frame
+    batch = 100
+    batch_rtts = []
+    start = time.monotonic()
+    for first in range(0, count, batch):
+        ops = b"".join(Client.set_op(field, rate) for rate in rates[first:first + batch])
+        t = time.monotonic()
+        replies = Client.parse_replies(client.request(ops))
+        batch_rtts.append(time.monotonic() - t)
+        if len(replies) != len(rates[first:first + batch]) or any(status != 0 for _, status, _ in replies):
+            raise RuntimeError("batch set failed")
+    report("binary, %d per frame" % batch, batch_rtts, time.monotonic() - start, count)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    where = parser.add_mutually_exclusive_group(required=True)
+    where.add_argument("--port", help="serial port of the board")
+    where.add_argument("--sim", help="path to silvanus-sim, run for the session")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--sim-arg", action="append", default=[], help="extra argument for the simulator")
+    sub = parser.add_subparsers(dest="action", required=True)
+    sub.add_parser("status", help="print the status block")
+    get = sub.add_parser("get", help="read settings fields by id")
+    get.add_argument("fields", type=int, nargs="*", help="field ids, all of them if none")
+    set_ = sub.add_parser("set", help="set a settings field")
+    set_.add_argument("field", type=int)
+    set_.add_argument("value")
+    sub.add_parser("flash", help="write the settings to flash")
+    sub.add_parser("defaults", help="reset the settings to their defaults")
+    b = sub.add_parser("bench", help="compare round trips and throughput of text and binary")
+    b.add_argument("--count", type=int, default=500)
+    args = parser.parse_args()
+
+    conn, close = open_sim(args.sim, args.sim_arg) if args.sim else open_serial(args.port, args.baud)
+    try:
+        # Let the boot messages go by
+        conn.drain()
+        client = Client(conn)
+        if args.action == "status":
+            ops = bytes([OP_STATUS])
+        elif args.action == "get":
+            ops = b"".join(bytes([OP_GET, f]) for f in (args.fields or sorted(FIELDS)))
+        elif args.action == "set":
+            ops = Client.set_op(args.field, parse_value(args.field, args.value))
+        elif args.action == "flash":
+            ops = bytes([OP_FLASH])
+        elif args.action == "defaults":
+            ops = bytes([OP_DEFAULTS])
+        else:
+            bench(client, args.count)
+            return
+
+        for op, status, data in Client.parse_replies(client.request(ops)):
+            if status not in (0, 1):
+                print("op %d: %s%s" % (op, STATUS_NAMES[status] if status < len(STATUS_NAMES) else status,
+                                       " (field %d)" % data[0] if data else ""))
+            elif op == OP_STATUS:
+                print_status(data)
+            elif op == OP_GET:
+                print("%2d %-22s %s" % (data[0], FIELDS[data[0]][0], field_value(data[0], data[1:])))
+            else:
+                print(STATUS_NAMES[status])
+    finally:
+        close()
+
+
+if __name__ == "__main__":
+    main()
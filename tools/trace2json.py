@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""Turns a silvanus-pico event trace into Chrome / Perfetto trace JSON.
+
+The trace is what the trace dump serial command prints. Read it from a
+file (or stdin), or fetch it straight from a board or the simulator:
+
+    tools/trace2json.py dump.txt -o trace.json
+    tools/trace2json.py --port /dev/ttyACM0 -o trace.json
+    tools/trace2json.py --sim _build/sim/silvanus-sim --sim-arg=--press --sim-arg=1@2 --wait 5 -o trace.json
+
+Open the result in https://ui.perfetto.dev or chrome://tracing. Pumps,
+lights, flash writes, NTP phases and animation layers each get a track of
+their own, button edges are instant events.
+"""
+
+import argparse
+import json
+import sys
+import time
+
+# Keep in step with TraceEvent in Trace.hpp
+PUMP_ON = 1
+PUMP_OFF = 2
+LIGHT_ON = 3
+LIGHT_OFF = 4
+BUTTON = 5
+NTP_STATE = 6
+FLASH_BEGIN = 7
+FLASH_END = 8
+ANIMATION = 9
+
+NO_ARG = 0xFFFFFFFF
+
+NTP_STATES = ["idle", "connecting", "resolving", "sending", "awaiting", "done", "failed"]
+FLASH_WHAT = ["settings", "checkpoint", "schedule"]
+ANIMATIONS = ["idle", "errorIdle", "blank", "wifi", "alert", "ok", "water-progress"]
+BUTTONS = {0: "water button", 1: "light button"}
+
+# Track ids
+PUMP_TRACK = 1
+LIGHT_TRACK = 11
+FLASH_TRACK = 20
+NTP_TRACK = 21
+BUTTON_TRACK = 22
+ANIMATION_TRACK = 30
+
+
+def parse(lines):
+    """The events in a dump as (time us, event, arg0, arg1), with the 32 bit
+    times unwrapped, and the time the dump was taken"""
+    events = []
+    now = None
+    offset = 0
+    last = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("trace:") and "now" in line:
+            now = int(line.rsplit(" ", 1)[1])
+        if not line.startswith("T "):
+            continue
+        t, event, arg0, arg1 = (int(x) for x in line.split()[1:5])
+        if last is not None and t + offset < last - (1 << 31):
+            offset += 1 << 32
+        last = t + offset
+        events.append((last, event, arg0, arg1))
+    if now is not None and events:
+        now += offset
+        if now < events[-1][0]:
+            now += 1 << 32
+    return events, now
+
+
+def convert(events, now):
+    out = []
+
+    def meta(tid, name):
+        out.append({"ph": "M", "pid": 1, "tid": tid, "name": "thread_name", "args": {"name": name}})
+
+    def span(tid, name, start, end, args=None):
+        out.append({"ph": "X", "pid": 1, "tid": tid, "name": name, "ts": start, "dur": max(end - start, 0),
+                    "args": args or {}})
+
+    def instant(tid, name, t, args=None):
+        out.append({"ph": "i", "s": "t", "pid": 1, "tid": tid, "name": name, "ts": t, "args": args or {}})
+
+    out.append({"ph": "M", "pid": 1, "name": "process_name", "args": {"name": "silvanus-pico"}})
+    tracks = set()
+
+    def track(tid, name):
+        if tid not in tracks:
+            tracks.add(tid)
+            meta(tid, name)
+
+    # What's open on each track: (start, name, args)
+    open_spans = {}
+    end_time = now if now is not None else (events[-1][0] if events else 0)
+
+    def begin(tid, t, name, args=None):
+        close(tid, t)
+        open_spans[tid] = (t, name, args or {})
+
+    def close(tid, t, args=None):
+        if tid in open_spans:
+            start, name, start_args = open_spans.pop(tid)
+            span(tid, name, start, t, dict(start_args, **(args or {})))
+
+    def lateness(arg):
+        return {"by hand": True} if arg == NO_ARG else {"late us": arg}
+
+    for t, event, arg0, arg1 in events:
+        if event == PUMP_ON:
+            tid = PUMP_TRACK + arg0
+            track(tid, "pump %d" % (arg0 + 1))
+            begin(tid, t, "on", {"on": lateness(arg1)})
+        elif event == PUMP_OFF:
+            tid = PUMP_TRACK + arg0
+            track(tid, "pump %d" % (arg0 + 1))
+            if tid in open_spans:
+                close(tid, t, {"off": lateness(arg1)})
+            else:
+                # Switched on before the oldest event in the ring
+                instant(tid, "off", t, {"off": lateness(arg1)})
+        elif event in (LIGHT_ON, LIGHT_OFF):
+            tid = LIGHT_TRACK + arg0
+            track(tid, "light %d" % (arg0 + 1))
+            if event == LIGHT_ON:
+                begin(tid, t, "on")
+            elif tid in open_spans:
+                close(tid, t)
+            else:
+                instant(tid, "off", t)
+        elif event == BUTTON:
+            track(BUTTON_TRACK, "buttons")
+            name = BUTTONS.get(arg0, "GPIO %d" % arg0)
+            instant(BUTTON_TRACK, "%s %s" % (name, "released" if arg1 else "pressed"), t)
+        elif event == NTP_STATE:
+            track(NTP_TRACK, "NTP")
+            state = NTP_STATES[arg0] if arg0 < len(NTP_STATES) else str(arg0)
+            if state in ("idle", "done", "failed"):
+                close(NTP_TRACK, t, {"result": state})
+                instant(NTP_TRACK, state, t)
+            else:
+                begin(NTP_TRACK, t, state)
+        elif event == FLASH_BEGIN:
+            track(FLASH_TRACK, "flash")
+            what = FLASH_WHAT[arg0] if arg0 < len(FLASH_WHAT) else str(arg0)
+            begin(FLASH_TRACK, t, "%s %s" % (what, "erase" if arg1 else "program"))
+        elif event == FLASH_END:
+            track(FLASH_TRACK, "flash")
+            close(FLASH_TRACK, t, {"lockout us": arg1})
+        elif event == ANIMATION:
+            tid = ANIMATION_TRACK + arg0
+            track(tid, "animation layer %d" % arg0)
+            if arg1 == NO_ARG:
+                close(tid, t)
+            else:
+                begin(tid, t, ANIMATIONS[arg1] if arg1 < len(ANIMATIONS) else str(arg1))
+        else:
+            track(0, "other")
+            instant(0, "event %d" % event, t, {"arg0": arg0, "arg1": arg1})
+
+    # Whatever was still going when the trace was dumped
+    for tid in list(open_spans):
+        close(tid, end_time, {"still going": True})
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def fetch(args):
+    """Send trace dump and collect its lines"""
+    import silvanus_client
+
+    if args.sim:
+        conn, close = silvanus_client.open_sim(args.sim, args.sim_arg)
+    else:
+        conn, close = silvanus_client.open_serial(args.port, args.baud)
+    try:
+        conn.drain()
+        if args.wait:
+            time.sleep(args.wait)
+            conn.drain()
+        conn.send(b"trace dump\n")
+        conn.wait_text(b"trace dump\n")
+        return conn.wait_text(b"ok\n", timeout=30).decode(errors="replace").splitlines()
+    finally:
+        close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("dump", nargs="?", help="trace dump output, stdin if left out")
+    parser.add_argument("--port", help="fetch the trace from the board on this serial port")
+    parser.add_argument("--sim", help="fetch the trace from this silvanus-sim")
+    parser.add_argument("--sim-arg", action="append", default=[], help="extra argument for the simulator")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--wait", type=float, default=0, help="seconds to let it run before fetching")
+    parser.add_argument("-o", "--output", help="where to write the JSON, stdout if left out")
+    args = parser.parse_args()
+
+    if args.port or args.sim:
+        lines = fetch(args)
+    elif args.dump:
+        with open(args.dump) as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    events, now = parse(lines)
+    result = convert(events, now)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(result, f)
+        print("%d events -> %s" % (len(events), args.output), file=sys.stderr)
+    else:
+        json.dump(result, sys.stdout, indent=1)
+        print()
+
+
+if __name__ == "__main__":
+    main()